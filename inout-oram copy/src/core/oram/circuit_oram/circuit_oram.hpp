@@ -0,0 +1,468 @@
+#pragma once
+#include <math.h>
+
+#include <algorithm>
+#include <bit>
+#include <map>
+#include <optional>
+#include <vector>
+
+#include "oram/common/block.hpp"
+#include "oram/common/bucket_arena.hpp"
+#include "oram/common/oram_client.hpp"
+#include "oram/common/position_map.hpp"
+#include "oram/common/stash.hpp"
+#include "oram/path_oram/path_oram.hpp"
+#include "server/channel.hpp"
+#include "utils/cipher.hpp"
+#include "utils/crypto.hpp"
+#include "utils/random_gen.hpp"
+
+// Circuit ORAM client. The tree, buckets and channel are the ones of
+// PathORAMClient, but an access removes its block from the path right away
+// and eviction moves at most one block at a time along two paths per access
+// (reverse-lexicographic order), after a two-pass scan of the path metadata.
+// The stash therefore stays below a small constant; with a recursive
+// position map the client holds O(1) blocks between accesses. During an
+// access it holds the path being read or evicted, O(log N) buckets: the
+// metadata scan needs the whole path before any block moves. Buckets are
+// not authenticated: with ORAM_INTEGRITY, Construct refuses to build one.
+template <size_t B, size_t Z = common::kDefaultZ>
+class CircuitORAMClient : public common::ORAMClient<B> {
+ public:
+  bool successful = false;
+
+  inline static constexpr size_t BucketSize() { return PathORAMClient<B, Z>::BucketSize(); }
+
+  inline static constexpr size_t EncryptedBucketSize() { return PathORAMClient<B, Z>::EncryptedBucketSize(); }
+
+  using TPathORAMChannel = typename PathORAMClient<B, Z>::TPathORAMChannel;
+
+  static std::optional<CircuitORAMClient *> Construct(size_t n,
+            TPathORAMChannel channel,
+            utils::Key key,
+            PositionMapConfig pm = {},
+            size_t stash_capacity = 16) {
+    if constexpr (common::kIntegrity) {
+      throw std::logic_error("Circuit ORAM does not verify buckets and is not available with ORAM_INTEGRITY");
+    }
+    auto o = new CircuitORAMClient(n, std::move(channel), key, pm, stash_capacity);
+    if (o->successful) {
+      return o;
+    }
+
+    delete o;
+    return std::nullopt;
+  }
+
+  // Setup with the leaves drawn and the chunks of buckets serialized and
+  // encrypted by n_threads threads of ctx. Placement stays one sequential
+  // pass. With a seed, block i gets leaf Mix64(seed + i) (as
+  // PathORAMClient::ParInit), whatever the number of threads.
+  void ParInit(threadpool::threadpool_context *ctx, std::vector<common::Block<B>> &blocks, size_t n_threads,
+               std::optional<uint64_t> seed = std::nullopt) {
+    if (!successful)
+        return;
+
+    std::unique_ptr<threadpool::worker::DefaultParallelWorker> worker;
+    if (ctx) {
+      n_threads = std::min(n_threads, ctx->num_threads + 1);
+    }
+    if (ctx && n_threads > 1) {
+      worker = std::make_unique<threadpool::worker::DefaultParallelWorker>(ctx, n_threads);
+    }
+    Setup(blocks, worker.get(), seed);
+  }
+
+  void Init(std::vector<common::Block<B>> &blocks) override {
+    if (!successful)
+        return;
+
+    Setup(blocks, nullptr, std::nullopt);
+  }
+
+  void Read(ORKey w, common::Block<B> &data) override {
+    auto *b = access(w);
+    if (!b) {
+      throw std::runtime_error("Block not found");
+    }
+    data.key = b->key;
+    memcpy(data.val, b->val, B);
+  }
+
+  void Write(ORKey w, const uint8_t *data) {
+    if (auto *b = access(w)) {
+      memcpy(b->val, data, B);
+    }
+  }
+
+  void Evict() override {
+    evict_once(next_eviction_leaf());
+    evict_once(next_eviction_leaf());
+
+    if (stash_.size() > stash_capacity_) {
+      throw std::runtime_error("Stash size exceeded");
+    }
+  }
+
+  // Every access reads and rewrites its own path, so a batch is a sequence
+  // of accesses with the semantics of PathORAMClient::AccessBatch.
+  void AccessBatch(const std::vector<ORKey> &keys, const std::vector<AccessOp> &ops,
+                   std::vector<common::Block<B>> &data) override {
+    if (keys.size() != ops.size()) {
+      throw std::invalid_argument("AccessBatch: keys and ops must have the same length");
+    }
+    data.resize(keys.size());
+
+    for (size_t i = 0; i < keys.size(); i++) {
+      common::Block<B> *b = nullptr;
+      try {
+        b = access(keys[i]);
+      } catch (const std::out_of_range &) {
+        // Key outside the position map: still read and rewrite a random
+        // path and evict, so the batch keeps its shape
+        path_to_leaf(min_leaf_ + random_gen::generateRandomNumber(n_), path_);
+        read_path();
+        write_path();
+        data[i] = common::Block<B>();
+        Evict();
+        continue;
+      }
+
+      if (ops[i] == AccessOp::Write) {
+        if (!b) {
+          b = &stash_.insert(common::Block<B>(keys[i], data[i].val));
+          b->leaf = last_leaf_;
+        } else {
+          memcpy(b->val, data[i].val, B);
+        }
+      } else if (b) {
+        data[i] = *b;
+        data[i].leaf = 0;
+      } else {
+        data[i] = common::Block<B>();
+      }
+      Evict();
+    }
+  }
+
+  size_t ClientMemoryBytes() const override {
+    return pos_map_->memory_bytes() + stash_.memory_bytes();
+  }
+
+  size_t StashSize() const { return stash_.size(); }
+
+ protected:
+  std::unique_ptr<common::PositionMap> pos_map_;
+  common::Stash<B> stash_;
+  size_t n_, l_, min_leaf_, max_leaf_, stash_capacity_;
+  size_t bus_, en_bus_;
+  inline static constexpr size_t kMaxBucketsPerWrite = 1024;  // bounds the arenas during setup
+  TPathORAMChannel channel_;
+  utils::Key EK;
+  utils::CipherEngine cipher_;
+  size_t g_ = 0;        // Evictions since setup
+  Leaf last_leaf_ = 0;  // Leaf assigned by the last access
+
+  // Per-eviction scratch, indexed by path level: 0 is the stash, i >= 1 is
+  // the bucket on tree level i - 1. -1 stands for none.
+  std::vector<ORBucketID> path_;
+  std::vector<common::Bucket<B, Z>> buckets_;
+  common::BucketArena enc_arena_{EncryptedBucketSize()}, plain_arena_{BucketSize()};  // buffers of path_
+  std::vector<int> deepest_, target_;
+
+  CircuitORAMClient(size_t n,
+        TPathORAMChannel channel,
+        utils::Key key,
+        PositionMapConfig pm,
+        size_t stash_capacity)
+      : n_(n), stash_capacity_(stash_capacity), channel_(std::move(channel)), EK(key), cipher_(key) {
+    bus_ = BucketSize();
+    en_bus_ = EncryptedBucketSize();
+    l_ = std::ceil(log2(n_));
+    min_leaf_ = (1ULL << l_) - 1;
+    max_leaf_ = min_leaf_ << 1;
+    if (pm.type != common::PositionMapType::Recursive) {
+      pos_map_ = common::MakePositionMap(pm.type, n_, l_, min_leaf_);
+    } else if (n_ > pm.recursion_cutoff) {
+      pos_map_ = std::make_unique<RecursivePositionMap<B>>(n_, l_, min_leaf_, pm, key);
+    } else {
+      pos_map_ = common::MakePositionMap(common::PositionMapType::Dense, n_, l_, min_leaf_);
+    }
+
+    successful = true;
+  }
+
+  // Level of the deepest common bucket of the paths to two leaves
+  inline size_t common_depth(Leaf a, Leaf b) const {
+    return l_ - std::bit_width((static_cast<uint64_t>(a) + 1) ^ (static_cast<uint64_t>(b) + 1));
+  }
+
+  Leaf next_eviction_leaf() {
+    uint64_t g = g_++, rev = 0;
+    for (size_t i = 0; i < l_; i++, g >>= 1) {
+      rev = (rev << 1) | (g & 1);
+    }
+    return min_leaf_ + rev;
+  }
+
+  // Root-to-leaf bucket ids of the path to leaf
+  void path_to_leaf(Leaf leaf, std::vector<ORBucketID> &path) {
+    path.resize(l_ + 1);
+    ORBucketID cur_id = leaf;
+    for (size_t level = l_ + 1; level-- > 0;) {
+      path[level] = cur_id;
+      cur_id = cur_id == 0 ? 0 : (cur_id - 1) / 2;
+    }
+  }
+
+  // Remaps w and moves its block from its path into the stash. Returns the
+  // block in the stash, or nullptr.
+  common::Block<B> *access(ORKey w) {
+    Leaf new_leaf = min_leaf_ + random_gen::generateRandomNumber(n_);
+    Leaf leaf = pos_map_->remap(w, new_leaf);
+    last_leaf_ = new_leaf;
+
+    path_to_leaf(leaf, path_);
+    read_path();
+    for (auto &bu : buckets_) {
+      int j = bu.find(w);
+      if (j >= 0) {
+        stash_.insert(std::move(bu.blocks_[j]));
+        bu.blocks_[j] = std::move(bu.blocks_[bu.flags_ - 1]);
+        bu.flags_--;
+      }
+    }
+    write_path();
+
+    // The stash is a few blocks: scan all of them rather than probe
+    auto *b = stash_.scan(w);
+    if (b) {
+      b->leaf = new_leaf;
+    }
+    return b;
+  }
+
+  // Deepest level (path indexing) a block can reach on the current path
+  inline int reach(const common::Block<B> &b, Leaf leaf) const {
+    return static_cast<int>(common_depth(b.leaf, leaf)) + 1;
+  }
+
+  // Slot in level i of the block that can go deepest, or -1
+  int deepest_slot(size_t i, Leaf leaf, int *depth) {
+    int best = -1;
+    *depth = -1;
+    if (i == 0) {
+      for (size_t s = 0; s < stash_.size(); s++) {
+        int d = reach(stash_[s], leaf);
+        if (d > *depth) { *depth = d; best = s; }
+      }
+      return best;
+    }
+    auto &bu = buckets_[i - 1];
+    for (int j = 0; j < bu.flags_; j++) {
+      int d = reach(bu.blocks_[j], leaf);
+      if (d > *depth) { *depth = d; best = j; }
+    }
+    return best;
+  }
+
+  void evict_once(Leaf leaf) {
+    const size_t levels = l_ + 2;
+    path_to_leaf(leaf, path_);
+    read_path();
+
+    // First pass, root to leaf: deepest_[i] is the shallowest level above i
+    // holding a block that can move down to i or further.
+    deepest_.assign(levels, -1);
+    int goal = -1, src = -1;
+    for (size_t i = 0; i < levels; i++) {
+      if (goal >= static_cast<int>(i)) {
+        deepest_[i] = src;
+      }
+      int depth;
+      deepest_slot(i, leaf, &depth);
+      if (depth > goal) {
+        goal = depth;
+        src = i;
+      }
+    }
+
+    // Second pass, leaf to root: target_[i] is where the block picked up at
+    // level i is dropped.
+    target_.assign(levels, -1);
+    int dest = -1;
+    src = -1;
+    for (size_t i = levels; i-- > 0;) {
+      if (static_cast<int>(i) == src) {
+        target_[i] = dest;
+        dest = -1;
+        src = -1;
+      }
+      bool has_room = i > 0 && static_cast<size_t>(buckets_[i - 1].flags_) < Z;
+      if (((dest == -1 && has_room) || target_[i] != -1) && deepest_[i] != -1) {
+        src = deepest_[i];
+        dest = i;
+      }
+    }
+
+    // Eviction pass, root to leaf, holding at most one block
+    common::Block<B> hold;
+    bool holding = false;
+    dest = -1;
+    for (size_t i = 0; i < levels; i++) {
+      common::Block<B> towrite;
+      bool writing = false;
+      if (holding && static_cast<int>(i) == dest) {
+        towrite = std::move(hold);
+        writing = true;
+        holding = false;
+        dest = -1;
+      }
+      if (target_[i] != -1) {
+        int depth;
+        int slot = deepest_slot(i, leaf, &depth);
+        if (i == 0) {
+          hold = stash_[slot];
+          stash_.erase_at(slot);
+        } else {
+          auto &bu = buckets_[i - 1];
+          hold = std::move(bu.blocks_[slot]);
+          bu.blocks_[slot] = std::move(bu.blocks_[bu.flags_ - 1]);
+          bu.flags_--;
+        }
+        holding = true;
+        dest = target_[i];
+      }
+      if (writing) {
+        auto &bu = buckets_[i - 1];
+        bu.blocks_[bu.flags_] = std::move(towrite);
+        bu.flags_++;
+      }
+    }
+
+    write_path();
+  }
+
+  // Streams the initial tree to the channel: the blocks, sorted by leaf, go
+  // as deep as their path allows, the buckets filled in post-order (a leaf,
+  // then every ancestor whose right subtree it completes) and sent in chunks
+  // of kMaxBucketsPerWrite. Besides the input, the client holds the sort
+  // order, one chunk and the blocks waiting for an open ancestor; blocks the
+  // root cannot take go to the stash.
+  void Setup(std::vector<common::Block<B>> &blocks, threadpool::worker::DefaultParallelWorker *worker,
+             std::optional<uint64_t> seed) {
+    auto draw = [&](size_t start, size_t end) {
+      for (size_t i = start; i < end; i++) {
+        uint64_t r = seed ? random_gen::Mix64(*seed + i) % n_ : random_gen::generateRandomNumber(n_);
+        blocks[i].leaf = min_leaf_ + r;
+      }
+    };
+    if (worker) {
+      worker->parallel_work([&](size_t t) {
+        auto [start, end] = worker->get_thread_range(t, blocks.size());
+        draw(start, end);
+      });
+    } else {
+      draw(0, blocks.size());
+    }
+    std::vector<std::pair<Leaf, size_t>> order(blocks.size());
+    for (size_t i = 0; i < blocks.size(); i++) {
+      pos_map_->set(blocks[i].key, blocks[i].leaf);
+      order[i] = {blocks[i].leaf, i};
+    }
+    std::sort(order.begin(), order.end());
+
+    stash_.clear();
+    path_.clear();
+    buckets_.resize(kMaxBucketsPerWrite);
+    std::vector<std::vector<size_t>> pending(l_ + 1);
+    auto fill = [&](ORBucketID id, size_t level) {
+      if (path_.size() == kMaxBucketsPerWrite) {
+        write_path(worker);
+        path_.clear();
+      }
+      auto &bu = buckets_[path_.size()];
+      path_.push_back(id);
+      auto &waiting = pending[level];
+      const size_t keep = std::min<size_t>(waiting.size(), Z);
+      bu.flags_ = keep;
+      for (size_t k = 0; k < Z; k++) {
+        bu.blocks_[k] = k < keep ? blocks[waiting[k]] : common::Block<B>();
+      }
+      for (size_t k = keep; k < waiting.size(); k++) {
+        if (level > 0) {
+          pending[level - 1].push_back(waiting[k]);
+        } else {
+          stash_.insert(blocks[waiting[k]]);
+        }
+      }
+      waiting.clear();
+    };
+    auto next = order.begin();
+    for (Leaf leaf = min_leaf_; leaf <= max_leaf_; leaf++) {
+      for (; next != order.end() && next->first == leaf; next++) {
+        pending[l_].push_back(next->second);
+      }
+      fill(leaf, l_);
+      uint64_t pos = leaf - min_leaf_ + 1;
+      for (size_t level = l_; level-- > 0 && pos % 2 == 0;) {
+        pos >>= 1;
+        fill(((static_cast<uint64_t>(leaf) + 1) >> (l_ - level)) - 1, level);
+      }
+    }
+    write_path(worker);
+
+    // Back to the scratch of one path
+    path_.clear();
+    std::vector<common::Bucket<B, Z>>().swap(buckets_);
+    enc_arena_.release();
+    plain_arena_.release();
+    if (stash_.size() > stash_capacity_) {
+      throw std::runtime_error("Stash size exceeded");
+    }
+  }
+
+  // Reads and decrypts the buckets of path_ into buckets_
+  void read_path() {
+    auto enc = enc_arena_.acquire(path_.size());
+    auto ser = plain_arena_.acquire(path_.size());
+    channel_->read_buckets(std::span<const ORBucketID>(path_), enc);
+
+    buckets_.resize(path_.size());
+    if (!cipher_.OpenBatch(enc, en_bus_, bus_, ser)) {
+      throw std::runtime_error("Failed to decrypt bucket");
+    }
+    for (size_t i = 0; i < path_.size(); i++) {
+      buckets_[i].deserialize(ser[i]);
+    }
+  }
+
+  // Encrypts buckets_ and writes them to the ids in path_, split across
+  // the threads of worker if there is one
+  void write_path(threadpool::worker::DefaultParallelWorker *worker = nullptr) {
+    auto enc = enc_arena_.acquire(path_.size());
+    auto ser = plain_arena_.acquire(path_.size());
+    auto seal = [&](size_t start, size_t end) {
+      for (size_t i = start; i < end; i++) {
+        buckets_[i].serialize(ser[i]);
+      }
+      return cipher_.SealBatch(ser.subspan(start, end - start), bus_, enc.subspan(start, end - start));
+    };
+    bool ok = true;
+    if (worker) {
+      std::vector<char> thread_ok(worker->thread_count(), 1);
+      worker->parallel_work([&](size_t t) {
+        auto [start, end] = worker->get_thread_range(t, path_.size());
+        thread_ok[t] = seal(start, end);
+      });
+      ok = std::all_of(thread_ok.begin(), thread_ok.end(), [](char c) { return c != 0; });
+    } else {
+      ok = seal(0, path_.size());
+    }
+    if (!ok) {
+      throw std::runtime_error("Failed to encrypt bucket");
+    }
+    channel_->write_buckets(std::span<const ORBucketID>(path_), std::span<char *const>(enc));
+  }
+};
@@ -0,0 +1,88 @@
+#pragma once
+#include <string>
+#include <utility>
+
+#include "perfstats.hpp"
+#include "datalog.hpp"
+
+namespace common {
+
+// Per-phase counters of an ORAM client, sampled on every access. Phases run
+// on crypto workers or on the background eviction thread add up the time of
+// every thread, so the totals are CPU time and may exceed the wall time.
+struct AccessStats {
+  TimingsField path_compute;   // position map remap and path ids
+  TimingsField channel_read;
+  TimingsField decrypt;
+  TimingsField deserialize;
+  TimingsField stash_lookup;   // read blocks into the stash, accessed keys out of it
+  TimingsField evict_place;    // picking the bucket of every stash block
+  TimingsField serialize;
+  TimingsField encrypt;
+  TimingsField channel_write;
+  TimingsField evict_wait;     // blocked on a background eviction
+  TimingsField integrity;      // hashing and checking buckets (with ORAM_INTEGRITY)
+
+  NumberField bytes_read, bytes_written;      // per path read / eviction
+  NumberField buckets_read, buckets_written;  // per path read / eviction
+  NumberField stash_size;                     // after every eviction
+
+  inline static constexpr std::pair<const char *, TimingsField AccessStats::*> kTimings[] = {
+      {"path_compute", &AccessStats::path_compute},   {"channel_read", &AccessStats::channel_read},
+      {"decrypt", &AccessStats::decrypt},             {"deserialize", &AccessStats::deserialize},
+      {"stash_lookup", &AccessStats::stash_lookup},   {"evict_place", &AccessStats::evict_place},
+      {"serialize", &AccessStats::serialize},         {"encrypt", &AccessStats::encrypt},
+      {"channel_write", &AccessStats::channel_write}, {"evict_wait", &AccessStats::evict_wait},
+      {"integrity", &AccessStats::integrity},
+  };
+  inline static constexpr std::pair<const char *, NumberField AccessStats::*> kNumbers[] = {
+      {"bytes_read", &AccessStats::bytes_read},     {"bytes_written", &AccessStats::bytes_written},
+      {"buckets_read", &AccessStats::buckets_read}, {"buckets_written", &AccessStats::buckets_written},
+      {"stash_size", &AccessStats::stash_size},
+  };
+
+  void reset() {
+    for (auto [name, field] : kTimings) {
+      (this->*field).reset();
+    }
+    for (auto [name, field] : kNumbers) {
+      (this->*field).reset();
+    }
+  }
+
+  double total_time_s() const {
+    double total = 0;
+    for (auto [name, field] : kTimings) {
+      total += (this->*field).time_s();
+    }
+    return total;
+  }
+
+  // One line per phase and counter, with the phases' share of their sum
+  std::string summary() const {
+    std::string s;
+    double total = total_time_s() > 0 ? total_time_s() : 1;
+    for (auto [name, field] : kTimings) {
+      s += tfm::format("%-16s %s\n", name, (this->*field).summary(total));
+    }
+    for (auto [name, field] : kNumbers) {
+      s += tfm::format("%-16s %s\n", name, (this->*field).summary());
+    }
+    return s;
+  }
+
+  // Adds <phase>_s and <phase>_n columns for the phases, and <counter>_mean
+  // and <counter>_max ones for the counters, e.g. for a DataLog CSV.
+  void add_columns(DataRow &row) const {
+    for (auto [name, field] : kTimings) {
+      row.add_column(std::string(name) + "_s", (this->*field).time_s());
+      row.add_column(std::string(name) + "_n", (this->*field).count.load());
+    }
+    for (auto [name, field] : kNumbers) {
+      row.add_column(std::string(name) + "_mean", (this->*field).mean());
+      row.add_column(std::string(name) + "_max", (this->*field).max_value.load());
+    }
+  }
+};
+
+} // namespace common
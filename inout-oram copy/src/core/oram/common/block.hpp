@@ -1,106 +1,105 @@
 #pragma once
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
 #include <string>
+#include <type_traits>
 #include <vector>
 #include <set>
 #include <map>
 
-using ORBucketID = uint32_t;
-using Leaf = uint32_t;
+#include "oram/common/simd_scan.hpp"
+
+// Width of block keys, leaves and bucket ids. 32 bits cap a tree at 2^32
+// buckets (2^31 blocks); build with ORAM_64BIT_IDS (the `wide_ids` meson
+// option) for larger trees, at 8 more bytes per block.
+#ifdef ORAM_64BIT_IDS
+using ORId = uint64_t;
+#else
+using ORId = uint32_t;
+#endif
+using ORKey = ORId;
+using ORBucketID = ORId;
+using Leaf = ORId;
 
 namespace common {
-    #define Z 4
+    // Blocks per bucket unless an engine is instantiated with its own Z
+    inline constexpr size_t kDefaultZ = 4;
+
+    // Blocks and buckets are packed and trivially copyable: their in-memory
+    // layout is the serialized one, so (de)serializing is a memcpy and
+    // arrays of them never touch the heap.
+#pragma pack(push, 1)
     // Represents a simple ORAM block
     template <size_t B>
     struct Block {
-        uint32_t key;
+        ORKey key;
+        Leaf leaf; // Leaf the block is mapped to, kept with the block so eviction never consults the position map
         uint8_t val[B];
 
-        Block() : key(-1) {
+        inline static constexpr size_t SerializedSize() { return sizeof(ORKey) + sizeof(Leaf) + B; }
+
+        Block() : key(-1), leaf(0) {
             memset(val, 0, B);
         }
 
-        Block (uint32_t key, const uint8_t* val) : key(key) {
+        Block (ORKey key, const uint8_t* val) : key(key), leaf(0) {
             memcpy(this->val, val, B);
         }
 
-        Block(uint32_t key, const std::array<uint8_t, B>& val) : key(key) {
+        Block(ORKey key, const std::array<uint8_t, B>& val) : key(key), leaf(0) {
             memcpy(this->val, val.data(), B);
         }
 
-        Block (const Block& other) : key(other.key) {
-            memcpy(val, other.val, B);
-        }
-
-        Block(Block&& other) noexcept : key(other.key) {
-            memcpy(val, other.val, B);
-            other.key = 0;
-            memset(other.val, 0, B); // Optional, for safety
-        }
-
-        Block& operator=(Block&& other) noexcept {
-            if (this != &other) {
-                key = other.key;
-                memcpy(val, other.val, B);
-                other.key = 0;
-                memset(other.val, 0, B); // Optional, for safety
-            }
-            return *this;
-        }
-
-        void serialize(char *buf) {
-            if(!buf) {
-                buf = new char[sizeof(uint32_t) + B];
-            } 
-
-            memcpy(buf, &key, sizeof(uint32_t));
-            memcpy(buf + sizeof(uint32_t), val, B);
+        void serialize(char *buf) const {
+            memcpy(buf, this, SerializedSize());
         }
 
         void deserialize(const char *buf) {
-            memcpy(&key, buf, sizeof(uint32_t));
-            memcpy(val, buf + sizeof(uint32_t), B);
+            memcpy(this, buf, SerializedSize());
         }
     };
 
-    // Represents a simple ORAM bucket
-    template <size_t B>
+    // Represents a simple ORAM bucket: flags_ is the number of real blocks
+    template <size_t B, size_t Z = kDefaultZ>
     struct Bucket {
-       char flags_;
-       std::vector<Block<B>> blocks_;
+        char flags_;
+        std::array<Block<B>, Z> blocks_;
+
+        inline static constexpr size_t SerializedSize() { return sizeof(char) + Z * Block<B>::SerializedSize(); }
 
-       Bucket() : flags_(0) {
-            for (size_t i = 0; i < Z; i++) {
-                blocks_.push_back(Block<B>());
+        Bucket() : flags_(0) {}
+
+        // Slot of the real block with the given key, or -1. The Z keys are
+        // gathered and compared at once, whatever flags_ is.
+        int find(ORKey key) const {
+            static_assert(Z < 64);
+            ORKey keys[Z];
+            for (size_t j = 0; j < Z; j++) {
+                keys[j] = blocks_[j].key;
             }
-       }
+            uint64_t m = simd::eq_mask(keys, Z, key) & ((uint64_t{1} << flags_) - 1);
+            return m ? std::countr_zero(m) : -1;
+        }
 
-       void serialize(char *buf) {
+        void serialize(char *buf) const {
             if (!buf) {
                 throw std::invalid_argument("Buffer cannot be null");
             }
-            
-            memcpy(buf, &flags_, sizeof(char));
-            char *ptr = buf + sizeof(char);
-            
-            for (size_t i = 0; i < Z; i++) {
-                blocks_[i].serialize(ptr);
-                ptr += sizeof(uint32_t) + B;
-            }
+            memcpy(buf, this, SerializedSize());
         }
 
         void deserialize(const char *buf) {
             if (!buf) {
                 throw std::invalid_argument("Buffer cannot be null");
             }
-            
-            memcpy(&flags_, buf, sizeof(char));
-            const char *ptr = buf + sizeof(char);
-            
-            for (size_t i = 0; i < Z; i++) {
-                blocks_[i].deserialize(ptr);
-                
-                ptr += sizeof(uint32_t) + B;
-            }
+            memcpy(this, buf, SerializedSize());
         }
-   };
+    };
+#pragma pack(pop)
+
+    static_assert(std::is_trivially_copyable_v<Block<1>> && sizeof(Block<1>) == Block<1>::SerializedSize());
+    static_assert(std::is_trivially_copyable_v<Bucket<1>> && sizeof(Bucket<1>) == Bucket<1>::SerializedSize());
 } // namespace common
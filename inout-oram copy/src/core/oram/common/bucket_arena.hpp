@@ -0,0 +1,47 @@
+#pragma once
+#include <cstddef>
+#include <span>
+#include <vector>
+
+namespace common {
+
+// Fixed-size buffers (encrypted or serialized buckets) for one path or one
+// batch, carved out of a single allocation. The arena only grows, so once it
+// has seen the largest path/batch an access reuses it without touching the
+// heap. Growing it invalidates the buffers handed out before.
+class BucketArena {
+ private:
+  size_t slot_size_;
+  std::vector<char> buf_;
+  std::vector<char *> slots_;
+
+ public:
+  explicit BucketArena(size_t slot_size = 0) : slot_size_(slot_size) {}
+
+  size_t slot_size() const { return slot_size_; }
+  size_t capacity() const { return slots_.size(); }
+
+  // n buffers of slot_size() bytes each
+  std::span<char *> acquire(size_t n) {
+    if (n > slots_.size()) {
+      buf_.resize(n * slot_size_);
+      slots_.resize(n);
+      for (size_t i = 0; i < n; i++) {
+        slots_[i] = buf_.data() + i * slot_size_;
+      }
+    }
+    return {slots_.data(), n};
+  }
+
+  char *operator[](size_t i) { return slots_[i]; }
+
+  // Gives the memory back, e.g. after setup wrote the whole tree.
+  void release() {
+    std::vector<char>().swap(buf_);
+    std::vector<char *>().swap(slots_);
+  }
+
+  size_t memory_bytes() const { return buf_.capacity() + slots_.capacity() * sizeof(char *); }
+};
+
+} // namespace common
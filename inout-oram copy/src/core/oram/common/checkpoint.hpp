@@ -0,0 +1,173 @@
+#pragma once
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#if defined(__linux__)
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#elif defined(__APPLE__)
+#include <sys/clonefile.h>
+#endif
+
+#include "oram/common/block.hpp"
+#include "utils/crypto.hpp"
+
+namespace common {
+
+// Fixed-size head of a client checkpoint, followed by the position map, the
+// stash blocks, the treetop buckets and, with integrity, the digests of the
+// first remote level (in that order, sizes below). Blocks and buckets are
+// stored in their in-memory (= serialized) layout.
+struct CheckpointHeader {
+  static constexpr char kMagic[8] = {'O', 'R', 'A', 'M', 'C', 'K', 'P', 'T'};
+  static constexpr uint32_t kVersion = 3;
+
+  char magic[8];
+  uint32_t version;
+  uint32_t id_bytes;        // sizeof(ORId) of the build that wrote it
+  uint64_t block_size;      // B
+  uint64_t z;
+  uint64_t n;
+  uint64_t treetop_levels;
+  uint64_t pos_map_type;
+  uint64_t cipher;          // utils::CipherMode of the buckets
+  uint8_t key_digest[utils::kDigestSize];  // the key itself is never written
+  uint64_t pos_map_bytes;
+  uint64_t stash_blocks;
+  uint64_t treetop_buckets;
+  uint64_t top_digests;     // 0 without integrity
+};
+static_assert(std::is_trivially_copyable_v<CheckpointHeader>);
+
+// Digest identifying the key a checkpoint was taken with
+inline std::array<uint8_t, utils::kDigestSize> KeyDigest(const utils::Key &key) {
+  static constexpr char kLabel[] = "oram-checkpoint-key";
+  std::vector<unsigned char> in(kLabel, kLabel + sizeof(kLabel));
+  in.insert(in.end(), key.begin(), key.end());
+  std::array<uint8_t, utils::kDigestSize> digest;
+  if (!utils::Hash(in.data(), in.size(), digest.data())) {
+    throw std::runtime_error("Failed to hash the checkpoint key");
+  }
+  return digest;
+}
+
+// Read-only mapping of a whole file, unmapped on destruction.
+class MappedFile {
+ private:
+  const char *data_ = nullptr;
+  size_t size_ = 0;
+
+ public:
+  explicit MappedFile(const std::string &path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      throw std::runtime_error("Failed to open " + path + ": " + std::strerror(errno));
+    }
+    struct stat st;
+    if (::fstat(fd, &st) != 0 || st.st_size == 0) {
+      ::close(fd);
+      throw std::runtime_error("Empty or unreadable file: " + path);
+    }
+    size_ = static_cast<size_t>(st.st_size);
+    void *p = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED) {
+      throw std::runtime_error("Failed to map " + path + ": " + std::strerror(errno));
+    }
+    data_ = static_cast<const char *>(p);
+  }
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+  ~MappedFile() { ::munmap(const_cast<char *>(data_), size_); }
+
+  const char *data() const { return data_; }
+  size_t size() const { return size_; }
+};
+
+// Writes data to path through a temporary file and a rename, so that a crash
+// leaves either the old or the new file.
+inline void WriteFileAtomic(const std::string &path, const std::vector<char> &data) {
+  const std::string tmp = path + ".tmp";
+  int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    throw std::runtime_error("Failed to create " + tmp + ": " + std::strerror(errno));
+  }
+  // Closes fd and removes tmp on every failure, reporting the first error
+  auto fail = [&](const char *what, int err) {
+    ::close(fd);
+    ::unlink(tmp.c_str());
+    throw std::runtime_error(std::string("Failed to ") + what + " " + tmp + ": " + std::strerror(err));
+  };
+  for (size_t done = 0; done < data.size();) {
+    ssize_t w = ::write(fd, data.data() + done, data.size() - done);
+    if (w < 0 && errno != EINTR) {
+      fail("write", errno);
+    }
+    done += w > 0 ? static_cast<size_t>(w) : 0;
+  }
+  if (::fsync(fd) != 0) {
+    fail("sync", errno);
+  }
+  if (::close(fd) != 0) {
+    const int err = errno;
+    ::unlink(tmp.c_str());
+    throw std::runtime_error("Failed to close " + tmp + ": " + std::strerror(err));
+  }
+  std::error_code ec;
+  std::filesystem::rename(tmp, path, ec);
+  if (ec) {
+    ::unlink(tmp.c_str());
+    throw std::runtime_error("Failed to rename " + tmp + " to " + path + ": " + ec.message());
+  }
+}
+
+// Copies from to to, sharing the data blocks when the file system can
+// (reflink on Linux, clonefile on APFS), else in the kernel
+// (copy_file_range), else through std::filesystem. to is replaced.
+inline void CloneFile(const std::string &from, const std::string &to) {
+  std::filesystem::remove(to);
+#if defined(__linux__)
+  int in = ::open(from.c_str(), O_RDONLY);
+  if (in < 0) {
+    throw std::runtime_error("Failed to open " + from + ": " + std::strerror(errno));
+  }
+  int out = ::open(to.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (out < 0) {
+    ::close(in);
+    throw std::runtime_error("Failed to create " + to + ": " + std::strerror(errno));
+  }
+  bool done = ::ioctl(out, FICLONE, in) == 0;
+  if (!done) {
+    struct stat st;
+    done = ::fstat(in, &st) == 0;
+    for (off_t left = st.st_size; done && left > 0;) {
+      ssize_t c = ::copy_file_range(in, nullptr, out, nullptr, static_cast<size_t>(left), 0);
+      done = c > 0;
+      left -= c > 0 ? c : 0;
+    }
+  }
+  ::close(in);
+  ::close(out);
+  if (done) {
+    return;
+  }
+  std::filesystem::remove(to);
+#elif defined(__APPLE__)
+  if (::clonefile(from.c_str(), to.c_str(), 0) == 0) {
+    return;
+  }
+#endif
+  std::filesystem::copy_file(from, to, std::filesystem::copy_options::overwrite_existing);
+}
+
+} // namespace common
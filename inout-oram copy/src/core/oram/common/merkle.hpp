@@ -0,0 +1,185 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <openssl/err.h>
+#include <openssl/evp.h>
+
+#include "oram/common/block.hpp"
+#include "utils/crypto.hpp"
+
+// Integrity of the bucket tree against a server that tampers with, moves or
+// replays buckets (the `integrity` meson option). Every serialized bucket
+// ends with the digests of its two children (zeros on the leaf level), so
+// the buckets form a Merkle tree whose top the client keeps: the digests of
+// the first level stored remotely, below the treetop cache. A read checks
+// every bucket of its paths against its parent (or the top); an eviction
+// rehashes the buckets it writes, children first, and takes the digests of
+// the children it does not write from their parents as last read.
+namespace common {
+
+#ifdef ORAM_INTEGRITY
+inline constexpr bool kIntegrity = true;
+#else
+inline constexpr bool kIntegrity = false;
+#endif
+
+using Digest = std::array<uint8_t, utils::kDigestSize>;
+
+// SHA-256 with a context kept by the thread and the digest fetched once (an
+// implicit EVP_sha256() lookup per call doubles the cost of a bucket), so
+// that hashing does not allocate. OpenSSL dispatches to SHA-NI or AVX2 code
+// when the CPU has it.
+inline void HashBucket(const char *data, size_t len, Digest &out) {
+  struct Context {
+    EVP_MD_CTX *ctx = EVP_MD_CTX_new();
+    ~Context() { EVP_MD_CTX_free(ctx); }
+  };
+  static EVP_MD *const sha256 = EVP_MD_fetch(nullptr, "SHA256", nullptr);  // kept for the process
+  static thread_local Context c;
+  unsigned int out_len = 0;
+  if (c.ctx == nullptr || sha256 == nullptr || EVP_DigestInit_ex(c.ctx, sha256, nullptr) != 1
+      || EVP_DigestUpdate(c.ctx, data, len) != 1 || EVP_DigestFinal_ex(c.ctx, out.data(), &out_len) != 1) {
+    ERR_print_errors_fp(stderr);
+    throw std::runtime_error("Failed to hash bucket");
+  }
+}
+
+class MerkleTree {
+ public:
+  inline static constexpr size_t kTrailerSize = 2 * sizeof(Digest);
+
+  // Child digests of a bucket as read, for the eviction that rewrites it
+  struct Children {
+    ORBucketID id;
+    Digest child[2];
+  };
+
+  // Scratch of one writer (link is called by the client, its setup workers
+  // and the background eviction thread): the digests still waiting for
+  // their parent, and the buckets of the current call sorted by id.
+  struct LinkState {
+    std::map<ORBucketID, Digest> pending;
+    std::vector<std::pair<ORBucketID, size_t>> index;
+    std::vector<Digest> digests;
+  };
+
+  MerkleTree() = default;
+  // top_level: the first level stored remotely; height: the leaf level
+  MerkleTree(size_t top_level, size_t height)
+      : top_level_(top_level), height_(height), top_(top_level <= height ? 1ULL << top_level : 0) {}
+
+  static size_t level(ORBucketID id) { return std::bit_width(static_cast<uint64_t>(id) + 1) - 1; }
+
+  std::vector<Digest> &top() { return top_; }
+  const std::vector<Digest> &top() const { return top_; }
+
+  // ser[i] is the serialized bucket ids[i] (len bytes, trailer included)
+  // and digests[i] its hash. ids is a union of paths below the treetop,
+  // sorted (either way). Throws if a bucket does not match the digest its
+  // parent, or the top, holds for it. The child digests of the buckets are
+  // appended to read.
+  void verify(std::span<const ORBucketID> ids, std::span<char *const> ser, size_t len,
+              std::span<const Digest> digests, std::vector<Children> &read) const {
+    const bool ascending = ids.front() <= ids.back();
+    for (size_t i = 0; i < ids.size(); i++) {
+      const ORBucketID id = ids[i];
+      const uint8_t *expected;
+      if (level(id) == top_level_) {
+        expected = top_[id - ((1ULL << top_level_) - 1)].data();
+      } else {
+        const ORBucketID parent = (id - 1) / 2;
+        auto it = ascending ? std::lower_bound(ids.begin(), ids.end(), parent)
+                            : std::lower_bound(ids.begin(), ids.end(), parent, std::greater<ORBucketID>());
+        if (it == ids.end() || *it != parent) {
+          throw std::logic_error("Bucket " + std::to_string(id) + " read without its parent");
+        }
+        expected = trailer(ser[it - ids.begin()], len) + (id % 2 == 0) * sizeof(Digest);
+      }
+      if (std::memcmp(expected, digests[i].data(), sizeof(Digest)) != 0) {
+        throw std::runtime_error("Integrity check failed for bucket " + std::to_string(id));
+      }
+    }
+    for (size_t i = 0; i < ids.size(); i++) {
+      auto &r = read.emplace_back();
+      r.id = ids[i];
+      std::memcpy(r.child, trailer(ser[i], len), kTrailerSize);
+    }
+  }
+
+  // Fills the trailers of the serialized buckets ser[i] (of ids[i]) and
+  // hashes them, children before parents. A child is taken from this call,
+  // from state.pending (written by an earlier call) or, if it is not being
+  // written, from read (its parent as last read).
+  // Digests whose parent is not in this call wait in state.pending, those of
+  // the first remote level go to the top. The caller clears read once the
+  // whole eviction is linked.
+  void link(std::span<const ORBucketID> ids, std::span<char *const> ser, size_t len, LinkState &state,
+            std::vector<Children> &read) {
+    auto by_id = [](const Children &a, const Children &b) { return a.id < b.id; };
+    if (!std::is_sorted(read.begin(), read.end(), by_id)) {
+      std::sort(read.begin(), read.end(), by_id);
+    }
+    state.index.clear();
+    for (size_t i = 0; i < ids.size(); i++) {
+      state.index.emplace_back(ids[i], i);
+    }
+    std::sort(state.index.begin(), state.index.end());
+    state.digests.resize(ids.size());
+    auto in_call = [&](ORBucketID id) -> const Digest * {
+      auto it = std::lower_bound(state.index.begin(), state.index.end(), std::make_pair(id, size_t(0)));
+      return it != state.index.end() && it->first == id ? &state.digests[it->second] : nullptr;
+    };
+
+    for (size_t k = state.index.size(); k-- > 0;) {
+      auto [id, i] = state.index[k];
+      uint8_t *t = trailer(ser[i], len);
+      if (level(id) == height_) {
+        std::memset(t, 0, kTrailerSize);
+      } else {
+        for (size_t side = 0; side < 2; side++) {
+          const ORBucketID child = 2 * id + 1 + side;
+          if (auto *d = in_call(child)) {
+            std::memcpy(t + side * sizeof(Digest), d->data(), sizeof(Digest));
+          } else if (auto p = state.pending.find(child); p != state.pending.end()) {
+            std::memcpy(t + side * sizeof(Digest), p->second.data(), sizeof(Digest));
+            state.pending.erase(p);
+          } else {
+            auto r = std::lower_bound(read.begin(), read.end(), Children{id, {}}, by_id);
+            if (r == read.end() || r->id != id) {
+              throw std::logic_error("No digest for child " + std::to_string(child) + " of bucket " +
+                                     std::to_string(id));
+            }
+            std::memcpy(t + side * sizeof(Digest), r->child[side].data(), sizeof(Digest));
+          }
+        }
+      }
+      HashBucket(ser[i], len, state.digests[i]);
+      if (level(id) == top_level_) {
+        top_[id - ((1ULL << top_level_) - 1)] = state.digests[i];
+      } else if (!in_call((id - 1) / 2)) {
+        state.pending[id] = state.digests[i];
+      }
+    }
+  }
+
+ private:
+  size_t top_level_ = 0, height_ = 0;
+  std::vector<Digest> top_;
+
+  static uint8_t *trailer(char *buf, size_t len) { return reinterpret_cast<uint8_t *>(buf + len - kTrailerSize); }
+  static const uint8_t *trailer(const char *buf, size_t len) {
+    return reinterpret_cast<const uint8_t *>(buf + len - kTrailerSize);
+  }
+};
+
+} // namespace common
@@ -0,0 +1,44 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include "oram/common/block.hpp"
+
+enum class AccessOp { Read, Write };
+
+namespace common {
+
+// ORAM engines a caller (e.g. a SEAL region) can pick from.
+enum class ORAMEngine { Path, Ring, Circuit };
+
+// Name of an engine, for logs
+inline const char *EngineName(ORAMEngine engine) {
+  switch (engine) {
+    case ORAMEngine::Path:
+      return "Path ORAM";
+    case ORAMEngine::Ring:
+      return "Ring ORAM";
+    case ORAMEngine::Circuit:
+      return "Circuit ORAM";
+  }
+  return "ORAM";
+}
+
+// Client surface shared by the ORAM engines. An access is a Read followed by
+// an Evict, which each engine maps onto its own eviction schedule.
+template <size_t B>
+class ORAMClient {
+ public:
+  virtual ~ORAMClient() = default;
+
+  virtual void Init(std::vector<Block<B>> &blocks) = 0;
+  virtual void Read(ORKey w, Block<B> &data) = 0;
+  virtual void Evict() = 0;
+  virtual void AccessBatch(const std::vector<ORKey> &keys, const std::vector<AccessOp> &ops,
+                           std::vector<Block<B>> &data) = 0;
+
+  // Client-side bytes held: position map and stash.
+  virtual size_t ClientMemoryBytes() const = 0;
+};
+
+} // namespace common
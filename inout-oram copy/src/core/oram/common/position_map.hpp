@@ -0,0 +1,220 @@
+#pragma once
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "oram/common/block.hpp"
+#include "utils/random_gen.hpp"
+
+namespace common {
+
+// Reads a width-bit little-endian value starting at bit offset bit of buf.
+inline uint64_t ReadBits(const uint8_t *buf, size_t bit, size_t width) {
+  uint64_t v = 0;
+  for (size_t i = 0; i < width;) {
+    const size_t byte = (bit + i) >> 3, off = (bit + i) & 7;
+    const size_t take = std::min<size_t>(8 - off, width - i);
+    v |= static_cast<uint64_t>((buf[byte] >> off) & ((1u << take) - 1)) << i;
+    i += take;
+  }
+  return v;
+}
+
+// Writes the low width bits of v starting at bit offset bit of buf.
+inline void WriteBits(uint8_t *buf, size_t bit, size_t width, uint64_t v) {
+  for (size_t i = 0; i < width;) {
+    const size_t byte = (bit + i) >> 3, off = (bit + i) & 7;
+    const size_t take = std::min<size_t>(8 - off, width - i);
+    const uint8_t mask = static_cast<uint8_t>(((1u << take) - 1) << off);
+    buf[byte] = static_cast<uint8_t>((buf[byte] & ~mask) | (((v >> i) << off) & mask));
+    i += take;
+  }
+}
+
+// Position map strategy interface. Maps a block key to the leaf it is
+// currently assigned to.
+class PositionMap {
+ public:
+  virtual ~PositionMap() = default;
+  virtual Leaf get(ORKey key) = 0;
+  virtual void set(ORKey key, Leaf leaf) = 0;
+
+  // Returns the old leaf of key and assigns it new_leaf. This is the only
+  // operation an ORAM access needs, so implementations that pay per lookup
+  // (e.g. recursive maps) override it to do a single access.
+  virtual Leaf remap(ORKey key, Leaf new_leaf) {
+    Leaf old_leaf = get(key);
+    set(key, new_leaf);
+    return old_leaf;
+  }
+
+  // Approximate number of client bytes used by the map.
+  virtual size_t memory_bytes() const = 0;
+
+  // Number of ORAM levels behind the map, i.e. extra accesses per lookup.
+  virtual size_t levels() const { return 0; }
+
+  // Checkpoints: appends the map's state to out, and restores it from what
+  // save wrote. Maps whose state is not all on the client do not support it.
+  virtual void save(std::vector<char> &) const {
+    throw std::logic_error("This position map does not support checkpoints");
+  }
+  virtual void load(const char *, size_t) {
+    throw std::logic_error("This position map does not support checkpoints");
+  }
+};
+
+// Ordered-map position map. Works for arbitrary (sparse) keys, e.g. the
+// document ids stored in the SEAL regions. Keys that were never set get a
+// fresh random one of the n leaves on every lookup, so that accessing a
+// missing key reads a random path.
+class MapPositionMap : public PositionMap {
+ private:
+  std::map<ORKey, Leaf> map_;
+  size_t n_;
+  Leaf min_leaf_;
+
+ public:
+  MapPositionMap(size_t n, Leaf min_leaf) : n_(n), min_leaf_(min_leaf) {}
+
+  Leaf get(ORKey key) override {
+    auto it = map_.find(key);
+    return it == map_.end() ? min_leaf_ + random_gen::generateRandomNumber(n_) : it->second;
+  }
+
+  void set(ORKey key, Leaf leaf) override { map_[key] = leaf; }
+
+  size_t memory_bytes() const override {
+    // key + value + red-black tree node overhead (3 pointers + color)
+    return map_.size() * (sizeof(ORKey) + sizeof(Leaf) + 4 * sizeof(void *));
+  }
+
+  // (key, leaf) pairs in key order
+  void save(std::vector<char> &out) const override {
+    for (const auto &[key, leaf] : map_) {
+      out.insert(out.end(), reinterpret_cast<const char *>(&key), reinterpret_cast<const char *>(&key) + sizeof(key));
+      out.insert(out.end(), reinterpret_cast<const char *>(&leaf), reinterpret_cast<const char *>(&leaf) + sizeof(leaf));
+    }
+  }
+
+  void load(const char *data, size_t len) override {
+    constexpr size_t kEntry = sizeof(ORKey) + sizeof(Leaf);
+    if (len % kEntry != 0) {
+      throw std::runtime_error("Corrupt map position map checkpoint");
+    }
+    map_.clear();
+    for (size_t off = 0; off < len; off += kEntry) {
+      ORKey key;
+      Leaf leaf;
+      std::memcpy(&key, data + off, sizeof(key));
+      std::memcpy(&leaf, data + off + sizeof(key), sizeof(leaf));
+      map_.emplace_hint(map_.end(), key, leaf);
+    }
+  }
+};
+
+// Dense position map: a flat array indexed by key where every leaf is stored
+// as its offset from the first leaf, bit-packed to l bits. Keys must be in
+// [0, n). Every key starts on a random one of the n leaves, so that the
+// first access of a key that was never set reads a random path.
+class DensePositionMap : public PositionMap {
+ private:
+  std::vector<uint64_t> words_;
+  size_t n_, width_;
+  uint64_t mask_;
+  Leaf min_leaf_;
+
+  void check(ORKey key) const {
+    if (key >= n_) {
+      throw std::out_of_range("Key " + std::to_string(key) +
+                              " out of range for dense position map of size " + std::to_string(n_));
+    }
+  }
+
+ public:
+  DensePositionMap(size_t n, size_t l, Leaf min_leaf)
+      : n_(n), width_(l > 0 ? l : 1), min_leaf_(min_leaf) {
+    if (width_ > 8 * sizeof(Leaf)) {
+      throw std::invalid_argument("Leaf width must be at most " + std::to_string(8 * sizeof(Leaf)) + " bits");
+    }
+    mask_ = (1ULL << width_) - 1;
+    // One extra word so that a value straddling the last boundary can always
+    // read words_[idx + 1].
+    words_.assign((n_ * width_ + 63) / 64 + 1, 0);
+    // Drawn in chunks to keep the map's own footprint
+    Leaf leaves[1024];
+    for (size_t key = 0; key < n_; key += std::size(leaves)) {
+      const size_t count = std::min(n_ - key, std::size(leaves));
+      random_gen::FillRandomNumbers(leaves, count, n_, min_leaf_);
+      for (size_t i = 0; i < count; i++) {
+        set(key + i, leaves[i]);
+      }
+    }
+  }
+
+  Leaf get(ORKey key) override {
+    check(key);
+    const uint64_t bit = static_cast<uint64_t>(key) * width_;
+    const size_t idx = bit >> 6;
+    const size_t off = bit & 63;
+
+    uint64_t v = words_[idx] >> off;
+    if (off + width_ > 64) {
+      v |= words_[idx + 1] << (64 - off);
+    }
+    return min_leaf_ + static_cast<Leaf>(v & mask_);
+  }
+
+  void set(ORKey key, Leaf leaf) override {
+    check(key);
+    const uint64_t v = static_cast<uint64_t>(leaf - min_leaf_) & mask_;
+    const uint64_t bit = static_cast<uint64_t>(key) * width_;
+    const size_t idx = bit >> 6;
+    const size_t off = bit & 63;
+
+    words_[idx] = (words_[idx] & ~(mask_ << off)) | (v << off);
+    if (off + width_ > 64) {
+      const size_t spill = 64 - off;
+      words_[idx + 1] = (words_[idx + 1] & ~(mask_ >> spill)) | (v >> spill);
+    }
+  }
+
+  size_t memory_bytes() const override { return words_.size() * sizeof(uint64_t); }
+
+  // The packed words as they are: n and l fix their number
+  void save(std::vector<char> &out) const override {
+    auto *p = reinterpret_cast<const char *>(words_.data());
+    out.insert(out.end(), p, p + words_.size() * sizeof(uint64_t));
+  }
+
+  void load(const char *data, size_t len) override {
+    if (len != words_.size() * sizeof(uint64_t)) {
+      throw std::runtime_error("Dense position map checkpoint does not match the map size");
+    }
+    std::memcpy(words_.data(), data, len);
+  }
+};
+
+// Recursive maps are built by the ORAM client itself (see
+// oram/path_oram/recursive_position_map.hpp), since they are made of clients.
+enum class PositionMapType { Map, Dense, Recursive };
+
+inline std::unique_ptr<PositionMap> MakePositionMap(PositionMapType type, size_t n, size_t l, Leaf min_leaf) {
+  switch (type) {
+    case PositionMapType::Map:
+      return std::make_unique<MapPositionMap>(n, min_leaf);
+    case PositionMapType::Dense:
+      return std::make_unique<DensePositionMap>(n, l, min_leaf);
+    case PositionMapType::Recursive:
+      break;
+  }
+  throw std::invalid_argument("Unknown position map type");
+}
+
+} // namespace common
@@ -0,0 +1,194 @@
+#pragma once
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+
+// Vector kernels over contiguous uint32_t (or, with ORAM_64BIT_IDS, uint64_t)
+// arrays of keys or leaves laid out structure-of-arrays. AVX2 is used when
+// the build targets it (-mavx2, see the `simd` meson option), SSE2 otherwise
+// on x86-64, and plain loops elsewhere or with ORAM_SIMD_SCALAR.
+#if !defined(ORAM_SIMD_SCALAR) && defined(__AVX2__)
+#define ORAM_SIMD_AVX2 1
+#include <immintrin.h>
+#elif !defined(ORAM_SIMD_SCALAR) && defined(__SSE2__)
+#define ORAM_SIMD_SSE2 1
+#include <emmintrin.h>
+#if defined(__SSE4_1__)
+#include <smmintrin.h>
+#endif
+#endif
+
+namespace common::simd {
+
+// Bit i is set iff keys[i] == key (n <= 64). Every element is compared, so
+// the time does not depend on where (or whether) key occurs.
+inline uint64_t eq_mask(const uint32_t *keys, size_t n, uint32_t key) {
+  uint64_t mask = 0;
+  size_t i = 0;
+#if defined(ORAM_SIMD_AVX2)
+  const __m256i k = _mm256_set1_epi32(static_cast<int>(key));
+  for (; i + 8 <= n; i += 8) {
+    __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(keys + i));
+    uint64_t m = static_cast<uint32_t>(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(v, k))));
+    mask |= m << i;
+  }
+#elif defined(ORAM_SIMD_SSE2)
+  const __m128i k = _mm_set1_epi32(static_cast<int>(key));
+  for (; i + 4 <= n; i += 4) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(keys + i));
+    uint64_t m = static_cast<uint32_t>(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(v, k))));
+    mask |= m << i;
+  }
+#endif
+  for (; i < n; i++) {
+    mask |= static_cast<uint64_t>(keys[i] == key) << i;
+  }
+  return mask;
+}
+
+// Index of the first keys[i] == key, or n. Stops at the first match.
+inline size_t find(const uint32_t *keys, size_t n, uint32_t key) {
+  size_t i = 0;
+#if defined(ORAM_SIMD_AVX2)
+  const __m256i k = _mm256_set1_epi32(static_cast<int>(key));
+  for (; i + 8 <= n; i += 8) {
+    __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(keys + i));
+    unsigned m = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(v, k)));
+    if (m) {
+      return i + std::countr_zero(m);
+    }
+  }
+#elif defined(ORAM_SIMD_SSE2)
+  const __m128i k = _mm_set1_epi32(static_cast<int>(key));
+  for (; i + 4 <= n; i += 4) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(keys + i));
+    unsigned m = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(v, k)));
+    if (m) {
+      return i + std::countr_zero(m);
+    }
+  }
+#endif
+  for (; i < n; i++) {
+    if (keys[i] == key) {
+      return i;
+    }
+  }
+  return n;
+}
+
+#if defined(ORAM_SIMD_SSE2)
+namespace detail {
+// 64-bit lane equality from 32-bit compares: both halves must match
+inline __m128i cmpeq_epi64_sse2(__m128i a, __m128i b) {
+  __m128i c = _mm_cmpeq_epi32(a, b);
+  return _mm_and_si128(c, _mm_shuffle_epi32(c, _MM_SHUFFLE(2, 3, 0, 1)));
+}
+} // namespace detail
+#endif
+
+// 64-bit keys (ORAM_64BIT_IDS): as above, two or four keys per vector.
+inline uint64_t eq_mask(const uint64_t *keys, size_t n, uint64_t key) {
+  uint64_t mask = 0;
+  size_t i = 0;
+#if defined(ORAM_SIMD_AVX2)
+  const __m256i k = _mm256_set1_epi64x(static_cast<long long>(key));
+  for (; i + 4 <= n; i += 4) {
+    __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(keys + i));
+    uint64_t m = static_cast<uint32_t>(_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(v, k))));
+    mask |= m << i;
+  }
+#elif defined(ORAM_SIMD_SSE2)
+  const __m128i k = _mm_set1_epi64x(static_cast<long long>(key));
+  for (; i + 2 <= n; i += 2) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(keys + i));
+    uint64_t m = static_cast<uint32_t>(_mm_movemask_pd(_mm_castsi128_pd(detail::cmpeq_epi64_sse2(v, k))));
+    mask |= m << i;
+  }
+#endif
+  for (; i < n; i++) {
+    mask |= static_cast<uint64_t>(keys[i] == key) << i;
+  }
+  return mask;
+}
+
+inline size_t find(const uint64_t *keys, size_t n, uint64_t key) {
+  for (size_t i = 0; i < n; i += 64) {
+    uint64_t m = eq_mask(keys + i, n - i < 64 ? n - i : 64, key);
+    if (m) {
+      return i + std::countr_zero(m);
+    }
+  }
+  return n;
+}
+
+// Like find, but reads all n keys and selects the result without branching
+// on the data: the scan takes the same time wherever key is.
+template <typename T>
+inline size_t find_all(const T *keys, size_t n, T key) {
+  size_t found = n;
+  for (size_t i = 0; i < n; i += 64) {
+    size_t len = n - i < 64 ? n - i : 64;
+    uint64_t m = eq_mask(keys + i, len, key);
+    size_t cand = i + std::countr_zero(m);  // i + 64 if m == 0, never picked
+    found = (found == n && m != 0) ? cand : found;
+  }
+  return found;
+}
+
+// acc[i] = min(acc[i], x[i] ^ y). With x and y heap indices (leaf + 1) of
+// leaves, the smaller x ^ y, the longer the common prefix of the two paths:
+// folding in several leaves leaves in acc how deep each block can go on
+// their union.
+inline void min_xor(const uint32_t *x, size_t n, uint32_t y, uint32_t *acc) {
+  size_t i = 0;
+#if defined(ORAM_SIMD_AVX2)
+  const __m256i yy = _mm256_set1_epi32(static_cast<int>(y));
+  for (; i + 8 <= n; i += 8) {
+    __m256i v = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(x + i)), yy);
+    __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(acc + i));
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(acc + i), _mm256_min_epu32(a, v));
+  }
+#elif defined(ORAM_SIMD_SSE2)
+  const __m128i yy = _mm_set1_epi32(static_cast<int>(y));
+  for (; i + 4 <= n; i += 4) {
+    __m128i v = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i *>(x + i)), yy);
+    __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(acc + i));
+#if defined(__SSE4_1__)
+    __m128i m = _mm_min_epu32(a, v);
+#else
+    // No unsigned min in SSE2: compare with the sign bits flipped
+    const __m128i sign = _mm_set1_epi32(INT32_MIN);
+    __m128i gt = _mm_cmpgt_epi32(_mm_xor_si128(a, sign), _mm_xor_si128(v, sign));
+    __m128i m = _mm_or_si128(_mm_and_si128(gt, v), _mm_andnot_si128(gt, a));
+#endif
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(acc + i), m);
+  }
+#endif
+  for (; i < n; i++) {
+    uint32_t v = x[i] ^ y;
+    acc[i] = v < acc[i] ? v : acc[i];
+  }
+}
+
+// 64-bit leaves. Neither SSE2 nor AVX2 has an unsigned 64-bit min: AVX2
+// compares with the sign bits flipped, SSE2 (no 64-bit compare at all) uses
+// the scalar loop.
+inline void min_xor(const uint64_t *x, size_t n, uint64_t y, uint64_t *acc) {
+  size_t i = 0;
+#if defined(ORAM_SIMD_AVX2)
+  const __m256i yy = _mm256_set1_epi64x(static_cast<long long>(y));
+  const __m256i sign = _mm256_set1_epi64x(INT64_MIN);
+  for (; i + 4 <= n; i += 4) {
+    __m256i v = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(x + i)), yy);
+    __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(acc + i));
+    __m256i gt = _mm256_cmpgt_epi64(_mm256_xor_si256(a, sign), _mm256_xor_si256(v, sign));
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(acc + i), _mm256_blendv_epi8(a, v, gt));
+  }
+#endif
+  for (; i < n; i++) {
+    uint64_t v = x[i] ^ y;
+    acc[i] = v < acc[i] ? v : acc[i];
+  }
+}
+
+} // namespace common::simd
@@ -0,0 +1,204 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "oram/common/block.hpp"
+#include "oram/common/simd_scan.hpp"
+
+namespace common {
+
+// Client stash. Blocks live in a contiguous pool (iteration order is
+// unspecified) with a hash index from key to slot, so lookups and removals
+// are O(1) regardless of how many blocks are waiting to be evicted. The index
+// is an open-addressing table (linear probing, backward-shift deletion), so
+// once the stash has reached its working size inserting and removing blocks
+// does not allocate. The keys are also kept apart from the payloads, one
+// contiguous array (keys_[slot] == pool_[slot].key, kNoKey once taken), for
+// scans that must not depend on the index (see scan()).
+template <size_t B>
+class Stash {
+ private:
+  struct Entry {
+    ORKey key;
+    uint32_t slot;
+  };
+  static constexpr uint32_t kEmpty = UINT32_MAX;
+  static constexpr size_t kMinTable = 16;
+  static constexpr ORKey kNoKey = static_cast<ORKey>(-1);
+
+  std::vector<Block<B>> pool_;
+  std::vector<ORKey> keys_;
+  std::vector<Entry> index_;  // power-of-two sized, at most half full
+  size_t mask_ = 0;
+
+  size_t home(ORKey key) const {
+    return static_cast<size_t>((static_cast<uint64_t>(key) * 0x9E3779B97F4A7C15ULL) >> 32) & mask_;
+  }
+
+  // Table position of key, or of the empty entry where it would go
+  size_t probe(ORKey key) const {
+    size_t i = home(key);
+    while (index_[i].slot != kEmpty && index_[i].key != key) {
+      i = (i + 1) & mask_;
+    }
+    return i;
+  }
+
+  void rehash(size_t capacity) {
+    size_t size = kMinTable;
+    while (size < capacity) {
+      size <<= 1;
+    }
+    std::vector<Entry>(size, Entry{0, kEmpty}).swap(index_);
+    mask_ = size - 1;
+    for (size_t slot = 0; slot < pool_.size(); slot++) {
+      const ORKey key = pool_[slot].key;
+      index_[probe(key)] = Entry{key, static_cast<uint32_t>(slot)};
+    }
+  }
+
+  void index_erase(ORKey key) {
+    size_t i = probe(key);
+    if (index_[i].slot == kEmpty) {
+      return;
+    }
+    // Shift back the entries of the cluster that would no longer be found
+    for (size_t j = (i + 1) & mask_; index_[j].slot != kEmpty; j = (j + 1) & mask_) {
+      size_t h = home(index_[j].key);
+      if (((j - h) & mask_) >= ((j - i) & mask_)) {
+        index_[i] = index_[j];
+        i = j;
+      }
+    }
+    index_[i].slot = kEmpty;
+  }
+
+  void index_set(ORKey key, size_t slot) {
+    index_[probe(key)] = Entry{key, static_cast<uint32_t>(slot)};
+  }
+
+ public:
+  using iterator = typename std::vector<Block<B>>::iterator;
+  using const_iterator = typename std::vector<Block<B>>::const_iterator;
+
+  size_t size() const { return pool_.size(); }
+  bool empty() const { return pool_.empty(); }
+
+  void reserve(size_t n) {
+    pool_.reserve(n);
+    keys_.reserve(n);
+    if (2 * n > index_.size()) {
+      rehash(2 * n);
+    }
+  }
+
+  void clear() {
+    pool_.clear();
+    keys_.clear();
+    std::fill(index_.begin(), index_.end(), Entry{0, kEmpty});
+  }
+
+  // Releases the memory left over once a large batch (e.g. setup) is evicted.
+  void shrink_to_fit() {
+    pool_.shrink_to_fit();
+    keys_.shrink_to_fit();
+    rehash(2 * pool_.size());
+  }
+
+  iterator begin() { return pool_.begin(); }
+  iterator end() { return pool_.end(); }
+  const_iterator begin() const { return pool_.begin(); }
+  const_iterator end() const { return pool_.end(); }
+
+  Block<B> &operator[](size_t slot) { return pool_[slot]; }
+  const Block<B> &operator[](size_t slot) const { return pool_[slot]; }
+
+  // Inserts b, replacing the block already stored under its key. Block is
+  // packed, so its key is copied out before anything takes it by reference.
+  template <typename T>
+  Block<B> &insert(T &&b) {
+    if (2 * (pool_.size() + 1) > index_.size()) {
+      rehash(2 * (pool_.size() + 1));
+    }
+    const ORKey key = b.key;
+    size_t i = probe(key);
+    if (index_[i].slot != kEmpty) {
+      return pool_[index_[i].slot] = std::forward<T>(b);
+    }
+    index_[i] = Entry{key, static_cast<uint32_t>(pool_.size())};
+    keys_.push_back(key);
+    return pool_.emplace_back(std::forward<T>(b));
+  }
+
+  // Block stored under key, or nullptr.
+  Block<B> *find(ORKey key) {
+    if (index_.empty()) {
+      return nullptr;
+    }
+    size_t i = probe(key);
+    return index_[i].slot == kEmpty ? nullptr : &pool_[index_[i].slot];
+  }
+
+  // Block stored under key, or nullptr, found by comparing key against every
+  // key of the stash: unlike find() the time depends only on size(), not on
+  // the key or the probe sequence it takes in the index.
+  Block<B> *scan(ORKey key) {
+    size_t slot = simd::find_all(keys_.data(), keys_.size(), key);
+    return slot == keys_.size() || key == kNoKey ? nullptr : &pool_[slot];
+  }
+
+  // Removes the block in slot by moving the last block into it.
+  void erase_at(size_t slot) {
+    index_erase(pool_[slot].key);
+    if (slot + 1 != pool_.size()) {
+      pool_[slot] = std::move(pool_.back());
+      keys_[slot] = keys_.back();
+      index_set(pool_[slot].key, slot);
+    }
+    pool_.pop_back();
+    keys_.pop_back();
+  }
+
+  bool erase(ORKey key) {
+    if (index_.empty()) {
+      return false;
+    }
+    size_t i = probe(key);
+    if (index_[i].slot == kEmpty) {
+      return false;
+    }
+    erase_at(index_[i].slot);
+    return true;
+  }
+
+  // Moves the block in slot out of the stash. Its slot stays allocated until
+  // the next compact(), so the slots of the other blocks do not change.
+  Block<B> take(size_t slot) {
+    index_erase(pool_[slot].key);
+    keys_[slot] = kNoKey;
+    return std::move(pool_[slot]);
+  }
+
+  // Keeps only the given slots (the others must have been taken) and packs
+  // them at the front of the pool.
+  void compact(std::vector<size_t> &keep) {
+    std::sort(keep.begin(), keep.end());
+    for (size_t j = 0; j < keep.size(); j++) {
+      if (keep[j] != j) {
+        pool_[j] = std::move(pool_[keep[j]]);
+        keys_[j] = keys_[keep[j]];
+        index_set(pool_[j].key, j);
+      }
+    }
+    pool_.resize(keep.size());
+    keys_.resize(keep.size());
+  }
+
+  size_t memory_bytes() const {
+    return pool_.capacity() * sizeof(Block<B>) + keys_.capacity() * sizeof(ORKey) +
+           index_.capacity() * sizeof(Entry);
+  }
+};
+
+} // namespace common
@@ -1,48 +1,93 @@
 #pragma once
 #include <math.h>
 
+#include <algorithm>
+#include <bit>
+#include <exception>
+#include <functional>
 #include <iostream>
 #include <map>
+#include <memory>
 #include <optional>
 #include <set>
 #include <vector>
 
+#include "oram/common/access_stats.hpp"
 #include "oram/common/block.hpp"
+#include "oram/common/bucket_arena.hpp"
+#include "oram/common/checkpoint.hpp"
+#include "oram/common/merkle.hpp"
+#include "oram/common/oram_client.hpp"
+#include "oram/common/position_map.hpp"
+#include "oram/common/simd_scan.hpp"
+#include "oram/common/stash.hpp"
 #include "server/channel.hpp"
+#include "utils/cipher.hpp"
 #include "utils/crypto.hpp"
 #include "utils/random_gen.hpp"
 #include "threadpool.h"
+#include "worker.hpp"
 #include "stopwatch.hpp"
 
 
-using ORKey = uint32_t;
-
 template <size_t B>
-class PathORAMClient {
+class RecursivePositionMap;
+
+// Position map selection for a client. Recursive maps store the leaves in a
+// chain of smaller ORAMs (kept in `storage`, disk files get a per-level
+// suffix) until a level has at most `recursion_cutoff` entries, which are then
+// kept in a local dense array.
+struct PositionMapConfig {
+  common::PositionMapType type = common::PositionMapType::Dense;
+  size_t recursion_cutoff = 1ULL << 16;
+  server::ServerConfig storage{server::ServerConfig::StorageType::Memory, ""};
+
+  PositionMapConfig() = default;
+  PositionMapConfig(common::PositionMapType type) : type(type) {}
+  PositionMapConfig(common::PositionMapType type, size_t cutoff, server::ServerConfig storage)
+      : type(type), recursion_cutoff(cutoff), storage(std::move(storage)) {}
+};
+
+// Z: blocks per bucket
+template <size_t B, size_t Z = common::kDefaultZ>
+class PathORAMClient : public common::ORAMClient<B> {
 
  public:
   bool setup_ = false, successful = false;
-  inline static constexpr size_t BlockSize() { return sizeof(uint32_t) + B; }
+  inline static constexpr size_t BlockSize() { return common::Block<B>::SerializedSize(); }
 
   inline static constexpr size_t EncryptedBlockSize() {
-    return utils::CiphertextLen(BlockSize());
+    return utils::SealedLen(BlockSize());
   }
 
+  // With ORAM_INTEGRITY, a serialized bucket ends with its children's digests
   inline static constexpr size_t BucketSize() {
-    return sizeof(char) + Z * BlockSize();
+    return common::Bucket<B, Z>::SerializedSize() + (common::kIntegrity ? common::MerkleTree::kTrailerSize : 0);
   }
 
   inline static constexpr size_t EncryptedBucketSize() {
-    return utils::CiphertextLen(BucketSize());
+    return utils::SealedLen(BucketSize());
+  }
+
+  // Buckets in the tree of n blocks (e.g. ServerConfig::num_buckets)
+  inline static constexpr size_t NumBuckets(size_t n) {
+    return 2 * std::bit_ceil(std::max<size_t>(n, 1)) - 1;
   }
 
-    using TPathORAMChannel = std::shared_ptr<channel::PathORAMChannel<char *, PathORAMClient<B>::EncryptedBucketSize()>>;
+    using TPathORAMChannel = std::shared_ptr<channel::PathORAMChannel<char *, EncryptedBucketSize()>>;
 
+  // treetop_levels: number of top tree levels kept decrypted on the client
+  // (0 disables the cache).
+  // ctx: threadpool whose workers decrypt/deserialize and serialize/encrypt
+  // the buckets of a path in parallel (nullptr: the calling thread does it).
   static std::optional<PathORAMClient *> Construct(size_t n, 
             TPathORAMChannel channel,
-            utils::Key key) {
+            utils::Key key,
+            PositionMapConfig pm = {},
+            size_t treetop_levels = 0,
+            threadpool::threadpool_context_t *ctx = nullptr) {
     // Initialize the ORAM
-    auto o = new PathORAMClient(n, std::move(channel), key);
+    auto o = new PathORAMClient(n, std::move(channel), key, pm, treetop_levels, ctx);
     if (o->successful) {
       return o;
     }
@@ -50,18 +95,152 @@ class PathORAMClient {
     return std::nullopt;
   }
 
-  void ParInit(threadpool::threadpool_context *ctx, std::vector<common::Block<B>> &blocks, size_t n_threads) {
+  // Reopens an ORAM from a Checkpoint: the client state comes from the
+  // (memory-mapped) checkpoint file, the buckets from channel, which must
+  // hold the tree the checkpoint was taken with (e.g. the same disk image,
+  // or a CloneFile of it). Returns nullopt if the checkpoint was written for
+  // another block size, Z, id width or key.
+  static std::optional<PathORAMClient *> Restore(const std::string &path,
+            TPathORAMChannel channel,
+            utils::Key key,
+            threadpool::threadpool_context_t *ctx = nullptr) {
+    common::MappedFile file(path);
+    common::CheckpointHeader h;
+    if (file.size() < sizeof(h)) {
+      throw std::runtime_error("Truncated checkpoint: " + path);
+    }
+    std::memcpy(&h, file.data(), sizeof(h));
+    if (std::memcmp(h.magic, common::CheckpointHeader::kMagic, sizeof(h.magic)) != 0 ||
+        h.version != common::CheckpointHeader::kVersion) {
+      throw std::runtime_error("Not a checkpoint of this version: " + path);
+    }
+    if (h.block_size != B || h.z != Z || h.id_bytes != sizeof(ORId)
+        || h.cipher != static_cast<uint64_t>(utils::kBucketCipher)) {
+      spdlog::error("Checkpoint {} is for B={}, Z={}, {}-byte ids, cipher {}", path, h.block_size, h.z, h.id_bytes,
+                    h.cipher);
+      return std::nullopt;
+    }
+    if (std::memcmp(h.key_digest, common::KeyDigest(key).data(), sizeof(h.key_digest)) != 0) {
+      spdlog::error("Checkpoint {} was taken with another key", path);
+      return std::nullopt;
+    }
+    const size_t stash_bytes = h.stash_blocks * sizeof(common::Block<B>);
+    const size_t treetop_bytes = h.treetop_buckets * sizeof(common::Bucket<B, Z>);
+    const size_t digest_bytes = h.top_digests * sizeof(common::Digest);
+    if (file.size() != sizeof(h) + h.pos_map_bytes + stash_bytes + treetop_bytes + digest_bytes) {
+      throw std::runtime_error("Truncated checkpoint: " + path);
+    }
+
+    auto pm_type = static_cast<common::PositionMapType>(h.pos_map_type);
+    // Owned until the end: loading the map or the stash may throw
+    std::unique_ptr<PathORAMClient> o(
+        new PathORAMClient(h.n, std::move(channel), key, PositionMapConfig(pm_type), h.treetop_levels, ctx));
+    if (o->treetop_.size() != h.treetop_buckets || o->merkle_.top().size() != h.top_digests) {
+      throw std::runtime_error("Checkpoint treetop does not match its tree: " + path);
+    }
+    const char *p = file.data() + sizeof(h);
+    o->pos_map_->load(p, h.pos_map_bytes);
+    p += h.pos_map_bytes;
+    o->stash_.clear();
+    for (size_t i = 0; i < h.stash_blocks; i++, p += sizeof(common::Block<B>)) {
+      common::Block<B> b;
+      std::memcpy(&b, p, sizeof(b));
+      o->stash_.insert(b);
+    }
+    // Either may be empty (no treetop, no integrity), and data() then null
+    if (treetop_bytes > 0) {
+      std::memcpy(o->treetop_.data(), p, treetop_bytes);
+    }
+    p += treetop_bytes;
+    if (digest_bytes > 0) {
+      std::memcpy(o->merkle_.top().data(), p, digest_bytes);
+    }
+    o->reserve_working_set();
+    o->setup_ = true;
+    return o.release();
+  }
+
+  ~PathORAMClient() override {
+    if (evict_pending_) {
+      evict_worker_->wait_task(evict_task_);
+    }
+  }
+
+  // Background eviction: an eviction still picks its blocks and fills its
+  // buckets right away, but serializing, encrypting and writing them runs
+  // on a thread of ctx while the next access reads its path. Only the
+  // buckets the two accesses share wait for the write; the buckets read and
+  // written per access do not change. stash_budget bounds the blocks held
+  // on the client (the stash plus those of the eviction in flight): an
+  // eviction that would exceed it is written synchronously (0: the maximum
+  // stash size).
+  void EnableBackgroundEviction(threadpool::threadpool_context_t *ctx, size_t stash_budget = 0) {
+    await_eviction();
+    evict_worker_ = std::make_unique<EvictWorker>(ctx, 1);
+    stash_budget_ = stash_budget ? stash_budget : max_stash_size_;
+  }
+
+  // seed: draw the leaves deterministically (the same tree for the same
+  // seed and blocks, whatever n_threads is).
+  void ParInit(threadpool::threadpool_context *ctx, std::vector<common::Block<B>> &blocks, size_t n_threads,
+               std::optional<uint64_t> seed = std::nullopt) {
     if (!successful)
         return;
     
-    run_setup_par(ctx, blocks, n_threads);
+    await_eviction();
+    run_setup_par(ctx, blocks, n_threads, seed);
+    stats_.reset();
   }
 
-  void Init(std::vector<common::Block<B>> &blocks) {
+  void Init(std::vector<common::Block<B>> &blocks) override {
     if (!successful)
         return;
     
+    await_eviction();
     Setup(blocks);
+    stats_.reset();
+  }
+
+  // Writes the client state to path (see Restore): the tree parameters, a
+  // digest of the key (not the key), the position map, the stash, the
+  // treetop and the top of the Merkle tree. The buckets are not copied; a
+  // disk image stays valid as long as no access runs between the checkpoint
+  // and reopening it. Not supported with a recursive position map, or
+  // between a Read and its Evict.
+  void Checkpoint(const std::string &path) {
+    await_eviction();
+    if (!evict_leaves_.empty()) {
+      throw std::logic_error("Checkpoint between a Read and its Evict");
+    }
+    common::CheckpointHeader h{};
+    std::memcpy(h.magic, common::CheckpointHeader::kMagic, sizeof(h.magic));
+    h.version = common::CheckpointHeader::kVersion;
+    h.id_bytes = sizeof(ORId);
+    h.block_size = B;
+    h.z = Z;
+    h.n = n_;
+    h.treetop_levels = treetop_levels_;
+    h.pos_map_type = static_cast<uint64_t>(pos_map_type_);
+    h.cipher = static_cast<uint64_t>(utils::kBucketCipher);
+    auto digest = common::KeyDigest(EK);
+    std::memcpy(h.key_digest, digest.data(), sizeof(h.key_digest));
+
+    std::vector<char> out(sizeof(h));
+    pos_map_->save(out);
+    h.pos_map_bytes = out.size() - sizeof(h);
+    h.stash_blocks = stash_.size();
+    for (const auto &b : stash_) {
+      auto *c = reinterpret_cast<const char *>(&b);
+      out.insert(out.end(), c, c + sizeof(b));
+    }
+    h.treetop_buckets = treetop_.size();
+    auto *t = reinterpret_cast<const char *>(treetop_.data());
+    out.insert(out.end(), t, t + treetop_.size() * sizeof(common::Bucket<B, Z>));
+    h.top_digests = merkle_.top().size();
+    auto *d = reinterpret_cast<const char *>(merkle_.top().data());
+    out.insert(out.end(), d, d + merkle_.top().size() * sizeof(common::Digest));
+    std::memcpy(out.data(), &h, sizeof(h));
+    common::WriteFileAtomic(path, out);
   }
 
   void getPathToLeaf(Leaf leaf, std::vector<ORBucketID> &path) {
@@ -74,48 +253,214 @@ class PathORAMClient {
       if (cur_id == 0) { break; }
 
       cur_id = (cur_id - 1) / 2;  // Move to parent
-      cache_.insert(cur_id);
     }
   }
 
-  void Read(ORKey w, common::Block<B> &data) {
-    bool found = false;
+  void Read(ORKey w, common::Block<B> &data) override {
     this->Read(w);
 
-    for (auto b : stash_) {
-      if (b.key == w) {
-        data.key = b.key;
-        memcpy(data.val, b.val, B);
-        found = true;
-      }
+    Stopwatch sw;
+    sw.start();
+    auto *b = stash_.find(w);
+    TIMINGS_SAMPLE(stats_, sw, stash_lookup, 0);
+    if (!b) {
+      throw std::runtime_error("Block not found");
     }
+    data.key = b->key;
+    memcpy(data.val, b->val, B);
+  }
+
+  // Reads w, lets f modify its value in place and evicts, i.e. a single
+  // read-modify-write access.
+  template <typename F>
+  void Update(ORKey w, F &&f) {
+    this->Read(w);
 
-    if (!found) {
+    Stopwatch sw;
+    sw.start();
+    auto *b = stash_.find(w);
+    TIMINGS_SAMPLE(stats_, sw, stash_lookup, 0);
+    if (!b) {
       throw std::runtime_error("Block not found");
     }
-    return;
+    f(b->val);
+
+    this->evict();
   }
 
-  void Evict() {
+  // Serves keys[i] with ops[i] in order, as if they were issued one by one,
+  // but with a single read of the union of their paths and a single
+  // eviction over it. Writes take data[i].val (and insert missing keys);
+  // reads fill data[i]. Entries whose key is not stored, or falls outside the
+  // position map, come back as an empty block (key -1).
+  void AccessBatch(const std::vector<ORKey> &keys, const std::vector<AccessOp> &ops,
+                   std::vector<common::Block<B>> &data) override {
+    if (keys.size() != ops.size()) {
+      throw std::invalid_argument("AccessBatch: keys and ops must have the same length");
+    }
+    data.resize(keys.size());
+
+    // Remap every key. A key accessed twice reads, the second time, the
+    // fresh leaf drawn by its first access: an independent random path.
+    Stopwatch sw;
+    sw.start();
+    auto &new_leaves = batch_leaves_;
+    auto &mapped = batch_mapped_;
+    auto &ids = path_ids_;
+    new_leaves.resize(keys.size());
+    random_gen::FillRandomNumbers(new_leaves.data(), keys.size(), n_, min_leaf_);
+    mapped.assign(keys.size(), true);
+    ids.clear();
+    for (size_t i = 0; i < keys.size(); i++) {
+      Leaf leaf;
+      try {
+        leaf = pos_map_->remap(keys[i], new_leaves[i]);
+      } catch (const std::out_of_range &) {
+        // Key outside the position map: still read a random path so the
+        // batch keeps its shape
+        leaf = min_leaf_ + random_gen::generateRandomNumber(n_);
+        mapped[i] = false;
+      }
+      // The path is known before the next keys are remapped (an access of
+      // a recursive position map each): let the storage start fetching it.
+      // The remote buckets come first, leaf to treetop.
+      const size_t first = ids.size();
+      getPathToLeaf(leaf, ids);
+      size_t remote = 0;
+      while (first + remote < ids.size() && ids[first + remote] >= treetop_.size()) {
+        remote++;
+      }
+      channel_->prefetch(std::span<const ORBucketID>(ids.data() + first, remote));
+      evict_leaves_.push_back(leaf);
+    }
+
+    std::sort(ids.begin(), ids.end());
+    ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+    TIMINGS_SAMPLE(stats_, sw, path_compute, 0);
+    read_path(ids);
+
+    sw.start();
+    for (size_t i = 0; i < keys.size(); i++) {
+      auto *b = stash_.find(keys[i]);
+      if (ops[i] == AccessOp::Write && mapped[i]) {
+        if (!b) {
+          b = &stash_.insert(common::Block<B>(keys[i], data[i].val));
+        } else {
+          memcpy(b->val, data[i].val, B);
+        }
+      } else if (ops[i] == AccessOp::Read && b) {
+        data[i] = *b;
+      } else {
+        data[i] = common::Block<B>();
+        continue;
+      }
+      b->leaf = new_leaves[i];
+      data[i].leaf = 0;
+    }
+    TIMINGS_SAMPLE(stats_, sw, stash_lookup, 0);
+
+    this->evict();
+  }
+
+  void Evict() override {
     this -> evict();
   }
 
+  // Client-side bytes held for this ORAM: the position map (including any
+  // recursive levels), the stash and the treetop cache.
+  size_t ClientMemoryBytes() const override {
+    return pos_map_->memory_bytes() + stash_.memory_bytes() +
+           treetop_.size() * sizeof(common::Bucket<B, Z>) +
+           enc_arena_.memory_bytes() + plain_arena_.memory_bytes() +
+           bg_buckets_.capacity() * sizeof(common::Bucket<B, Z>) + bg_enc_arena_.memory_bytes() +
+           bg_plain_arena_.memory_bytes();
+  }
+
+  size_t TreetopLevels() const { return treetop_levels_; }
+
+  size_t PositionMapLevels() const { return pos_map_->levels(); }
+
+  // Per-phase timings and per-access counters since the last Init/ParInit
+  // (or ResetStats). Background eviction and crypto workers sample them too,
+  // so they can be read while accesses run.
+  const common::AccessStats &Stats() const { return stats_; }
+  void ResetStats() { stats_.reset(); }
+
  protected:
-  std::map<ORKey, Leaf> pos_map_;  // position map
-  std::set<ORBucketID>
-      cache_;  // Stores which nodes have been accessed so far (before eviction)
-  std::vector<common::Block<B>> stash_;
+  std::unique_ptr<common::PositionMap> pos_map_;  // position map
+  std::vector<Leaf> evict_leaves_;  // Leaves of the paths read since the last eviction
+  common::Stash<B> stash_;
   size_t n_, bs_, min_leaf_, max_stash_size_, l_;  // n_ = number of blocks, bs_ = block size, l_ = height of the tree
   size_t en_bs_, max_leaf_;   // Encrypted block size
   size_t bus_;     // Bucket size
   size_t en_bus_;  // Encrypted bucket size
   TPathORAMChannel channel_;
   utils::Key EK;
-  std::mutex cache_mutex_;
+  utils::CipherEngine cipher_;  // seals buckets under EK
+
+  common::PositionMapType pos_map_type_;  // the map actually built (small recursive maps are dense)
+
+  // Treetop cache: buckets 0 .. treetop_.size() - 1 (the top
+  // treetop_levels_ levels) live decrypted on the client and never reach
+  // the channel.
+  size_t treetop_levels_ = 0;
+  std::vector<common::Bucket<B, Z>> treetop_;
+
+  using BlockIndex = ORId;  // position of a block in the setup input
+
+  // Eviction engine scratch space, reused across evictions
+  std::vector<ORBucketID> evict_ids_;       // buckets to rebuild, level by level, sorted within a level
+  std::vector<size_t> level_off_;           // level d owns evict_ids_[level_off_[d], level_off_[d + 1])
+  std::vector<common::Bucket<B, Z>> evict_buckets_;
+  std::vector<size_t> evict_depth_, evict_order_, evict_pool_, evict_count_;
+  std::vector<Leaf> evict_heap_, evict_xor_;  // stash leaves as heap indices, and their min xor with the paths
+
+  // Access scratch space: the buffers of one path (or batch) between the
+  // client and the channel, and the id lists that go with them. Reused so
+  // that a steady-state access does not allocate.
+  inline static constexpr size_t kMaxBucketsPerWrite = 1024;  // bounds the arenas during setup
+  common::BucketArena enc_arena_{EncryptedBucketSize()}, plain_arena_{BucketSize()};
+  std::vector<ORBucketID> path_ids_, remote_ids_, send_ids_;
+  std::vector<Leaf> batch_leaves_;
+  std::vector<bool> batch_mapped_;
+  std::vector<common::Bucket<B, Z>> read_buckets_;  // decoded buckets of the last read, in id order
+  std::vector<size_t> send_slots_;               // evict_buckets_ slot of every send_ids_ entry
+
+  common::AccessStats stats_;
+
+  // Workers for the per-bucket crypto, when constructed with a threadpool
+  std::unique_ptr<threadpool::worker::DefaultParallelWorker> worker_;
+
+  // Background eviction (see EnableBackgroundEviction). The eviction in
+  // flight owns bg_*: its buckets (swapped out of evict_buckets_), their ids
+  // and its own arenas, so the read of the next access can use the others.
+  using EvictWorker = threadpool::worker::BackgroundWorker<std::function<void()>>;
+  std::unique_ptr<EvictWorker> evict_worker_;
+  typename EvictWorker::TaskHandle evict_task_;
+  bool evict_pending_ = false;
+  size_t stash_budget_ = 0;
+  std::vector<ORBucketID> bg_ids_;
+  std::vector<common::Bucket<B, Z>> bg_buckets_;
+  common::BucketArena bg_enc_arena_{EncryptedBucketSize()}, bg_plain_arena_{BucketSize()};
+  size_t bg_blocks_ = 0;            // real blocks in bg_buckets_
+  std::exception_ptr bg_error_;
+  std::vector<ORBucketID> split_ids_[2];  // read_path: buckets off / on the eviction in flight
+  std::vector<char *> split_bufs_[2];
+
+  // Integrity (ORAM_INTEGRITY): the digests of the first remote level, the
+  // child digests of the buckets read since the last eviction, and the
+  // linking scratch of this thread and of the background eviction
+  common::MerkleTree merkle_;
+  std::vector<common::MerkleTree::Children> merkle_read_, bg_merkle_read_;
+  common::MerkleTree::LinkState merkle_link_, bg_merkle_link_;
+  std::vector<common::Digest> read_digests_;  // of the buckets of the last read
 
   PathORAMClient(size_t n, 
         TPathORAMChannel channel,
-        utils::Key key) : n_(n), channel_(std::move(channel)), EK(key) {
+        utils::Key key,
+        PositionMapConfig pm = {},
+        size_t treetop_levels = 0,
+        threadpool::threadpool_context_t *ctx = nullptr) : n_(n), channel_(std::move(channel)), EK(key), cipher_(key) {
     bs_ = BlockSize();
     en_bs_ = EncryptedBlockSize();
     bus_ = BucketSize();
@@ -124,113 +469,224 @@ class PathORAMClient {
     max_stash_size_ = 2 * Z * l_;
     min_leaf_ = (1ULL << l_) - 1;
     max_leaf_ = min_leaf_ << 1;
+    treetop_levels_ = std::min(treetop_levels, l_ + 1);
+    treetop_.resize((1ULL << treetop_levels_) - 1);
+    if constexpr (common::kIntegrity) {
+      merkle_ = common::MerkleTree(treetop_levels_, l_);
+    }
+    if (ctx && ctx->num_threads > 0) {
+      worker_ = std::make_unique<threadpool::worker::DefaultParallelWorker>(ctx);
+    }
+    pos_map_type_ = pm.type;
+    if (pm.type != common::PositionMapType::Recursive) {
+      pos_map_ = common::MakePositionMap(pm.type, n_, l_, min_leaf_);
+    } else if (n_ > pm.recursion_cutoff) {
+      pos_map_ = std::make_unique<RecursivePositionMap<B>>(n_, l_, min_leaf_, pm, key);
+    } else {
+      pos_map_type_ = common::PositionMapType::Dense;
+      pos_map_ = common::MakePositionMap(common::PositionMapType::Dense, n_, l_, min_leaf_);
+    }
 
     successful = true;
   }
 
   void Read(ORKey w) {
-    Leaf leaf = pos_map_[w];
-    std::vector<ORBucketID> path;
-    getPathToLeaf(leaf, path);
-
-    read_path(path);
+    Stopwatch sw;
+    sw.start();
+    Leaf new_leaf = min_leaf_ + random_gen::generateRandomNumber(n_);
+    Leaf leaf = pos_map_->remap(w, new_leaf);
+    path_ids_.clear();
+    getPathToLeaf(leaf, path_ids_);
+    evict_leaves_.push_back(leaf);
 
-    pos_map_[w] = min_leaf_ + random_gen::generateRandomNumber(n_);
+    TIMINGS_SAMPLE(stats_, sw, path_compute, 0);
+    read_path(path_ids_);
 
+    sw.start();
+    if (auto *b = stash_.find(w)) {
+      b->leaf = new_leaf;
+    }
+    TIMINGS_SAMPLE(stats_, sw, stash_lookup, 0);
   }
 
   void Write(ORKey w, uint8_t *data) {
-    Leaf leaf = pos_map_[w];
-    std::vector<ORBucketID> path;
-    getPathToLeaf(leaf, path);
-
-    read_path(path);
-
-    for (auto b : stash_) {
-      if (b.key == w) {
-        memcpy(b.val, data, B);
-      }
-    }
-
+    Stopwatch sw;
+    sw.start();
     Leaf new_leaf = min_leaf_ + random_gen::generateRandomNumber(n_);
-    pos_map_[w] = new_leaf;
+    Leaf leaf = pos_map_->remap(w, new_leaf);
+    path_ids_.clear();
+    getPathToLeaf(leaf, path_ids_);
+    evict_leaves_.push_back(leaf);
+
+    TIMINGS_SAMPLE(stats_, sw, path_compute, 0);
+    read_path(path_ids_);
+
+    sw.start();
+    if (auto *b = stash_.find(w)) {
+      memcpy(b->val, data, B);
+      b->leaf = new_leaf;
+    }
+    TIMINGS_SAMPLE(stats_, sw, stash_lookup, 0);
   }
 
 
   
-  struct par_setup_args {
-    std::vector<common::Block<B>> &blocks;
-    size_t n_threads;
-    size_t thread_id;
-    size_t start,end;
-    PathORAMClient<B> *oram;
-  };
-  void ParSetup(void *args) {
-    spdlog::info("\tthread_id:{}\n\tstart:{}\n\tend:{}", static_cast<par_setup_args *>(args)->thread_id, static_cast<par_setup_args *>(args)->start, static_cast<par_setup_args *>(args)->end);
-    auto *setup_args = static_cast<par_setup_args *>(args);
-    auto &[blocks, n_threads, thread_id, start, end, oram] = *setup_args;
-    assert(oram);
-    auto cache_start_ = 2*start;
-    auto cache_end_ = 2*end;
-    if (thread_id == n_threads - 1) {
-      cache_end_ = 2*end-1;
-    }
-
-    for (size_t i = start; i < end; i++) {
-      Leaf k = oram->min_leaf_ + random_gen::generateRandomNumber(n_);
-      oram->pos_map_.insert({blocks[i].key, k});
-      oram->stash_.push_back(blocks[i]);
-    }
-
-    for (size_t i = cache_start_; i < cache_end_; i++) {
-      std::lock_guard<std::mutex> lock(oram->cache_mutex_);
-      oram->cache_.insert(i);
-    }
-  }
-
-  void run_setup_par(threadpool::threadpool_context_t *ctx, std::vector<common::Block<B>> &blocks, size_t n_threads) {
-// #ifdef LOG
+  // Parallel setup. Threads own disjoint ranges: they draw the leaves of a
+  // range of blocks, partition their blocks by subtree, and then build,
+  // serialize and encrypt whole subtrees of (at most) kMaxBucketsPerWrite
+  // buckets, a round of one subtree per thread at a time. The calling thread
+  // writes every round to the channel and finally builds the levels above
+  // the subtrees from the blocks their roots could not hold. Buckets are
+  // filled as in bulk_load, so the tree only depends on the leaves, and with
+  // a seed the leaves are Mix64(seed + i) for block i, whatever the number of
+  // threads.
+  void run_setup_par(threadpool::threadpool_context_t *ctx, std::vector<common::Block<B>> &blocks, size_t n_threads,
+                     std::optional<uint64_t> seed) {
     spdlog::info("[PAR-SETUP]: \n n = {}\n num_threads = {}", blocks.size(), n_threads);
-// #endif
-
-    auto works_ = (threadpool::thread_work *)alloca(n_threads * sizeof(threadpool::thread_work));
-    auto args_ = (par_setup_args *)alloca(n_threads * sizeof(par_setup_args));
-    size_t work_count = 0;
     Stopwatch parsetup;
-
     parsetup.start();
-    for(size_t tid = 0; tid < n_threads; tid++) {
-      size_t start = (tid * blocks.size()) / n_threads;
-      size_t end = ((tid + 1) * blocks.size()) / n_threads;
-
-      new (&args_[work_count]) par_setup_args{blocks, n_threads, tid, start, end, this};
 
-      if (tid == n_threads - 1) {
-        this->ParSetup(&args_[work_count]);
+    std::unique_ptr<threadpool::worker::DefaultParallelWorker> worker;
+    if (ctx) {
+      n_threads = std::min(n_threads, ctx->num_threads + 1);
+    }
+    if (ctx && n_threads > 1) {
+      worker = std::make_unique<threadpool::worker::DefaultParallelWorker>(ctx, n_threads);
+    } else {
+      n_threads = 1;
+    }
+    auto parallel = [&](const std::function<void(size_t)> &f) {
+      if (worker) {
+        worker->parallel_work(f);
+      } else {
+        f(0);
       }
-      else {
-        works_[work_count] = threadpool::thread_work {
-                              .type = threadpool::THREAD_WORK_SINGLE,
-                              .single = {.func = [](void *arg) { 
-                                          auto *args = static_cast<par_setup_args *>(arg);
-                                          args->oram->ParSetup(arg); 
-                                                  },
-                                         .arg = &args_[work_count]}
-                          };
-        threadpool::thread_work_push(ctx, &works_[work_count]);
-        work_count++;  
+    };
+    auto range = [&](size_t t, size_t count) {
+      return std::make_pair(t * count / n_threads, (t + 1) * count / n_threads);
+    };
+
+    // Leaves, drawn per block range
+    parallel([&](size_t t) {
+      auto [start, end] = range(t, blocks.size());
+      for (size_t i = start; i < end; i++) {
+        uint64_t r = seed ? random_gen::Mix64(*seed + i) % n_ : random_gen::generateRandomNumber(n_);
+        blocks[i].leaf = min_leaf_ + r;
       }
+    });
+    // Neighbouring keys of a dense position map share words, so the map is
+    // filled by this thread
+    for (auto &b : blocks) {
+      pos_map_->set(b.key, b.leaf);
     }
 
-    for (size_t i = 0; i < work_count; i++) {
-      spdlog::info("[PAR-SETUP]: waiting for thread {}", i);
-      threadpool::thread_wait(ctx, &works_[i]);
+    // Partition the blocks by subtree: counting sort on the subtree of the
+    // leaf, per thread range, then a scatter into disjoint slices
+    size_t height = std::min<size_t>(l_, std::bit_width(kMaxBucketsPerWrite) - 2);
+    size_t root_level = l_ - height;
+    size_t n_subtrees = 1ULL << root_level;
+    std::vector<size_t> offsets(n_threads * n_subtrees + 1, 0);
+    parallel([&](size_t t) {
+      auto [start, end] = range(t, blocks.size());
+      for (size_t i = start; i < end; i++) {
+        offsets[((blocks[i].leaf - min_leaf_) >> height) * n_threads + t + 1]++;
+      }
+    });
+    for (size_t j = 1; j < offsets.size(); j++) {
+      offsets[j] += offsets[j - 1];
     }
-    spdlog::info("[PAR-SETUP] time elapsed for par {}", parsetup.elapsed_sec());
+    std::vector<std::pair<Leaf, BlockIndex>> order(blocks.size());
+    parallel([&](size_t t) {
+      auto [start, end] = range(t, blocks.size());
+      std::vector<size_t> pos(n_subtrees);
+      for (size_t j = 0; j < n_subtrees; j++) {
+        pos[j] = offsets[j * n_threads + t];
+      }
+      for (size_t i = start; i < end; i++) {
+        order[pos[(blocks[i].leaf - min_leaf_) >> height]++] = {blocks[i].leaf, static_cast<BlockIndex>(i)};
+      }
+    });
+
+    // Subtrees, one per thread and round
+    struct SubtreeState {
+      std::vector<std::vector<BlockIndex>> pending;
+      std::vector<common::Bucket<B, Z>> buckets;
+      std::vector<ORBucketID> ids;
+      common::BucketArena enc{EncryptedBucketSize()}, plain{BucketSize()};
+      common::MerkleTree::LinkState link;
+      std::vector<common::MerkleTree::Children> none;  // every child is written
+      bool ok = true;
+    };
+    std::vector<SubtreeState> states(n_threads);
+    std::vector<std::vector<BlockIndex>> carries(n_subtrees);
+    stash_.clear();
+    for (size_t round = 0; round < n_subtrees; round += n_threads) {
+      parallel([&](size_t t) {
+        size_t j = round + t;
+        if (j >= n_subtrees) {
+          return;
+        }
+        auto &st = states[t];
+        st.pending.resize(l_ + 1);
+        st.buckets.resize(2ULL << height);
+        st.ids.clear();
+        auto first = order.begin() + offsets[j * n_threads];
+        auto last = order.begin() + offsets[(j + 1) * n_threads];
+        std::sort(first, last);
+
+        build_subtree(blocks, &*first, &*first + (last - first), min_leaf_ + (j << height), root_level, st.pending,
+                      [&](ORBucketID id) -> common::Bucket<B, Z> & {
+                        if (id < treetop_.size()) {
+                          return treetop_[id];
+                        }
+                        st.ids.push_back(id);
+                        return st.buckets[st.ids.size() - 1];
+                      },
+                      &carries[j]);
+
+        auto enc = st.enc.acquire(st.ids.size());
+        auto ser = st.plain.acquire(st.ids.size());
+        for (size_t k = 0; k < st.ids.size(); k++) {
+          st.buckets[k].serialize(ser[k]);
+        }
+        if constexpr (common::kIntegrity) {
+          merkle_.link(st.ids, ser, bus_, st.link, st.none);
+        }
+        st.ok = cipher_.SealBatch(ser, bus_, enc) && st.ok;
+      });
+
+      for (size_t t = 0; t < n_threads && round + t < n_subtrees; t++) {
+        auto &st = states[t];
+        if (!st.ok) {
+          throw std::runtime_error("Failed to encrypt bucket");
+        }
+        merkle_link_.pending.merge(st.link.pending);
+        channel_->write_buckets(std::span<const ORBucketID>(st.ids), st.enc.acquire(st.ids.size()));
+      }
+    }
+    states.clear();
+
+    // Levels above the subtrees: a bucket takes the blocks its two children
+    // could not hold
+    begin_stream();
+    for (size_t level = root_level; level-- > 0;) {
+      std::vector<std::vector<BlockIndex>> up(1ULL << level);
+      for (size_t j = 0; j < up.size(); j++) {
+        auto &waiting = carries[2 * j];
+        waiting.insert(waiting.end(), carries[2 * j + 1].begin(), carries[2 * j + 1].end());
+        fill_bucket(stream_bucket((1ULL << level) - 1 + j), blocks, waiting, level > 0 ? &up[j] : nullptr);
+      }
+      carries = std::move(up);
+    }
+    if (root_level == 0) {
+      for (auto i : carries[0]) {
+        stash_.insert(blocks[i]);
+      }
+    }
+    end_stream();
 
-    // Evict the stash
     setup_ = true;
-    evict();
+    spdlog::info("[PAR-SETUP] time elapsed for par {}", parsetup.elapsed_sec());
   }
 
   void Setup(std::vector<common::Block<B>> &blocks) {
@@ -239,152 +695,559 @@ class PathORAMClient {
     setup.start();
     for (size_t i = 0; i < n_; i++) {
       Leaf k = this->min_leaf_ + random_gen::generateRandomNumber(n_);
-      pos_map_.insert({blocks[i].key, k});
+      pos_map_->set(blocks[i].key, k);
+      blocks[i].leaf = k;
     }
 
-    // Since eviction works with cache, we make cache contain all nodes of the tree
-    for (size_t i = 0; i < 2*n_-1; i++) { cache_.insert(i); }
+    // Pack the blocks into every bucket of the tree (all buckets up to the
+    // last leaf, so that unused leaves are written too)
+    setup_ = true;
+    bulk_load(blocks);
+    spdlog::info("[SEQ-SETUP] time elapsed for seq {}", setup.elapsed_sec());
+  }
 
-    // Push all the blocks into the stash
-    for (auto b : blocks) {
-      stash_.push_back(b);
+  // Builds the initial tree bottom-up from blocks that already carry their
+  // leaf. The blocks are sorted by leaf and the buckets are filled in
+  // post-order (see build_subtree), the same placement as evicting
+  // everything at once. Finished buckets are streamed to the channel in
+  // chunks, so memory beyond the input is the sort order, one chunk and the
+  // few blocks in transit.
+  void bulk_load(const std::vector<common::Block<B>> &blocks) {
+    std::vector<std::pair<Leaf, BlockIndex>> order(blocks.size());
+    for (size_t i = 0; i < blocks.size(); i++) {
+      order[i] = {blocks[i].leaf, static_cast<BlockIndex>(i)};
     }
-    spdlog::info("[SEQ-SETUP] time elapsed for seq {}", setup.elapsed_sec());
+    std::sort(order.begin(), order.end());
+
+    stash_.clear();
+    begin_stream();
+    std::vector<std::vector<BlockIndex>> pending(l_ + 1);
+    build_subtree(blocks, order.data(), order.data() + order.size(), min_leaf_, 0, pending,
+                  [&](ORBucketID id) -> common::Bucket<B, Z> & { return stream_bucket(id); }, nullptr);
+    end_stream();
+  }
 
-    // Evict the stash
-    setup_ = true;
-    evict();
+  // Fills, in post-order (a leaf, then every ancestor whose right subtree it
+  // completes), the buckets of the subtree rooted on root_level whose first
+  // leaf is first_leaf. [first, last) are the (leaf, block index) pairs of
+  // its blocks, sorted. bucket(id) returns the bucket to fill for id;
+  // pending[d] holds the blocks waiting for the open bucket on level d, and
+  // the blocks the root cannot hold go to carry (the stash if null).
+  template <typename BucketFor>
+  void build_subtree(const std::vector<common::Block<B>> &blocks, const std::pair<Leaf, BlockIndex> *first,
+                     const std::pair<Leaf, BlockIndex> *last, uint64_t first_leaf, size_t root_level,
+                     std::vector<std::vector<BlockIndex>> &pending, BucketFor &&bucket, std::vector<BlockIndex> *carry) {
+    uint64_t last_leaf = first_leaf + (1ULL << (l_ - root_level)) - 1;
+    for (uint64_t leaf = first_leaf; leaf <= last_leaf; leaf++) {
+      for (; first != last && first->first == leaf; first++) {
+        pending[l_].push_back(first->second);
+      }
+      fill_bucket(bucket(leaf), blocks, pending[l_], l_ > root_level ? &pending[l_ - 1] : carry);
+
+      uint64_t pos = leaf - first_leaf + 1;
+      for (size_t level = l_; level-- > root_level && pos % 2 == 0;) {
+        pos >>= 1;
+        fill_bucket(bucket(ancestor(leaf, level)), blocks, pending[level],
+                    level > root_level ? &pending[level - 1] : carry);
+      }
+    }
+  }
+
+  // Puts up to Z of the waiting blocks in bu and passes the rest up (to the
+  // stash if up is null).
+  void fill_bucket(common::Bucket<B, Z> &bu, const std::vector<common::Block<B>> &blocks,
+                   std::vector<BlockIndex> &waiting, std::vector<BlockIndex> *up) {
+    size_t keep = std::min<size_t>(waiting.size(), Z);
+    bu.flags_ = keep;
+    for (size_t k = 0; k < Z; k++) {
+      bu.blocks_[k] = k < keep ? blocks[waiting[k]] : common::Block<B>();
+    }
+    for (size_t k = keep; k < waiting.size(); k++) {
+      if (up) {
+        up->push_back(waiting[k]);
+      } else {
+        stash_.insert(blocks[waiting[k]]);
+      }
+    }
+    waiting.clear();
+  }
+
+  // Streaming writes of a setup: stream_bucket(id) hands out the bucket for
+  // id (the treetop copy, or a slot of the current chunk, which is sent when
+  // full).
+  void begin_stream() {
+    if (evict_buckets_.size() < kMaxBucketsPerWrite) {
+      evict_buckets_.resize(kMaxBucketsPerWrite);
+    }
+    send_ids_.clear();
+    send_slots_.clear();
+  }
+
+  common::Bucket<B, Z> &stream_bucket(ORBucketID id) {
+    if (id < treetop_.size()) {
+      return treetop_[id];
+    }
+    if (send_ids_.size() == kMaxBucketsPerWrite) {
+      send_encrypted();
+    }
+    send_slots_.push_back(send_ids_.size());
+    send_ids_.push_back(id);
+    return evict_buckets_[send_slots_.back()];
+  }
+
+  void end_stream() {
+    send_encrypted();
+
+    // Drop the scratch space sized for the chunks
+    std::vector<common::Bucket<B, Z>>().swap(evict_buckets_);
+    enc_arena_.release();
+    plain_arena_.release();
+    reserve_working_set();
+  }
+
+  // Sizes the stash and the eviction scratch for steady-state accesses (a
+  // full stash plus one path)
+  void reserve_working_set() {
+    const size_t working = max_stash_size_ + Z * (l_ + 1);
+    stash_.reserve(working);
+    for (auto *v : {&evict_depth_, &evict_order_, &evict_pool_}) {
+      v->reserve(working);
+    }
+    evict_heap_.reserve(working);
+    evict_xor_.reserve(working);
   }
 
   void read_path(std::vector<ORBucketID> &ids) {
-    // Read the Encrypted buckets from the server
-    std::vector<char *> enc_buckets;
+    // Cached buckets are emptied straight into the stash
+    Stopwatch sw;
+    sw.start();
+    auto &remote = remote_ids_;
+    remote.clear();
     for (auto id : ids) {
-      char *en_bu = (char *)malloc(en_bus_ * sizeof(char));
-      enc_buckets.push_back(en_bu);
+      if (id < treetop_.size()) {
+        auto &bu = treetop_[id];
+        for (int i = 0; i < bu.flags_; i++) {
+          stash_.insert(std::move(bu.blocks_[i]));
+        }
+        bu.flags_ = 0;
+      } else {
+        remote.push_back(id);
+      }
+    }
+    TIMINGS_SAMPLE(stats_, sw, stash_lookup, 0);
+    if (remote.empty()) {
+      return;
     }
-    channel_->read_buckets(ids, enc_buckets);
 
-    // Iterate over the read buckets
-    for (auto en_bu : enc_buckets) {
-      // Decrypt each bucket
-      char *bu_ser = (char *)malloc(bus_ * sizeof(char));
-      auto dec_ = utils::Decrypt(en_bu, en_bus_, EK, bu_ser);
+    // Read the Encrypted buckets from the server into the arena
+    auto enc_buckets = enc_arena_.acquire(remote.size());
+    auto ser_buckets = plain_arena_.acquire(remote.size());
+    sw.start();
+    if (evict_pending_) {
+      read_around_eviction(remote, enc_buckets);
+    } else {
+      channel_->read_buckets(std::span<const ORBucketID>(remote), enc_buckets);
+    }
+    TIMINGS_SAMPLE(stats_, sw, channel_read, 0);
+    NUMBER_SAMPLE(stats_, buckets_read, remote.size());
+    NUMBER_SAMPLE(stats_, bytes_read, remote.size() * en_bus_);
+
+    // Decrypt and deserialize each bucket (possibly in parallel), hashing
+    // it on the way when the tree is authenticated
+    if (read_buckets_.size() < remote.size()) {
+      read_buckets_.resize(remote.size());
+    }
+    if constexpr (common::kIntegrity) {
+      read_digests_.resize(remote.size());
+    }
+    bool ok = for_each_range(remote.size(), [&](size_t start, size_t end) {
+      Stopwatch bsw;
+      bsw.start();
+      if (!cipher_.OpenBatch(enc_buckets.subspan(start, end - start), en_bus_, bus_,
+                             ser_buckets.subspan(start, end - start))) {
+        return false;
+      }
+      TIMINGS_SAMPLE_N(stats_, bsw, decrypt, end - start);
+      if constexpr (common::kIntegrity) {
+        bsw.start();
+        for (size_t i = start; i < end; i++) {
+          common::HashBucket(ser_buckets[i], bus_, read_digests_[i]);
+        }
+        TIMINGS_SAMPLE_N(stats_, bsw, integrity, end - start);
+      }
+      bsw.start();
+      for (size_t i = start; i < end; i++) {
+        read_buckets_[i].deserialize(ser_buckets[i]);
+      }
+      TIMINGS_SAMPLE_N(stats_, bsw, deserialize, end - start);
+      return true;
+    });
+    if (!ok) {
+      throw std::runtime_error("Failed to decrypt bucket");
+    }
+    if constexpr (common::kIntegrity) {
+      sw.start();
+      merkle_.verify(remote, ser_buckets, bus_, std::span<const common::Digest>(read_digests_).first(remote.size()),
+                     merkle_read_);
+      TIMINGS_SAMPLE_N(stats_, sw, integrity, 0);
+    }
 
-      if (dec_ != bus_) {
-        throw std::runtime_error("Failed to decrypt bucket");
-        exit(1);
+    // Add the buckets' blocks to the stash, in path order so that the stash
+    // does not depend on the scheduling of the workers
+    sw.start();
+    for (size_t i = 0; i < remote.size(); i++) {
+      auto &bu = read_buckets_[i];
+      for (int j = 0; j < bu.flags_; j++) {
+        stash_.insert(std::move(bu.blocks_[j]));
       }
+    }
+    TIMINGS_SAMPLE(stats_, sw, stash_lookup, 0);
+  }
 
-      // Deserialize the buckets
-      common::Bucket<B> bu;
-      bu.deserialize(bu_ser);
+  // Reads ids into bufs while an eviction is in flight: first the buckets it
+  // does not write, then, once it is done, the ones it does.
+  void read_around_eviction(const std::vector<ORBucketID> &ids, std::span<char *> bufs) {
+    for (size_t g = 0; g < 2; g++) {
+      split_ids_[g].clear();
+      split_bufs_[g].clear();
+    }
+    for (size_t i = 0; i < ids.size(); i++) {
+      size_t g = std::binary_search(bg_ids_.begin(), bg_ids_.end(), ids[i]);
+      split_ids_[g].push_back(ids[i]);
+      split_bufs_[g].push_back(bufs[i]);
+    }
+    channel_->read_buckets(std::span<const ORBucketID>(split_ids_[0]), std::span<char *const>(split_bufs_[0]));
+    if (!split_ids_[1].empty()) {
+      await_eviction();
+      channel_->read_buckets(std::span<const ORBucketID>(split_ids_[1]), std::span<char *const>(split_bufs_[1]));
+    }
+  }
 
-      // If the bucket is empty, continue
-      if (bu.flags_ == 0) {
-        continue;
+  // Hands the buckets in send_ids_/send_slots_ to the background thread,
+  // once the previous eviction is written.
+  void send_background() {
+    await_eviction();
+    const size_t count = send_ids_.size();
+    bg_ids_.assign(send_ids_.begin(), send_ids_.end());
+    if (bg_buckets_.size() < count) {
+      bg_buckets_.resize(count);
+    }
+    bg_blocks_ = 0;
+    for (size_t k = 0; k < count; k++) {
+      std::swap(bg_buckets_[k], evict_buckets_[send_slots_[k]]);
+      bg_blocks_ += bg_buckets_[k].flags_;
+    }
+    send_ids_.clear();
+    send_slots_.clear();
+    std::swap(merkle_read_, bg_merkle_read_);
+
+    evict_task_ = evict_worker_->queue_task([this] {
+      try {
+        const size_t count = bg_ids_.size();
+        auto ser = bg_plain_arena_.acquire(count);
+        auto enc = bg_enc_arena_.acquire(count);
+        Stopwatch sw;
+        sw.start();
+        for (size_t k = 0; k < count; k++) {
+          bg_buckets_[k].serialize(ser[k]);
+        }
+        TIMINGS_SAMPLE_N(stats_, sw, serialize, count);
+        if constexpr (common::kIntegrity) {
+          sw.start();
+          merkle_.link(bg_ids_, ser, bus_, bg_merkle_link_, bg_merkle_read_);
+          bg_merkle_read_.clear();
+          TIMINGS_SAMPLE_N(stats_, sw, integrity, count);
+        }
+        sw.start();
+        if (!cipher_.SealBatch(ser, bus_, enc)) {
+          throw std::runtime_error("Failed to encrypt bucket");
+        }
+        TIMINGS_SAMPLE_N(stats_, sw, encrypt, count);
+        sw.start();
+        channel_->write_buckets(std::span<const ORBucketID>(bg_ids_), enc);
+        TIMINGS_SAMPLE(stats_, sw, channel_write, 0);
+        NUMBER_SAMPLE(stats_, buckets_written, count);
+        NUMBER_SAMPLE(stats_, bytes_written, count * en_bus_);
+      } catch (...) {
+        bg_error_ = std::current_exception();
       }
+    });
+    if (!evict_task_.valid) {
+      throw std::runtime_error("No thread available for background eviction");
+    }
+    evict_pending_ = true;
+  }
 
-      // Otherwise, add the bucket's blocks to the stash.
-      for (int i = 0; i < bu.flags_; i++) {
-        stash_.push_back(bu.blocks_[i]);
-      }
+  // Waits for the eviction in flight, if any, and rethrows its error.
+  void await_eviction() {
+    if (!evict_pending_) {
+      return;
+    }
+    Stopwatch sw;
+    sw.start();
+    evict_worker_->wait_task(evict_task_);
+    TIMINGS_SAMPLE(stats_, sw, evict_wait, 0);
+    evict_pending_ = false;
+    bg_blocks_ = 0;
+    if (bg_error_) {
+      std::rethrow_exception(std::exchange(bg_error_, nullptr));
+    }
+  }
+
+  // Runs f(start, end) over ranges covering [0, count): one range per worker
+  // when the client has a threadpool, else the whole of it. Returns false if
+  // any call did.
+  template <typename F>
+  bool for_each_range(size_t count, F &&f) {
+    if (!worker_ || count < 2) {
+      return f(size_t(0), count);
     }
 
-    enc_buckets.clear();
+    struct Range {
+      F *f;
+      size_t count;
+      const threadpool::worker::DefaultParallelWorker *worker;
+      std::atomic<bool> ok{true};
+    } range{&f, count, worker_.get()};
+    // Captures a single pointer so that the std::function does not allocate
+    worker_->parallel_work([r = &range](size_t thread_index) {
+      auto [start, end] = r->worker->get_thread_range(thread_index, r->count);
+      if (start < end && !(*r->f)(start, end)) {
+        r->ok.store(false, std::memory_order_relaxed);
+      }
+    });
+    return range.ok.load();
   }
 
-  void evict() {
-    // If the stash is empty, return
-    if (stash_.empty()) {
-      return;
+  // Serializes and encrypts the buckets in send_slots_ (possibly in
+  // parallel) into the arena and sends them to send_ids_, at most
+  // kMaxBucketsPerWrite at a time. With integrity, children are linked
+  // before their parents: ascending ids (evictions) go out last chunk first.
+  void send_encrypted() {
+    const size_t n_chunks = (send_ids_.size() + kMaxBucketsPerWrite - 1) / kMaxBucketsPerWrite;
+    const bool reverse = common::kIntegrity && !send_ids_.empty() && send_ids_.front() < send_ids_.back();
+    for (size_t c = 0; c < n_chunks; c++) {
+      const size_t first = (reverse ? n_chunks - 1 - c : c) * kMaxBucketsPerWrite;
+      const size_t count = std::min(kMaxBucketsPerWrite, send_ids_.size() - first);
+      const auto ids = std::span<const ORBucketID>(send_ids_).subspan(first, count);
+      auto ser_buckets = plain_arena_.acquire(count);
+      auto enc_buckets = enc_arena_.acquire(count);
+      auto serialize = [&](size_t start, size_t end) {
+        Stopwatch bsw;
+        bsw.start();
+        for (size_t k = start; k < end; k++) {
+          evict_buckets_[send_slots_[first + k]].serialize(ser_buckets[k]);
+        }
+        TIMINGS_SAMPLE_N(stats_, bsw, serialize, end - start);
+      };
+      auto seal = [&](size_t start, size_t end) {
+        Stopwatch bsw;
+        bsw.start();
+        bool encrypted = cipher_.SealBatch(ser_buckets.subspan(start, end - start), bus_,
+                                           enc_buckets.subspan(start, end - start));
+        TIMINGS_SAMPLE_N(stats_, bsw, encrypt, end - start);
+        return encrypted;
+      };
+      bool ok;
+      if constexpr (common::kIntegrity) {
+        // A parent is hashed over its children's digests, so every bucket
+        // is serialized before any is linked
+        for_each_range(count, [&](size_t start, size_t end) {
+          serialize(start, end);
+          return true;
+        });
+        Stopwatch hsw;
+        hsw.start();
+        merkle_.link(ids, ser_buckets, bus_, merkle_link_, merkle_read_);
+        TIMINGS_SAMPLE_N(stats_, hsw, integrity, count);
+        ok = for_each_range(count, [&](size_t start, size_t end) { return seal(start, end); });
+      } else {
+        ok = for_each_range(count, [&](size_t start, size_t end) {
+          serialize(start, end);
+          return seal(start, end);
+        });
+      }
+      if (!ok) {
+        throw std::runtime_error("Failed to encrypt bucket");
+      }
+
+      Stopwatch sw;
+      sw.start();
+      channel_->write_buckets(ids, enc_buckets);
+      TIMINGS_SAMPLE(stats_, sw, channel_write, 0);
+      NUMBER_SAMPLE(stats_, buckets_written, count);
+      NUMBER_SAMPLE(stats_, bytes_written, count * en_bus_);
     }
+    // Every bucket read since the last eviction is rewritten by now
+    merkle_read_.clear();
+    send_ids_.clear();
+    send_slots_.clear();
+  }
 
-    std::map<ORBucketID, common::Bucket<B>> to_write;
+  // Ancestor of leaf on the given level
+  inline ORBucketID ancestor(Leaf leaf, size_t level) const {
+    return ((static_cast<uint64_t>(leaf) + 1) >> (l_ - level)) - 1;
+  }
 
-    for (auto level = l_; level >= 0; level--) {
-      // Computing the cached nodes in the current level
-      auto min_level = (1ULL << level) - 1;
-      auto max_level = min_level << 1;
-      auto low = cache_.lower_bound(min_level);
-      auto high = cache_.lower_bound(max_level);
+  // Level of the deepest common bucket of the paths to two leaves: the
+  // length of the common prefix of their (1-based) heap indices.
+  inline size_t common_depth(Leaf a, Leaf b) const {
+    return l_ - std::bit_width((static_cast<uint64_t>(a) + 1) ^ (static_cast<uint64_t>(b) + 1));
+  }
 
-#ifdef LOG
-      std::stringstream ss;
-      ss << "Evicting level " << level << std::endl
-            << "Low: " << *low << std::endl
-            << "High: " << *high << std::endl;
-      spdlog::info(ss.str());
-#endif
+  // Slot of bucket id (on the given level) in evict_buckets_
+  inline size_t evict_slot(size_t level, ORBucketID id) const {
+    auto first = evict_ids_.begin() + level_off_[level];
+    auto last = evict_ids_.begin() + level_off_[level + 1];
+    return std::lower_bound(first, last, id) - evict_ids_.begin();
+  }
 
-      // Initializing the buckets with the corresponding bucket ids.
-      for (ORBucketID id = *low; id <= *high; id++) {
-        to_write[id] = common::Bucket<B>();
+  // Greedy single-pass eviction. Every stash block gets its deepest legal
+  // level on the cached paths from its leaf, the stash is bucketed by that
+  // level, and the buckets are filled bottom-up: a block that does not fit at
+  // its deepest level is carried to the next level up. With a single path
+  // this is O(|stash| + L*Z).
+  void evict() {
+    // Nothing was read since the last eviction. A path that was read is
+    // always written back, even with an empty stash, so that every access
+    // looks the same to the server.
+    if (evict_leaves_.empty()) {
+      merkle_read_.clear();
+      NUMBER_SAMPLE(stats_, stash_size, stash_.size());
+      return;
+    }
+    Stopwatch sw;
+    sw.start();
+
+    // Buckets to rebuild, laid out level by level in flat arrays. The paths
+    // are sorted so that shared ancestors are adjacent and deduplicated.
+    std::sort(evict_leaves_.begin(), evict_leaves_.end());
+    evict_leaves_.erase(std::unique(evict_leaves_.begin(), evict_leaves_.end()), evict_leaves_.end());
+    evict_ids_.clear();
+    level_off_.assign(l_ + 2, 0);
+    for (size_t level = 0; level <= l_; level++) {
+      level_off_[level] = evict_ids_.size();
+      for (auto leaf : evict_leaves_) {
+        ORBucketID id = ancestor(leaf, level);
+        if (evict_ids_.size() == level_off_[level] || evict_ids_.back() != id) {
+          evict_ids_.push_back(id);
+        }
       }
+    }
+    level_off_[l_ + 1] = evict_ids_.size();
 
-      // Now, we need to place the blocks in the stash into the buckets
-      // they can reside into.
-      for (size_t block_idx = 0; block_idx < stash_.size(); block_idx++) {
-        auto b = stash_[block_idx];
-        std::vector<ORBucketID> path;
-        auto leaf = pos_map_[b.key];
-        assert(leaf >= min_leaf_ && leaf <= max_leaf_);
-        getPathToLeaf(leaf, path);
+    if (evict_ids_.empty()) {
+      return;
+    }
+    if (evict_buckets_.size() < evict_ids_.size()) {
+      evict_buckets_.resize(evict_ids_.size());
+    }
+    for (size_t slot = 0; slot < evict_ids_.size(); slot++) {
+      auto &bu = evict_buckets_[slot];
+      bu.flags_ = 0;
+      for (auto &b : bu.blocks_) {
+        b = common::Block<B>();
+      }
+    }
 
-        assert(path.size() == l_ + 1);
+    // Deepest legal level of every stash block, and a counting sort of the
+    // stash by it (deepest first). The leaves are gathered into a flat array
+    // so that each path is folded in with one vector pass over the stash
+    // (see common_depth: the smallest xor is the deepest common level).
+    const size_t n_stash = stash_.size();
+    evict_heap_.resize(n_stash);
+    evict_xor_.assign(n_stash, static_cast<Leaf>((1ULL << l_) - 1));
+    for (size_t i = 0; i < n_stash; i++) {
+      Leaf leaf = stash_[i].leaf;
+      assert(leaf >= min_leaf_ && leaf <= max_leaf_);
+      evict_heap_[i] = leaf + 1;
+    }
+    for (auto p : evict_leaves_) {
+      common::simd::min_xor(evict_heap_.data(), n_stash, p + 1, evict_xor_.data());
+    }
+    evict_depth_.resize(n_stash);
+    auto &count = evict_count_;
+    count.assign(l_ + 2, 0);
+    for (size_t i = 0; i < n_stash; i++) {
+      size_t depth = l_ - std::bit_width(evict_xor_[i]);
+      evict_depth_[i] = depth;
+      count[l_ - depth + 1]++;
+    }
+    for (size_t d = 1; d <= l_ + 1; d++) {
+      count[d] += count[d - 1];
+    }
+    evict_order_.resize(stash_.size());
+    for (size_t i = 0; i < stash_.size(); i++) {
+      evict_order_[count[l_ - evict_depth_[i]]++] = i;
+    }
 
-        auto cur_id = path[level];
+    // Fill bottom-up. The pool holds the blocks that may still be placed at
+    // the current level: the ones whose deepest level it is and the ones
+    // carried up from below.
+    evict_pool_.clear();
+    size_t next = 0;
+    for (size_t level = l_ + 1; level-- > 0;) {
+      while (next < evict_order_.size() && evict_depth_[evict_order_[next]] == level) {
+        evict_pool_.push_back(evict_order_[next++]);
+      }
 
-        // If the bucket is not in the to_write map, continue
-        if (to_write.find(cur_id) == to_write.end()) {
-          continue;
-        }
+      const size_t n_level_buckets = level_off_[level + 1] - level_off_[level];
+      size_t keep = 0, j = 0;
+      for (; j < evict_pool_.size(); j++) {
+        auto i = evict_pool_[j];
+        auto &bu = evict_buckets_[evict_slot(level, ancestor(stash_[i].leaf, level))];
 
-        // If the bucket is full, continue
-        auto flags = to_write[cur_id].flags_;
-        if (flags == Z) {
+        if (bu.flags_ == Z) {
+          evict_pool_[keep++] = i;
+          // A single full bucket on this level: everything else is carried.
+          if (n_level_buckets == 1) { j++; break; }
           continue;
         }
 
-        // Add the block to the bucket
-        to_write[cur_id].blocks_[flags].key = b.key;
-        std::memcpy(to_write[cur_id].blocks_[flags].val, b.val, B);
-        to_write[cur_id].flags_++;
-        stash_.erase(stash_.begin() + block_idx);
+        bu.blocks_[bu.flags_] = stash_.take(i);
+        bu.flags_++;
       }
-
-      if (level == 0) { break; /* root is done we can exit */ }
+      for (; j < evict_pool_.size(); j++) {
+        evict_pool_[keep++] = evict_pool_[j];
+      }
+      evict_pool_.resize(keep);
     }
 
+    // Whatever is left in the pool stays in the stash
+    stash_.compact(evict_pool_);
+
     if (stash_.size() > max_stash_size_ && setup_ == false) {
       throw std::runtime_error("Stash size exceeded");
       exit(1);
     }
-
-    // Now we have constructed all the buckets that need to be written
-    // The only thing that's left is to serialize them and encrypt them
-    // before sending them to the channel.
-    std::map<ORBucketID, char *> to_send;
-    for (auto &it : to_write) {
-      auto &[bucket_offset, bucket] = it;
-      char *bu_ser = (char *)malloc(PathORAMClient<B>::BucketSize() * sizeof(char));
-      bucket.serialize(bu_ser);
-
-      char *en_bu = (char *)malloc(PathORAMClient<B>::EncryptedBucketSize() * sizeof(char));
-      auto suc = utils::Encrypt(bu_ser, bus_, EK, en_bu);
-
-      if (!suc) {
-        throw std::runtime_error("Failed to encrypt bucket");
-        exit(1);
+    NUMBER_SAMPLE(stats_, stash_size, stash_.size());
+
+    // Now we have constructed all the buckets that need to be written.
+    // Cached ones are swapped into the treetop; the only thing that's left
+    // for the others is to serialize and encrypt them before sending them
+    // to the channel, here or on the background thread.
+    send_ids_.clear();
+    send_slots_.clear();
+    size_t held = 0;
+    for (size_t slot = 0; slot < evict_ids_.size(); slot++) {
+      auto bucket_offset = evict_ids_[slot];
+      if (bucket_offset < treetop_.size()) {
+        std::swap(treetop_[bucket_offset], evict_buckets_[slot]);
+        continue;
       }
-
-      to_send[bucket_offset] = en_bu;
-      free(bu_ser);
+      send_ids_.push_back(bucket_offset);
+      send_slots_.push_back(slot);
+      held += evict_buckets_[slot].flags_;
     }
+    TIMINGS_SAMPLE(stats_, sw, evict_place, 0);
 
-    // Send the encrypted buckets to the server
-    channel_->write_buckets(to_send);
-    to_send.clear();
-    cache_.clear();
+    if (evict_worker_ && !send_ids_.empty() && stash_.size() + held <= stash_budget_) {
+      send_background();
+    } else {
+      await_eviction();
+      send_encrypted();
+    }
+    evict_leaves_.clear();
   }
-};
\ No newline at end of file
+};
+#include "oram/path_oram/recursive_position_map.hpp"
@@ -0,0 +1,104 @@
+#pragma once
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "oram/common/position_map.hpp"
+#include "oram/path_oram/path_oram.hpp"
+
+// Position map stored in a smaller Path ORAM. Every block of that ORAM packs
+// per_block_ leaves of the mapped ORAM as width_-bit offsets from its first
+// leaf, so each level shrinks the map by a factor of per_block_. The inner ORAM
+// picks its own position map from the same config, which recurses until a
+// level fits under the cutoff and a local dense array takes over.
+template <size_t B>
+class RecursivePositionMap : public common::PositionMap {
+ private:
+  size_t n_, width_, per_block_, m_;
+  Leaf min_leaf_;
+  std::unique_ptr<PathORAMClient<B>> oram_;
+  // Leaves written before the first access. Setup assigns every leaf at once,
+  // so the inner ORAM is bulk-initialized from here instead of paying one
+  // access per key.
+  std::unique_ptr<common::DensePositionMap> staging_;
+
+  void build() {
+    std::vector<common::Block<B>> blocks(m_);
+    for (size_t i = 0; i < m_; i++) {
+      blocks[i].key = i;
+      for (size_t j = 0; j < per_block_ && i * per_block_ + j < n_; j++) {
+        Leaf leaf = staging_->get(i * per_block_ + j);
+        common::WriteBits(blocks[i].val, j * width_, width_, leaf - min_leaf_);
+      }
+    }
+
+    oram_->Init(blocks);
+    staging_.reset();
+  }
+
+  Leaf access(ORKey key, const Leaf *new_leaf) {
+    if (key >= n_) {
+      throw std::out_of_range("Key " + std::to_string(key) + " out of range for recursive position map");
+    }
+    if (staging_) {
+      build();
+    }
+
+    Leaf old_leaf = 0;
+    const size_t bit = (key % per_block_) * width_;
+    oram_->Update(key / per_block_, [&](uint8_t *val) {
+      old_leaf = min_leaf_ + common::ReadBits(val, bit, width_);
+      if (new_leaf) {
+        common::WriteBits(val, bit, width_, *new_leaf - min_leaf_);
+      }
+    });
+    return old_leaf;
+  }
+
+ public:
+  RecursivePositionMap(size_t n, size_t l, Leaf min_leaf, const PositionMapConfig &pm, utils::Key key)
+      : n_(n), width_(l > 0 ? l : 1), min_leaf_(min_leaf) {
+    per_block_ = (B * 8) / width_;
+    if (per_block_ < 2) {
+      throw std::invalid_argument("Block size too small to pack leaves for a recursive position map");
+    }
+    m_ = (n_ + per_block_ - 1) / per_block_;
+
+    // Every level lives in its own storage; disk files get a suffix per level.
+    PositionMapConfig inner = pm;
+    if (!inner.storage.diskDirectory.empty()) {
+      inner.storage.diskDirectory += ".pos";
+    }
+    if (inner.storage.type == server::ServerConfig::StorageType::Arena ||
+        inner.storage.type == server::ServerConfig::StorageType::Mmap) {
+      inner.storage.num_buckets = PathORAMClient<B>::NumBuckets(m_);
+    }
+
+    auto channel = std::make_shared<channel::PathORAMChannel<char *, PathORAMClient<B>::EncryptedBucketSize()>>(inner.storage);
+    auto o = PathORAMClient<B>::Construct(m_, std::move(channel), key, inner);
+    if (!o.has_value()) {
+      throw std::runtime_error("Failed to construct recursive position map level");
+    }
+    oram_.reset(o.value());
+    staging_ = std::make_unique<common::DensePositionMap>(n_, l, min_leaf_);
+  }
+
+  Leaf get(ORKey key) override { return access(key, nullptr); }
+
+  void set(ORKey key, Leaf leaf) override {
+    if (staging_) {
+      staging_->set(key, leaf);
+      return;
+    }
+    access(key, &leaf);
+  }
+
+  Leaf remap(ORKey key, Leaf new_leaf) override { return access(key, &new_leaf); }
+
+  size_t memory_bytes() const override {
+    return (staging_ ? staging_->memory_bytes() : 0) + oram_->ClientMemoryBytes();
+  }
+
+  size_t levels() const override { return 1 + oram_->PositionMapLevels(); }
+};
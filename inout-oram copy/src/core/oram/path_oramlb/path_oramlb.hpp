@@ -5,38 +5,44 @@
 #include <algorithm>
 #include <iostream>
 
-template <size_t B>
-class PathORAMLBClient : public PathORAMClient<B> {
+template <size_t B, size_t Z = common::kDefaultZ>
+class PathORAMLBClient : public PathORAMClient<B, Z> {
     public:
     #define LPP 4
     size_t ll_; // height of the large bucket tree
     size_t large_bucket_size;
-    using PathORAMClient<B>::pos_map_;
-    using PathORAMClient<B>::stash_;
-    using PathORAMClient<B>::n_;
-    using PathORAMClient<B>::min_leaf_;
-    using PathORAMClient<B>::cache_;
-    using ORVirtualBucketID = uint32_t;
+    using PathORAMClient<B, Z>::pos_map_;
+    using PathORAMClient<B, Z>::stash_;
+    using PathORAMClient<B, Z>::n_;
+    using PathORAMClient<B, Z>::min_leaf_;
+    using PathORAMClient<B, Z>::stats_;
+    using PathORAMClient<B, Z>::cipher_;
+    using ORVirtualBucketID = ORBucketID;
     using ORVirtualBucketOffset = uint32_t;
     using VirtualPositionID = uint32_t; // virtual position = virtual large bucket id + offset in the large bucket
+    using Keyword = ORKey;
 
     inline static constexpr size_t EncryptedLargeBucketSize() {
-        return ((1 << LPP) - 1) * PathORAMClient<B>::EncryptedBucketSize();
+        return ((1 << LPP) - 1) * PathORAMClient<B, Z>::EncryptedBucketSize();
     }
 
-    using TPathORAMLBChannel = std::shared_ptr<channel::PathORAMChannel<char *, PathORAMLBClient<B>::EncryptedLargeBucketSize()>>;
+    using TPathORAMLBChannel = std::shared_ptr<channel::PathORAMChannel<char *, PathORAMLBClient::EncryptedLargeBucketSize()>>;
 
     using u64 = uint64_t;
 
-    static std::optional<PathORAMLBClient<B> *> Construct(size_t n, 
+    // treetop_levels: top tree levels kept decrypted on the client, rounded
+    // down to whole large buckets (LPP levels each).
+    static std::optional<PathORAMLBClient *> Construct(size_t n, 
             TPathORAMLBChannel channel,
-            utils::Key key) {
+            utils::Key key,
+            common::PositionMapType pm_type = common::PositionMapType::Dense,
+            size_t treetop_levels = 0) {
         // Initialize the ORAM
         std::cout << "[PATH ORAMLB] Constructing ORAM with n = " << n << std::endl
                 << "\tPayload/Value size = " << B << std::endl
-                << "\tEncrypted block size = " << PathORAMClient<B>::EncryptedBlockSize() << std::endl
-                << "\tBucket size = " << PathORAMClient<B>::BucketSize() << std::endl;
-        auto o = new PathORAMLBClient<B>(n, std::move(channel), key);
+                << "\tEncrypted block size = " << PathORAMClient<B, Z>::EncryptedBlockSize() << std::endl
+                << "\tBucket size = " << PathORAMClient<B, Z>::BucketSize() << std::endl;
+        auto o = new PathORAMLBClient(n, std::move(channel), key, pm_type, treetop_levels);
         if (o->successful) {
             return o;
         }
@@ -45,7 +51,10 @@ class PathORAMLBClient : public PathORAMClient<B> {
     }
     
 
-    void Init(std::vector<common::Block<B>> blocks) { this->Setup(blocks);}
+    void Init(std::vector<common::Block<B>> blocks) {
+        this->Setup(blocks);
+        stats_.reset();
+    }
  
     void Access(Keyword w, uint8_t *data, bool write) {
         if (write) {
@@ -135,7 +144,7 @@ class PathORAMLBClient : public PathORAMClient<B> {
 
         // compute the block offset of the small bucket's blocks within the packed subtree
         u64 packed_bucket_index = packed_subtree_relative_node_id - 1; // blocks are packed starting from 0
-        // u64 bucket_start_block_offset = PathORAMClient<B>::BucketSize() * packed_bucket_index;
+        // u64 bucket_start_block_offset = PathORAMClient<B, Z>::BucketSize() * packed_bucket_index;
        u64 bucket_start_block_offset = packed_bucket_index; 
 
         *vbu = vnode_id;
@@ -143,23 +152,40 @@ class PathORAMLBClient : public PathORAMClient<B> {
       }
 
 private:
+        // Large buckets accessed so far (before eviction)
+        std::set<ORVirtualBucketID> cache_;
+        // Treetop cache: large buckets 1 .. vtreetop_.size() stay decrypted
+        // on the client
+        std::vector<std::array<common::Bucket<B, Z>, ((1 << LPP)-1)>> vtreetop_;
         TPathORAMLBChannel channel_;
         utils::Key EK;
         u64 buckets_per_page = (1 << LPP) - 1;
 
+        // Large bucket buffers between the client and the channel, reused
+        // across accesses (these shadow the small-bucket arenas of the base)
+        inline static constexpr size_t kMaxLargeBucketsPerWrite = 64;
+        common::BucketArena enc_arena_{EncryptedLargeBucketSize()};
+        common::BucketArena plain_arena_{PathORAMClient<B, Z>::BucketSize()};
+        std::vector<ORVirtualBucketID> read_vids_, send_vids_;
+        common::Bucket<B, Z> read_bucket_;
+
         PathORAMLBClient(size_t n, 
                 TPathORAMLBChannel channel,
-                utils::Key key) : PathORAMClient<B>::PathORAMClient(n, nullptr, key), channel_(std::move(channel)) {
-            PathORAMClient<B>::successful = true;
+                utils::Key key,
+                common::PositionMapType pm_type,
+                size_t treetop_levels) : PathORAMClient<B, Z>::PathORAMClient(n, nullptr, key, pm_type), channel_(std::move(channel)) {
+            PathORAMClient<B, Z>::successful = true;
             EK = key;
-            large_bucket_size = PathORAMClient<B>::EncryptedBucketSize() * ((1 << LPP) - 1);
+            large_bucket_size = PathORAMClient<B, Z>::EncryptedBucketSize() * ((1 << LPP) - 1);
             ll_ = std::ceil((log2(n) + 1) / LPP);
+            vtreetop_.resize(total_large_bucket_node_count(std::min<u64>(treetop_levels / LPP, ll_)));
         }
      void Setup(std::vector<common::Block<B>> &blocks) {
         // Careful here, cache_ contains ORVirtualBucketID and not ORBucketID
-        for (auto b : blocks) {
+        for (auto &b : blocks) {
             Leaf leaf = min_leaf_ + random_gen::generateRandomNumber(n_);
-            pos_map_.insert({b.key, leaf});
+            pos_map_->set(b.key, leaf);
+            b.leaf = leaf;
         }
 
         u64 tree_height = std::ceil((log2(n_)+1)/LPP); 
@@ -171,18 +197,22 @@ private:
             cache_.insert(i);
         }
 
-        for (auto b : blocks) {
-            stash_.push_back(b);
+        stash_.reserve(blocks.size());
+        for (auto &b : blocks) {
+            stash_.insert(b);
         }
 
-        PathORAMClient<B>::setup_ = true;
+        PathORAMClient<B, Z>::setup_ = true;
         evict();
       }
 
       void Read(Keyword w, uint8_t *data) {
-        Leaf leaf = pos_map_[w];
+        Stopwatch sw;
+        sw.start();
+        Leaf new_leaf = min_leaf_ + random_gen::generateRandomNumber(PathORAMClient<B, Z>::n_);
+        Leaf leaf = pos_map_->remap(w, new_leaf);
         std::vector<ORBucketID> path;
-        PathORAMClient<B>::getPathToLeaf(leaf, path);
+        PathORAMClient<B, Z>::getPathToLeaf(leaf, path);
         bool found = false;
 
         std::vector<ORVirtualBucketID> vpath;
@@ -193,19 +223,20 @@ private:
             bucket_to_vbucket(bu + 1, &vbu, &vbu_offset);
             if (std::find(vpath.begin(), vpath.end(), vbu) == vpath.end()) {
                 vpath.push_back(vbu);
+                cache_.insert(vbu);
             }
         }
 
+        TIMINGS_SAMPLE(stats_, sw, path_compute, 0);
         read_path(vpath);
-        pos_map_[w] = min_leaf_ + random_gen::generateRandomNumber(PathORAMClient<B>::n_);
 
-        for (auto &b : stash_) {
-            if (b.key == w) {
-                found = true;
-                // memcpy(b.val, data, B);
-                std::copy(b.val, b.val + B, data);
-            }
+        sw.start();
+        if (auto *b = stash_.find(w)) {
+            found = true;
+            b->leaf = new_leaf;
+            std::copy(b->val, b->val + B, data);
         }
+        TIMINGS_SAMPLE(stats_, sw, stash_lookup, 0);
         
         if (!found) {
             throw std::runtime_error("Looking for keyword " + std::to_string(w) + " failed");
@@ -214,186 +245,87 @@ private:
       }
 
       void Write(Keyword w, uint8_t *data) {
-        Leaf leaf = PathORAMClient<B>::pos_map_[w];
+        Stopwatch sw;
+        sw.start();
+        Leaf new_leaf = min_leaf_ + random_gen::generateRandomNumber(PathORAMClient<B, Z>::n_);
+        Leaf leaf = pos_map_->remap(w, new_leaf);
         std::vector<ORBucketID> path;
-        PathORAMClient<B>::getPathToLeaf(leaf, path);
+        PathORAMClient<B, Z>::getPathToLeaf(leaf, path);
 
         std::vector<ORVirtualBucketID> vpath;
         for (auto bu : path) {
             ORVirtualBucketID vbu;
             ORVirtualBucketOffset vbu_offset;
             bucket_to_vbucket(bu + 1, &vbu, &vbu_offset);
-            if (std::find(vpath.begin(), vpath.end(), vbu) == vpath.end()) 
+            if (std::find(vpath.begin(), vpath.end(), vbu) == vpath.end()) {
                 vpath.push_back(vbu);
-        }
-
-        read_path(vpath);
-
-        for (auto b : PathORAMClient<B>::stash_) {
-            if (b.key == w) {
-                memcpy(b.val, data, B);
+                cache_.insert(vbu);
             }
         }
 
-        PathORAMClient<B>::pos_map_[w] = PathORAMClient<B>::min_leaf_ + random_gen::generateRandomNumber(PathORAMClient<B>::n_);
-      }
-
-    //   char* serializeEncryptBycket_par(std::map<ORVirtualBucketID, std::array<common::Bucket<B>, ((1 << LPP)-1)>>& to_write) {
-    //     const size_t bucket_size = PathORAMClient<B>::BucketSize();
-    //     const size_t encrypted_bucket_size = PathORAMClient<B>::EncryptedBucketSize();
-    //     const size_t large_bucket_size = encrypted_bucket_size * ((1 << LPP)-1);
-    //     const size_t total_size = large_bucket_size * to_write.size();
-        
-    //     // Allocate the final buffer
-    //     char* enc_large_buckets = (char*)malloc(sizeof(char) * total_size);
-        
-    //     // Create thread pool with number of hardware threads
-    //     ThreadPool pool(std::thread::hardware_concurrency());
-        
-    //     // Structure to hold all futures
-    //     std::vector<std::future<void>> futures;
-        
-    //     // Mutex for synchronizing cur_pos updates
-    //     std::mutex pos_mutex;
-    //     char* cur_pos = enc_large_buckets;
-
-    //     // Structure to pass to worker threads
-    //     struct EncryptTask {
-    //         common::Bucket<B>* bucket;
-    //         char* output_pos;
-    //         size_t bucket_size;
-    //         const char* EK;  // Assuming EK is your encryption key
-    //     };
-
-    //     // Worker function
-    //     auto encrypt_bucket = [](void* arg) -> void {
-    //         EncryptTask* task = static_cast<EncryptTask*>(arg);
-            
-    //         // Create temporary buffer for serialization
-    //         std::unique_ptr<char[]> temp_buffer(new char[task->bucket_size]);
-            
-    //         // Serialize
-    //         task->bucket->serialize(temp_buffer.get());
-            
-    //         // Encrypt
-    //         if (!utils::Encrypt(temp_buffer.get(), task->bucket_size, task->EK, task->output_pos)) {
-    //             throw std::runtime_error("Failed to encrypt bucket");
-    //         }
-    //     };
-
-    //     // Queue up all encryption tasks
-    //     for (auto& entry : to_write) {
-    //         auto& [buID, arr_bu] = entry;
-            
-    //         for (size_t i = 0; i < ((1 << LPP)-1); i++) {
-    //             // Get the next position in the output buffer
-    //             char* output_pos;
-    //             {
-    //                 std::lock_guard<std::mutex> lock(pos_mutex);
-    //                 output_pos = cur_pos;
-    //                 cur_pos += encrypted_bucket_size;
-    //             }
-
-    //             // Create task data
-    //             auto task_data = new EncryptTask{
-    //                 &arr_bu[i],
-    //                 output_pos,
-    //                 bucket_size,
-    //                 EK
-    //             };
-
-    //             // Queue the task
-    //             futures.push_back(
-    //                 pool.enqueue_void_ptr(static_cast<void(*)(void*)>(encrypt_bucket), task_data)
-    //             );
-    //         }
-    //     }
-
-    //     // Wait for all encryptions to complete
-    //     for (auto& future : futures) {
-    //         try {
-    //             future.get();
-    //         } catch (const std::exception& e) {
-    //             // Clean up allocated memory
-    //             free(enc_large_buckets);
-    //             throw std::runtime_error(std::string("Encryption failed: ") + e.what());
-    //         }
-    //     }
-
-    //     return enc_large_buckets;
-    // }
-
-      char *
-      serializeEncryptBycket(std::map<ORVirtualBucketID,  std::array<common::Bucket<B>, ((1 << LPP)-1)>> &to_write) {
-        const size_t bucket_size = PathORAMClient<B>::BucketSize();
-        // const size_t large_bucket_size = PathORAMClient<B>::EncryptedBucketSize() * ((1 << LPP)-1);
-        char *enc_large_buckets = (char *)malloc(sizeof(char) * large_bucket_size * to_write.size());
-        char *cur_pos = enc_large_buckets;
-
-        for (auto &entry : to_write) {
-            auto &[buID, arr_bu] = entry;
-            for (size_t i = 0; i < ((1 << LPP)-1); i++) {
-                std::unique_ptr<char[]> temp_buffer(new char[bucket_size]);
-                arr_bu[i].serialize(temp_buffer.get());
-
-                if (!utils::Encrypt(temp_buffer.get(), bucket_size, EK, cur_pos)) {
-                    throw std::runtime_error("Failed to encrypt bucket [LINE: " + std::to_string(__LINE__) + "]");
-                    exit(1);
-                }
+        TIMINGS_SAMPLE(stats_, sw, path_compute, 0);
+        read_path(vpath);
 
-                cur_pos += PathORAMClient<B>::EncryptedBucketSize();
-            }
+        sw.start();
+        if (auto *b = stash_.find(w)) {
+            memcpy(b->val, data, B);
+            b->leaf = new_leaf;
         }
-
-        return enc_large_buckets;
+        TIMINGS_SAMPLE(stats_, sw, stash_lookup, 0);
       }
 
-      std::map<ORVirtualBucketID, char *>
-      encryptBuckets(std::map<ORVirtualBucketID, std::array<common::Bucket<B>, ((1 << LPP)-1)>> &to_write) {
-        std::map<ORVirtualBucketID, char *> enc_large_buckets;
-        const size_t bucket_size = PathORAMClient<B>::BucketSize();
-        // const size_t large_bucket_size = PathORAMClient<B>::EncryptedBucketSize() * ((1 << LPP) - 1);
-
-
-        for ( auto& [buID, arr_bu] : to_write) {
-            // std::cout << "Encrypting large bucket [{" << buID << "}]\n"
-            //     << "\twith " << arr_bu.size() << " small buckets\n"
-            //     << "\tbucket size: " << bucket_size << "\n"
-            //     << "\tlarge bucket size: " << large_bucket_size
-            //     << std::endl;
-
-            if (arr_bu.size() != buckets_per_page) {
-                throw std::runtime_error("Invalid bucket size");
-                exit(1);
+      // Serializes and encrypts to_write into the arena and sends it, at most
+      // kMaxLargeBucketsPerWrite large buckets per channel call
+      void write_large_buckets(std::map<ORVirtualBucketID, std::array<common::Bucket<B, Z>, ((1 << LPP)-1)>> &to_write) {
+        const size_t bucket_size = PathORAMClient<B, Z>::BucketSize();
+        const size_t chunk = std::min(to_write.size(), kMaxLargeBucketsPerWrite);
+        auto enc = enc_arena_.acquire(chunk);
+        char *bu_ser = plain_arena_.acquire(1)[0];
+        Stopwatch sw;
+        auto send = [&](std::span<char *const> bufs) {
+            sw.start();
+            channel_->write_buckets(std::span<const ORVirtualBucketID>(send_vids_), bufs);
+            TIMINGS_SAMPLE(stats_, sw, channel_write, 0);
+            NUMBER_SAMPLE(stats_, buckets_written, send_vids_.size() * buckets_per_page);
+            NUMBER_SAMPLE(stats_, bytes_written, send_vids_.size() * EncryptedLargeBucketSize());
+        };
+
+        send_vids_.clear();
+        for (auto &[buID, arr_bu] : to_write) {
+            if (send_vids_.size() == chunk) {
+                send(enc);
+                send_vids_.clear();
             }
 
-            auto large_bucket = std::make_unique<char[]>(PathORAMLBClient<B>::EncryptedLargeBucketSize() * sizeof(char));
-            char *cur_pos = large_bucket.get();
-
+            char *cur_pos = enc[send_vids_.size()];
             for (size_t i = 0; i < ((1 << LPP) - 1); i++) {
-                std::unique_ptr<char[]> temp_buffer(new char[bucket_size]);
-                arr_bu[i].serialize(temp_buffer.get());
+                sw.start();
+                arr_bu[i].serialize(bu_ser);
+                TIMINGS_SAMPLE(stats_, sw, serialize, 0);
 
-                if (!utils::Encrypt(temp_buffer.get(), bucket_size, EK, cur_pos)) {
+                sw.start();
+                if (!cipher_.Seal(bu_ser, bucket_size, cur_pos)) {
                     throw std::runtime_error("Failed to encrypt bucket [LINE: " + std::to_string(__LINE__) + "]");
                     exit(1);
                 }
+                TIMINGS_SAMPLE(stats_, sw, encrypt, 0);
 
-                cur_pos += PathORAMClient<B>::EncryptedBucketSize();
+                cur_pos += PathORAMClient<B, Z>::EncryptedBucketSize();
             }
-
-            enc_large_buckets[buID] = (char *)malloc(sizeof(char) * PathORAMLBClient<B>::EncryptedLargeBucketSize());
-            std::memcpy(enc_large_buckets[buID], large_bucket.get(), PathORAMLBClient<B>::EncryptedLargeBucketSize());
-            large_bucket.release();
+            send_vids_.push_back(buID);
         }
 
-        return enc_large_buckets;
+        if (!send_vids_.empty()) {
+            send(enc.first(send_vids_.size()));
+        }
       }
 
       void evict() {
-        if (PathORAMClient<B>::stash_.empty()) { return; }
+        if (PathORAMClient<B, Z>::stash_.empty()) { return; }
+        Stopwatch sw;
+        sw.start();
 
-        std::map<ORVirtualBucketID, std::array<common::Bucket<B>, ((1 << LPP)-1)>> to_write;
+        std::map<ORVirtualBucketID, std::array<common::Bucket<B, Z>, ((1 << LPP)-1)>> to_write;
         
         for (auto level = ll_-1; level >= 0; level--) {
             // Computing the cached nodes in the current level
@@ -415,16 +347,17 @@ private:
             }
 
             // Now, we need to place the blocks in the stash into the buckets
-            // they can reside into.
-            for (size_t block_idx = 0; block_idx < PathORAMClient<B>::stash_.size(); block_idx++) {
-                auto b = PathORAMClient<B>::stash_[block_idx];
+            // they can reside into. Walk the stash backwards: removing a
+            // block moves the (already visited) last block into its slot.
+            for (size_t block_idx = PathORAMClient<B, Z>::stash_.size(); block_idx-- > 0;) {
+                auto b = PathORAMClient<B, Z>::stash_[block_idx];
                 std::vector<ORBucketID> path;
-                auto leaf = PathORAMClient<B>::pos_map_[b.key];
-                assert(leaf >= PathORAMClient<B>::min_leaf_ && leaf <=PathORAMClient<B>::max_leaf_);
-                PathORAMClient<B>::getPathToLeaf(leaf, path);
-                common::Bucket<B> *bucket = nullptr;
+                auto leaf = b.leaf;
+                assert((leaf >= PathORAMClient<B, Z>::min_leaf_ && leaf <=PathORAMClient<B, Z>::max_leaf_));
+                PathORAMClient<B, Z>::getPathToLeaf(leaf, path);
+                common::Bucket<B, Z> *bucket = nullptr;
 
-                assert(path.size() == PathORAMClient<B>::l_ + 1);
+                assert((path.size() == PathORAMClient<B, Z>::l_ + 1));
 
                 ORVirtualBucketID vbuID;
                 ORVirtualBucketOffset vbu_offset;
@@ -453,37 +386,62 @@ private:
                     continue;
                 }
                 // Add the block to the bucket 
-                bucket->blocks_[flags].key = b.key;
-                std::memcpy(bucket->blocks_[flags].val, b.val, B);
+                bucket->blocks_[flags] = b;
                 bucket->flags_++;
-                PathORAMClient<B>::stash_.erase(PathORAMClient<B>::stash_.begin() + block_idx);
+                PathORAMClient<B, Z>::stash_.erase_at(block_idx);
 
             }
             if (level == 0) { break; }
         }
         
-        if (PathORAMClient<B>::stash_.size() > PathORAMClient<B>::max_stash_size_ && PathORAMClient<B>::setup_ == false) {
+        if (PathORAMClient<B, Z>::stash_.size() > PathORAMClient<B, Z>::max_stash_size_ && PathORAMClient<B, Z>::setup_ == false) {
             throw std::runtime_error("Stash size exceeded");
             exit(1);
         }
 
-        std::map<ORVirtualBucketID, char *> large_buckets = encryptBuckets(to_write);
+        NUMBER_SAMPLE(stats_, stash_size, stash_.size());
 
-        channel_->write_buckets(large_buckets);
-        large_buckets.clear();
-        PathORAMClient<B>::cache_.clear();
+        // Cached large buckets are kept as they are, the rest go to the server
+        for (auto it = to_write.begin(); it != to_write.end() && it->first <= vtreetop_.size();) {
+            vtreetop_[it->first - 1] = std::move(it->second);
+            it = to_write.erase(it);
+        }
+        TIMINGS_SAMPLE(stats_, sw, evict_place, 0);
+
+        write_large_buckets(to_write);
+        cache_.clear();
         to_write.clear();
       }
 
-      void read_path(std::vector<ORBucketID> &vids) {
-        std::vector<char *> enc_large_buckets;
-        size_t en_bus_ = PathORAMClient<B>::EncryptedBucketSize();
-        for (auto id : vids) {
-          char *en_bu = (char *)malloc(PathORAMLBClient<B>::EncryptedLargeBucketSize() * sizeof(char));
-          enc_large_buckets.push_back(en_bu);
+      void read_path(std::vector<ORBucketID> &all_vids) {
+        // Cached large buckets are emptied straight into the stash
+        Stopwatch sw;
+        sw.start();
+        auto &vids = read_vids_;
+        vids.clear();
+        for (auto vid : all_vids) {
+            if (vid >= 1 && vid <= vtreetop_.size()) {
+                for (auto &bu : vtreetop_[vid - 1]) {
+                    for (char blocks = 0; blocks < bu.flags_; blocks++) {
+                        PathORAMClient<B, Z>::stash_.insert(bu.blocks_[blocks]);
+                    }
+                    bu.flags_ = 0;
+                }
+            } else {
+                vids.push_back(vid);
+            }
         }
 
-        channel_->read_buckets(vids, enc_large_buckets);
+        size_t en_bus_ = PathORAMClient<B, Z>::EncryptedBucketSize();
+        auto enc_large_buckets = enc_arena_.acquire(vids.size());
+        char *vbu_ser = plain_arena_.acquire(1)[0];
+
+        TIMINGS_SAMPLE(stats_, sw, stash_lookup, 0);
+        sw.start();
+        channel_->read_buckets(std::span<const ORVirtualBucketID>(vids), enc_large_buckets);
+        TIMINGS_SAMPLE(stats_, sw, channel_read, 0);
+        NUMBER_SAMPLE(stats_, buckets_read, vids.size() * buckets_per_page);
+        NUMBER_SAMPLE(stats_, bytes_read, vids.size() * EncryptedLargeBucketSize());
 
         for (auto en_lbu : enc_large_buckets) {
             assert(en_lbu);
@@ -495,26 +453,28 @@ private:
                 //     << ", en_bus_: " << en_bus_
                 //     << ", offset: " << offset
                 //     << std::endl;
-                auto vbu_ser = std::make_unique<char[]>(en_bus_);
-
-                auto dec = utils::Decrypt(en_lbu + offset, PathORAMClient<B>::EncryptedBucketSize(), EK, vbu_ser.get());
-                if (dec != PathORAMClient<B>::BucketSize()) {
+                sw.start();
+                auto dec = cipher_.Open(en_lbu + offset, PathORAMClient<B, Z>::EncryptedBucketSize(), vbu_ser);
+                if (dec != PathORAMClient<B, Z>::BucketSize()) {
                     std::cerr << "Bucket size mismatch: dec=" << dec 
-                        << ", Expected=" << PathORAMClient<B>::EncryptedBucketSize() << std::endl;
+                        << ", Expected=" << PathORAMClient<B, Z>::EncryptedBucketSize() << std::endl;
                     throw std::runtime_error("Failed to decrypt bucket [LINE: " + std::to_string(__LINE__) + "]");
                     exit(1);
                 }
-                common::Bucket<B> bu;
-                bu.deserialize(vbu_ser.get());
+                TIMINGS_SAMPLE(stats_, sw, decrypt, 0);
+                sw.start();
+                auto &bu = read_bucket_;
+                bu.deserialize(vbu_ser);
+                TIMINGS_SAMPLE(stats_, sw, deserialize, 0);
 
+                sw.start();
                 for (char blocks = 0; blocks < bu.flags_; blocks++) {
-                    PathORAMClient<B>::stash_.push_back(bu.blocks_[blocks]);
+                    PathORAMClient<B, Z>::stash_.insert(bu.blocks_[blocks]);
                 }
+                TIMINGS_SAMPLE(stats_, sw, stash_lookup, 0);
 
                 offset += en_bus_;
             }
         }
-
-        enc_large_buckets.clear();
       }  
 };
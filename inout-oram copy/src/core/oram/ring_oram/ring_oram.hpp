@@ -0,0 +1,622 @@
+#pragma once
+#include <math.h>
+
+#include <algorithm>
+#include <bit>
+#include <numeric>
+#include <optional>
+#include <random>
+#include <vector>
+
+#include "oram/common/block.hpp"
+#include "oram/common/bucket_arena.hpp"
+#include "oram/common/oram_client.hpp"
+#include "oram/common/position_map.hpp"
+#include "oram/common/simd_scan.hpp"
+#include "oram/common/stash.hpp"
+#include "server/channel.hpp"
+#include "utils/cipher.hpp"
+#include "utils/crypto.hpp"
+#include "utils/random_gen.hpp"
+
+// Ring ORAM parameters. Every bucket has Z real and S dummy slots, a path is
+// evicted every A accesses, and a bucket is reshuffled once S of its slots
+// have been read. Z = 4, S = 6, A = 3 keeps the stash as small as in Path
+// ORAM with Z = 4. An eviction or setup that leaves more than stash_capacity
+// blocks in the stash fails; 0 picks 2 * Z * L, Path ORAM's bound.
+struct RingORAMParams {
+  size_t S = 6;
+  size_t A = 3;
+  size_t stash_capacity = 0;
+};
+
+// Per-bucket metadata, stored encrypted in its own channel. It tells the
+// client which slot holds which real block and which slots were already read
+// since the bucket was last written.
+template <size_t Z = common::kDefaultZ>
+struct RingBucketMeta {
+  uint32_t count = 0;  // Slots read since the bucket was last written
+  uint64_t valid = 0;  // Bit s: slot s was not read since then
+  uint8_t n_real = 0;
+  ORKey keys[Z];
+  uint8_t slots[Z];
+
+  inline static constexpr size_t SerializedSize() {
+    return sizeof(uint32_t) + sizeof(uint64_t) + sizeof(uint8_t) + Z * (sizeof(ORKey) + sizeof(uint8_t));
+  }
+
+  void serialize(char *buf) const {
+    memcpy(buf, &count, sizeof(count));
+    buf += sizeof(count);
+    memcpy(buf, &valid, sizeof(valid));
+    buf += sizeof(valid);
+    memcpy(buf, &n_real, sizeof(n_real));
+    buf += sizeof(n_real);
+    memcpy(buf, keys, sizeof(keys));
+    buf += sizeof(keys);
+    memcpy(buf, slots, sizeof(slots));
+  }
+
+  void deserialize(const char *buf) {
+    memcpy(&count, buf, sizeof(count));
+    buf += sizeof(count);
+    memcpy(&valid, buf, sizeof(valid));
+    buf += sizeof(valid);
+    memcpy(&n_real, buf, sizeof(n_real));
+    buf += sizeof(n_real);
+    memcpy(keys, buf, sizeof(keys));
+    buf += sizeof(keys);
+    memcpy(slots, buf, sizeof(slots));
+  }
+};
+
+// Ring ORAM client. Buckets are stored slot by slot (slot s of bucket id is
+// unit id * (Z + S) + s of the slot channel), so an online access reads one
+// block per bucket instead of the whole bucket. Paths are evicted in
+// reverse-lexicographic order every A accesses.
+template <size_t B, size_t Z = common::kDefaultZ>
+class RingORAMClient : public common::ORAMClient<B> {
+ public:
+  using Meta = RingBucketMeta<Z>;
+
+  bool successful = false;
+
+  inline static constexpr size_t SlotSize() { return common::Block<B>::SerializedSize(); }
+
+  inline static constexpr size_t EncryptedSlotSize() { return utils::SealedLen(SlotSize()); }
+
+  inline static constexpr size_t MetaSize() { return Meta::SerializedSize(); }
+
+  inline static constexpr size_t EncryptedMetaSize() { return utils::SealedLen(MetaSize()); }
+
+  using TSlotChannel = std::shared_ptr<channel::PathORAMChannel<char *, RingORAMClient::EncryptedSlotSize()>>;
+  using TMetaChannel = std::shared_ptr<channel::PathORAMChannel<char *, RingORAMClient::EncryptedMetaSize()>>;
+
+  static std::optional<RingORAMClient *> Construct(size_t n,
+            TSlotChannel slot_channel,
+            TMetaChannel meta_channel,
+            utils::Key key,
+            RingORAMParams params = {},
+            common::PositionMapType pm = common::PositionMapType::Dense) {
+    auto o = new RingORAMClient(n, std::move(slot_channel), std::move(meta_channel), key, params, pm);
+    if (o->successful) {
+      return o;
+    }
+
+    delete o;
+    return std::nullopt;
+  }
+
+  void Init(std::vector<common::Block<B>> &blocks) override {
+    if (!successful)
+        return;
+
+    Setup(blocks);
+  }
+
+  void Read(ORKey w, common::Block<B> &data) override {
+    auto *b = access(w);
+    if (!b) {
+      throw std::runtime_error("Block not found");
+    }
+    data.key = b->key;
+    memcpy(data.val, b->val, B);
+  }
+
+  // Eviction is scheduled, not per access: every A-th call evicts the next
+  // path in reverse-lexicographic order.
+  void Evict() override {
+    if (++round_ % params_.A == 0) {
+      evict_path();
+      if (stash_.size() > stash_capacity_) {
+        throw std::runtime_error("Stash size exceeded");
+      }
+    }
+  }
+
+  // Ring ORAM fetches a single block per bucket online, so a batch is a
+  // sequence of accesses; it still follows the batch semantics of
+  // PathORAMClient::AccessBatch.
+  void AccessBatch(const std::vector<ORKey> &keys, const std::vector<AccessOp> &ops,
+                   std::vector<common::Block<B>> &data) override {
+    if (keys.size() != ops.size()) {
+      throw std::invalid_argument("AccessBatch: keys and ops must have the same length");
+    }
+    data.resize(keys.size());
+
+    for (size_t i = 0; i < keys.size(); i++) {
+      common::Block<B> *b = nullptr;
+      try {
+        b = access(keys[i]);
+      } catch (const std::out_of_range &) {
+        // Key outside the position map: still read a random path and count
+        // it towards eviction, so the batch keeps its shape
+        read_online(keys[i], min_leaf_ + random_gen::generateRandomNumber(n_));
+        data[i] = common::Block<B>();
+        Evict();
+        continue;
+      }
+
+      if (ops[i] == AccessOp::Write) {
+        if (!b) {
+          b = &stash_.insert(common::Block<B>(keys[i], data[i].val));
+          b->leaf = last_leaf_;
+        } else {
+          memcpy(b->val, data[i].val, B);
+        }
+      } else if (b) {
+        data[i] = *b;
+        data[i].leaf = 0;
+      } else {
+        data[i] = common::Block<B>();
+      }
+      Evict();
+    }
+  }
+
+  size_t ClientMemoryBytes() const override {
+    return pos_map_->memory_bytes() + stash_.memory_bytes();
+  }
+
+  size_t StashSize() const { return stash_.size(); }
+
+ protected:
+  std::unique_ptr<common::PositionMap> pos_map_;
+  common::Stash<B> stash_;
+  size_t n_, l_, min_leaf_, max_leaf_, slots_, stash_capacity_;  // slots_ = Z + S
+  RingORAMParams params_;
+  TSlotChannel slot_channel_;
+  TMetaChannel meta_channel_;
+  utils::Key EK;
+  utils::CipherEngine cipher_;
+  random_gen::Urbg rng_;
+  size_t round_ = 0;   // Accesses since setup
+  size_t g_ = 0;       // Evictions since setup
+  Leaf last_leaf_ = 0; // Leaf assigned by the last access
+
+  // Buffers of the slots and metadata records in flight, reused across
+  // accesses; slot_ids_ are the slots of the buckets being written
+  common::BucketArena slot_arena_{EncryptedSlotSize()}, meta_arena_{EncryptedMetaSize()};
+  std::vector<ORBucketID> slot_ids_;
+  std::vector<Meta> write_metas_;
+
+  // Contents of the buckets being rebuilt, Z slots each: fill_blocks_[i * Z
+  // + j] for j < fill_counts_[i] are the real blocks of fill_ids_[i]
+  std::vector<ORBucketID> fill_ids_;
+  std::vector<common::Block<B>> fill_blocks_;
+  std::vector<size_t> fill_counts_;
+  std::vector<std::vector<size_t>> by_depth_;  // Stash slots by deepest level on the evicted path
+  std::vector<size_t> pool_;
+
+  // Buckets per write of a setup
+  static constexpr size_t kSetupChunk = 1024;
+
+  RingORAMClient(size_t n,
+        TSlotChannel slot_channel,
+        TMetaChannel meta_channel,
+        utils::Key key,
+        RingORAMParams params,
+        common::PositionMapType pm)
+      : n_(n), params_(params), slot_channel_(std::move(slot_channel)),
+        meta_channel_(std::move(meta_channel)), EK(key), cipher_(key) {
+    slots_ = Z + params_.S;
+    if (slots_ > 64 || params_.A == 0) {
+      return;
+    }
+    l_ = std::ceil(log2(n_));
+    min_leaf_ = (1ULL << l_) - 1;
+    max_leaf_ = min_leaf_ << 1;
+    pos_map_ = common::MakePositionMap(pm, n_, l_, min_leaf_);
+    stash_capacity_ = params_.stash_capacity ? params_.stash_capacity : 2 * Z * l_;
+
+    successful = true;
+  }
+
+  void getPathToLeaf(Leaf leaf, std::vector<ORBucketID> &path) {
+    ORBucketID cur_id = leaf;
+    while (true) {
+      path.push_back(cur_id);
+      if (cur_id == 0) { break; }
+      cur_id = (cur_id - 1) / 2;
+    }
+  }
+
+  // Level of the deepest common bucket of the paths to two leaves
+  inline size_t common_depth(Leaf a, Leaf b) const {
+    return l_ - std::bit_width((static_cast<uint64_t>(a) + 1) ^ (static_cast<uint64_t>(b) + 1));
+  }
+
+  // Ancestor of leaf on the given level
+  inline ORBucketID ancestor(Leaf leaf, size_t level) const {
+    return ((static_cast<uint64_t>(leaf) + 1) >> (l_ - level)) - 1;
+  }
+
+  inline ORBucketID slot_id(ORBucketID bucket, size_t slot) const {
+    return bucket * slots_ + slot;
+  }
+
+  // Remaps w, fetches its path online and reshuffles the buckets that ran
+  // out of dummies. Returns w's block in the stash, or nullptr.
+  common::Block<B> *access(ORKey w) {
+    Leaf new_leaf = min_leaf_ + random_gen::generateRandomNumber(n_);
+    Leaf leaf = pos_map_->remap(w, new_leaf);
+    last_leaf_ = new_leaf;
+
+    read_online(w, leaf);
+
+    auto *b = stash_.find(w);
+    if (b) {
+      b->leaf = new_leaf;
+    }
+    return b;
+  }
+
+  // Slots of m that were not read yet and hold no real block
+  static uint64_t dummy_slots(const Meta &m) {
+    uint64_t dummies = m.valid;
+    for (size_t j = 0; j < m.n_real; j++) {
+      dummies &= ~(1ULL << m.slots[j]);
+    }
+    return dummies;
+  }
+
+  // Uniformly random set bit of a non-zero mask
+  size_t random_slot(uint64_t mask) {
+    size_t k = std::uniform_int_distribution<size_t>(0, std::popcount(mask) - 1)(rng_);
+    for (; k > 0; k--) {
+      mask &= mask - 1;
+    }
+    return std::countr_zero(mask);
+  }
+
+  // Random slot of m that was not read yet and holds no real block
+  size_t pick_dummy(const Meta &m) {
+    uint64_t dummies = dummy_slots(m);
+    if (dummies == 0) {
+      throw std::runtime_error("Ring ORAM bucket ran out of dummy slots");
+    }
+    return random_slot(dummies);
+  }
+
+  // Slots to read so that a bucket is emptied of its real blocks: every
+  // valid real slot, padded with random unread dummies up to Z reads. They
+  // are returned in slot order, so neither the offsets nor the order of the
+  // reads tell the real slots from the dummies.
+  std::vector<size_t> drain_slots(const Meta &m) {
+    std::vector<size_t> slots;
+    for (size_t j = 0; j < m.n_real; j++) {
+      if (m.valid >> m.slots[j] & 1) {
+        slots.push_back(m.slots[j]);
+      }
+    }
+    for (uint64_t dummies = dummy_slots(m); slots.size() < Z && dummies;) {
+      size_t s = random_slot(dummies);
+      slots.push_back(s);
+      dummies &= ~(1ULL << s);
+    }
+    std::sort(slots.begin(), slots.end());
+    return slots;
+  }
+
+  void read_online(ORKey w, Leaf leaf) {
+    std::vector<ORBucketID> path;
+    getPathToLeaf(leaf, path);
+    std::vector<Meta> metas = read_meta(path);
+
+    // One slot per bucket: the one holding w, or an unread dummy
+    std::vector<ORBucketID> ids(path.size());
+    size_t hit = path.size();
+    for (size_t i = 0; i < path.size(); i++) {
+      auto &m = metas[i];
+      size_t slot = slots_;
+      for (uint64_t hits = common::simd::eq_mask(m.keys, m.n_real, w); hits; hits &= hits - 1) {
+        size_t j = std::countr_zero(hits);
+        if (m.valid >> m.slots[j] & 1) {
+          slot = m.slots[j];
+          hit = i;
+        }
+      }
+      if (slot == slots_) {
+        slot = pick_dummy(m);
+      }
+
+      ids[i] = slot_id(path[i], slot);
+      m.valid &= ~(1ULL << slot);
+      m.count++;
+    }
+
+    std::vector<common::Block<B>> blocks = read_slots(ids, [hit](size_t i) { return i == hit; });
+    if (hit != path.size()) {
+      stash_.insert(std::move(blocks[hit]));
+    }
+
+    // Buckets that used up their dummies are reshuffled right away, the
+    // others only get their metadata updated.
+    std::vector<ORBucketID> full, rest;
+    std::vector<Meta> full_metas, rest_metas;
+    for (size_t i = 0; i < path.size(); i++) {
+      if (metas[i].count >= params_.S) {
+        full.push_back(path[i]);
+        full_metas.push_back(metas[i]);
+      } else {
+        rest.push_back(path[i]);
+        rest_metas.push_back(metas[i]);
+      }
+    }
+    write_meta(rest, rest_metas);
+    if (!full.empty()) {
+      early_reshuffle(full, full_metas);
+    }
+  }
+
+  // Reads the remaining real blocks of each bucket and writes them back with
+  // fresh dummies and a fresh permutation.
+  void early_reshuffle(std::vector<ORBucketID> &buckets, std::vector<Meta> &metas) {
+    std::vector<ORBucketID> ids;
+    std::vector<size_t> owner;
+    for (size_t i = 0; i < buckets.size(); i++) {
+      for (auto s : drain_slots(metas[i])) {
+        ids.push_back(slot_id(buckets[i], s));
+        owner.push_back(i);
+      }
+    }
+
+    fill_blocks_.resize(buckets.size() * Z);
+    fill_counts_.assign(buckets.size(), 0);
+    auto blocks = read_slots(ids, [](size_t) { return true; });
+    for (size_t k = 0; k < ids.size(); k++) {
+      if (blocks[k].key != static_cast<ORKey>(-1)) {
+        fill_blocks_[owner[k] * Z + fill_counts_[owner[k]]++] = std::move(blocks[k]);
+      }
+    }
+
+    write_full_buckets(buckets, fill_blocks_, fill_counts_);
+  }
+
+  // Reads the whole next path of the reverse-lexicographic order into the
+  // stash and writes it back filled greedily, deepest blocks first.
+  void evict_path() {
+    uint64_t g = g_++, rev = 0;
+    for (size_t i = 0; i < l_; i++, g >>= 1) {
+      rev = (rev << 1) | (g & 1);
+    }
+    Leaf leaf = min_leaf_ + rev;
+
+    std::vector<ORBucketID> path;
+    getPathToLeaf(leaf, path);
+    std::vector<Meta> metas = read_meta(path);
+
+    std::vector<ORBucketID> ids;
+    for (size_t i = 0; i < path.size(); i++) {
+      for (auto s : drain_slots(metas[i])) {
+        ids.push_back(slot_id(path[i], s));
+      }
+    }
+    for (auto &b : read_slots(ids, [](size_t) { return true; })) {
+      if (b.key != static_cast<ORKey>(-1)) {
+        stash_.insert(std::move(b));
+      }
+    }
+
+    // path[i] is on level l_ - i. Walk bottom-up, carrying the blocks that
+    // may still go higher.
+    by_depth_.resize(l_ + 1);
+    for (auto &d : by_depth_) {
+      d.clear();
+    }
+    for (size_t slot = 0; slot < stash_.size(); slot++) {
+      by_depth_[common_depth(stash_[slot].leaf, leaf)].push_back(slot);
+    }
+
+    fill_blocks_.resize(path.size() * Z);
+    fill_counts_.assign(path.size(), 0);
+    auto &pool = pool_;
+    pool.clear();
+    for (size_t i = 0; i < path.size(); i++) {
+      size_t level = l_ - i;
+      pool.insert(pool.end(), by_depth_[level].begin(), by_depth_[level].end());
+      while (!pool.empty() && fill_counts_[i] < Z) {
+        fill_blocks_[i * Z + fill_counts_[i]++] = stash_.take(pool.back());
+        pool.pop_back();
+      }
+    }
+    stash_.compact(pool);
+
+    write_full_buckets(path, fill_blocks_, fill_counts_);
+  }
+
+  // Builds the initial tree bottom-up: the blocks are sorted by their fresh
+  // leaf and the buckets are filled in post-order (a leaf, then every
+  // ancestor whose right subtree it completes), up to Z blocks each, the rest
+  // waiting for the next bucket up. Finished buckets are written in chunks of
+  // kSetupChunk, so memory beyond the input is the sort order and one chunk.
+  void Setup(std::vector<common::Block<B>> &blocks) {
+    std::vector<std::pair<Leaf, size_t>> order(blocks.size());
+    for (size_t i = 0; i < blocks.size(); i++) {
+      Leaf k = min_leaf_ + random_gen::generateRandomNumber(n_);
+      pos_map_->set(blocks[i].key, k);
+      blocks[i].leaf = k;
+      order[i] = {k, i};
+    }
+    std::sort(order.begin(), order.end());
+
+    stash_.clear();
+    fill_ids_.clear();
+    fill_counts_.clear();
+    std::vector<std::vector<size_t>> pending(l_ + 1);
+    auto next = order.begin();
+    for (Leaf leaf = min_leaf_; leaf <= max_leaf_; leaf++) {
+      for (; next != order.end() && next->first == leaf; ++next) {
+        pending[l_].push_back(next->second);
+      }
+      setup_bucket(leaf, blocks, pending[l_], l_ > 0 ? &pending[l_ - 1] : nullptr);
+
+      uint64_t pos = leaf - min_leaf_ + 1;
+      for (size_t level = l_; level-- > 0 && pos % 2 == 0;) {
+        pos >>= 1;
+        setup_bucket(ancestor(leaf, level), blocks, pending[level], level > 0 ? &pending[level - 1] : nullptr);
+      }
+    }
+    flush_setup();
+
+    // Drop the scratch space sized for the chunks
+    slot_arena_.release();
+    meta_arena_.release();
+    std::vector<ORBucketID>().swap(slot_ids_);
+    std::vector<ORBucketID>().swap(fill_ids_);
+    std::vector<common::Block<B>>().swap(fill_blocks_);
+    std::vector<size_t>().swap(fill_counts_);
+    std::vector<Meta>().swap(write_metas_);
+    if (stash_.size() > stash_capacity_) {
+      throw std::runtime_error("Stash size exceeded");
+    }
+  }
+
+  // Queues bucket id of a setup with up to Z of the waiting blocks and passes
+  // the rest up (to the stash if up is null).
+  void setup_bucket(ORBucketID id, const std::vector<common::Block<B>> &blocks, std::vector<size_t> &waiting,
+                    std::vector<size_t> *up) {
+    if (fill_ids_.size() == kSetupChunk) {
+      flush_setup();
+    }
+    const size_t i = fill_ids_.size();
+    const size_t keep = std::min<size_t>(waiting.size(), Z);
+    fill_ids_.push_back(id);
+    fill_counts_.push_back(keep);
+    fill_blocks_.resize((i + 1) * Z);
+    for (size_t k = 0; k < keep; k++) {
+      fill_blocks_[i * Z + k] = blocks[waiting[k]];
+    }
+    for (size_t k = keep; k < waiting.size(); k++) {
+      if (up) {
+        up->push_back(waiting[k]);
+      } else {
+        stash_.insert(blocks[waiting[k]]);
+      }
+    }
+    waiting.clear();
+  }
+
+  void flush_setup() {
+    if (fill_ids_.empty()) {
+      return;
+    }
+    write_full_buckets(fill_ids_, fill_blocks_, fill_counts_);
+    fill_ids_.clear();
+    fill_counts_.clear();
+  }
+
+  std::vector<Meta> read_meta(std::vector<ORBucketID> &ids) {
+    auto enc = meta_arena_.acquire(ids.size());
+    meta_channel_->read_buckets(std::span<const ORBucketID>(ids), enc);
+
+    std::vector<Meta> metas(ids.size());
+    char buf[EncryptedMetaSize()];
+    for (size_t i = 0; i < ids.size(); i++) {
+      if (cipher_.Open(enc[i], EncryptedMetaSize(), buf) != MetaSize()) {
+        throw std::runtime_error("Failed to decrypt bucket metadata");
+      }
+      metas[i].deserialize(buf);
+    }
+    return metas;
+  }
+
+  void write_meta(const std::vector<ORBucketID> &ids, const std::vector<Meta> &metas) {
+    if (ids.empty()) {
+      return;
+    }
+
+    auto enc = meta_arena_.acquire(ids.size());
+    char buf[MetaSize()];
+    for (size_t i = 0; i < ids.size(); i++) {
+      metas[i].serialize(buf);
+      if (!cipher_.Seal(buf, MetaSize(), enc[i])) {
+        throw std::runtime_error("Failed to encrypt bucket metadata");
+      }
+    }
+    meta_channel_->write_buckets(std::span<const ORBucketID>(ids), std::span<char *const>(enc));
+  }
+
+  // Reads the given slots and decrypts the ones selected by want (the
+  // others stay default blocks).
+  template <typename F>
+  std::vector<common::Block<B>> read_slots(std::vector<ORBucketID> &ids, F &&want) {
+    auto enc = slot_arena_.acquire(ids.size());
+    slot_channel_->read_buckets(std::span<const ORBucketID>(ids), enc);
+
+    std::vector<common::Block<B>> blocks(ids.size());
+    char buf[EncryptedSlotSize()];
+    for (size_t i = 0; i < ids.size(); i++) {
+      if (want(i)) {
+        if (cipher_.Open(enc[i], EncryptedSlotSize(), buf) != SlotSize()) {
+          throw std::runtime_error("Failed to decrypt slot");
+        }
+        blocks[i].deserialize(buf);
+      }
+    }
+    return blocks;
+  }
+
+  // Writes every slot and the metadata of the given buckets: the counts[i]
+  // blocks at contents[i * Z] land on random slots of buckets[i], dummies on
+  // the rest, and all slots become unread.
+  void write_full_buckets(const std::vector<ORBucketID> &buckets, const std::vector<common::Block<B>> &contents,
+                          const std::vector<size_t> &counts) {
+    auto enc = slot_arena_.acquire(buckets.size() * slots_);
+    slot_ids_.clear();
+    auto &metas = write_metas_;
+    metas.resize(buckets.size());
+    uint8_t perm[64];
+    const common::Block<B> *at[64];
+    char buf[SlotSize()];
+    const common::Block<B> dummy;
+
+    for (size_t i = 0; i < buckets.size(); i++) {
+      auto &m = metas[i];
+      m.count = 0;
+      m.valid = slots_ == 64 ? ~0ULL : (1ULL << slots_) - 1;
+      m.n_real = counts[i];
+
+      std::iota(perm, perm + slots_, 0);
+      std::shuffle(perm, perm + slots_, rng_);
+
+      std::fill(at, at + slots_, &dummy);
+      for (size_t j = 0; j < m.n_real; j++) {
+        m.keys[j] = contents[i * Z + j].key;
+        m.slots[j] = perm[j];
+        at[perm[j]] = &contents[i * Z + j];
+      }
+
+      for (size_t s = 0; s < slots_; s++) {
+        at[s]->serialize(buf);
+        if (!cipher_.Seal(buf, SlotSize(), enc[slot_ids_.size()])) {
+          throw std::runtime_error("Failed to encrypt slot");
+        }
+        slot_ids_.push_back(slot_id(buckets[i], s));
+      }
+    }
+
+    slot_channel_->write_buckets(std::span<const ORBucketID>(slot_ids_), std::span<char *const>(enc));
+    write_meta(buckets, metas);
+  }
+};
@@ -8,14 +8,45 @@ template <typename EncryptedBucket, size_t EncryptedBucketSize = 0>
 class PathORAMChannel {
     private:
         server::StorageServer<EncryptedBucket, EncryptedBucketSize> server_;
+        size_t bytes_read_ = 0, bytes_written_ = 0;  // Traffic through the channel
     
     public:
         PathORAMChannel(const server::ServerConfig &config) : server_(config) {}
         
-        void write_bucket(ORBucketID id, EncryptedBucket EncBucket) { server_.write_bucket(EncBucket); }
-        void write_buckets(std::map<ORBucketID, EncryptedBucket> EncBuckets) { server_.write_buckets(EncBuckets); }
-        void read_bucket(const ORBucketID &id, EncryptedBucket EncBucket) { server_.read_bucket(id, EncBucket); }
-        void read_buckets(std::vector<ORBucketID> &ids, std::vector<EncryptedBucket> &EncBuckets) { server_.read_buckets(ids, EncBuckets); }
+        void write_bucket(ORBucketID id, EncryptedBucket EncBucket) {
+            bytes_written_ += EncryptedBucketSize;
+            server_.write_bucket(id, EncBucket);
+        }
+        void write_buckets(std::map<ORBucketID, EncryptedBucket> EncBuckets) {
+            bytes_written_ += EncBuckets.size() * EncryptedBucketSize;
+            server_.write_buckets(EncBuckets);
+        }
+        void read_bucket(const ORBucketID &id, EncryptedBucket EncBucket) {
+            bytes_read_ += EncryptedBucketSize;
+            server_.read_bucket(id, EncBucket);
+        }
+        void read_buckets(std::vector<ORBucketID> &ids, std::vector<EncryptedBucket> &EncBuckets) {
+            bytes_read_ += ids.size() * EncryptedBucketSize;
+            server_.read_buckets(ids, EncBuckets);
+        }
+
+        // Span forms: EncBuckets[i] is the caller's buffer for bucket ids[i]
+        void write_buckets(std::span<const ORBucketID> ids, std::span<const EncryptedBucket> EncBuckets) {
+            bytes_written_ += ids.size() * EncryptedBucketSize;
+            server_.write_buckets(ids, EncBuckets);
+        }
+        void read_buckets(std::span<const ORBucketID> ids, std::span<const EncryptedBucket> EncBuckets) {
+            bytes_read_ += ids.size() * EncryptedBucketSize;
+            server_.read_buckets(ids, EncBuckets);
+        }
+
+        // Hint that ids will be read soon; moves no buckets
+        void prefetch(std::span<const ORBucketID> ids) {
+            server_.prefetch(ids);
+        }
+
+        size_t bytes_read() const { return bytes_read_; }
+        size_t bytes_written() const { return bytes_written_; }
 };
 
 } // namespace channel
\ No newline at end of file
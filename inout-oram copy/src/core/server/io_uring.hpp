@@ -0,0 +1,173 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+// Minimal io_uring on the raw kernel interface (no liburing): a ring of
+// fixed depth, filled with reads and writes, submitted and waited for as one
+// batch. One thread drives a ring; the io_uring storage keeps one per thread.
+namespace server {
+
+class IoUring {
+ private:
+  int fd_ = -1;
+  unsigned entries_ = 0;
+  void *sq_ring_ = MAP_FAILED, *cq_ring_ = MAP_FAILED;
+  size_t sq_ring_size_ = 0, cq_ring_size_ = 0, sqes_size_ = 0;
+  io_uring_sqe *sqes_ = static_cast<io_uring_sqe *>(MAP_FAILED);
+  unsigned *sq_head_, *sq_tail_, *sq_mask_, *sq_array_;
+  unsigned *cq_head_, *cq_tail_, *cq_mask_;
+  io_uring_cqe *cqes_;
+  unsigned queued_ = 0;     // prepared since the last submit
+  bool registered_ = false;  // a fixed buffer (index 0) is registered
+
+  static unsigned load_acquire(unsigned *p) { return std::atomic_ref<unsigned>(*p).load(std::memory_order_acquire); }
+  static void store_release(unsigned *p, unsigned v) {
+    std::atomic_ref<unsigned>(*p).store(v, std::memory_order_release);
+  }
+
+  template <typename T>
+  static T *at(void *base, uint32_t off) {
+    return reinterpret_cast<T *>(static_cast<char *>(base) + off);
+  }
+
+ public:
+  explicit IoUring(unsigned entries) {
+    io_uring_params p{};
+    fd_ = static_cast<int>(::syscall(__NR_io_uring_setup, entries, &p));
+    if (fd_ < 0) {
+      throw std::runtime_error(std::string("Failed to set up an io_uring: ") + std::strerror(errno));
+    }
+    entries_ = p.sq_entries;
+    sq_ring_size_ = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cq_ring_size_ = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+      sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+    }
+    sq_ring_ = ::mmap(nullptr, sq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_,
+                      IORING_OFF_SQ_RING);
+    if (sq_ring_ != MAP_FAILED) {
+      cq_ring_ = (p.features & IORING_FEAT_SINGLE_MMAP)
+                     ? sq_ring_
+                     : ::mmap(nullptr, cq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_,
+                              IORING_OFF_CQ_RING);
+    }
+    sqes_size_ = p.sq_entries * sizeof(io_uring_sqe);
+    if (cq_ring_ != MAP_FAILED) {
+      sqes_ = static_cast<io_uring_sqe *>(::mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE,
+                                                 MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQES));
+    }
+    if (sqes_ == MAP_FAILED) {
+      int err = errno;
+      release();
+      throw std::runtime_error(std::string("Failed to map an io_uring: ") + std::strerror(err));
+    }
+    sq_head_ = at<unsigned>(sq_ring_, p.sq_off.head);
+    sq_tail_ = at<unsigned>(sq_ring_, p.sq_off.tail);
+    sq_mask_ = at<unsigned>(sq_ring_, p.sq_off.ring_mask);
+    sq_array_ = at<unsigned>(sq_ring_, p.sq_off.array);
+    cq_head_ = at<unsigned>(cq_ring_, p.cq_off.head);
+    cq_tail_ = at<unsigned>(cq_ring_, p.cq_off.tail);
+    cq_mask_ = at<unsigned>(cq_ring_, p.cq_off.ring_mask);
+    cqes_ = at<io_uring_cqe>(cq_ring_, p.cq_off.cqes);
+  }
+
+  IoUring(const IoUring &) = delete;
+  IoUring &operator=(const IoUring &) = delete;
+
+  ~IoUring() { release(); }
+
+  unsigned entries() const { return entries_; }
+  unsigned queued() const { return queued_; }
+  bool registered() const { return registered_; }
+
+  // Registers [buf, buf + len) as fixed buffer 0, replacing the previous
+  // one. Returns false where the kernel refuses it (e.g. RLIMIT_MEMLOCK);
+  // the ring then simply works without a fixed buffer.
+  bool register_buffer(void *buf, size_t len) {
+    if (registered_) {
+      ::syscall(__NR_io_uring_register, fd_, IORING_UNREGISTER_BUFFERS, nullptr, 0);
+      registered_ = false;
+    }
+    struct iovec iov{buf, len};
+    registered_ = ::syscall(__NR_io_uring_register, fd_, IORING_REGISTER_BUFFERS, &iov, 1) == 0;
+    return registered_;
+  }
+
+  // Queues a read (or write) of len bytes at off into (from) buf; fixed: buf
+  // lies in the registered buffer. user_data comes back in the completion.
+  void queue(bool write, int fd, void *buf, size_t len, uint64_t off, bool fixed, uint64_t user_data) {
+    if (queued_ == entries_) {
+      throw std::logic_error("io_uring submission queue is full");
+    }
+    const unsigned tail = *sq_tail_ + queued_;
+    const unsigned idx = tail & *sq_mask_;
+    io_uring_sqe &sqe = sqes_[idx];
+    std::memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode = fixed ? (write ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED)
+                       : (write ? IORING_OP_WRITE : IORING_OP_READ);
+    sqe.fd = fd;
+    sqe.addr = reinterpret_cast<uint64_t>(buf);
+    sqe.len = static_cast<uint32_t>(len);
+    sqe.off = off;
+    sqe.buf_index = 0;
+    sqe.user_data = user_data;
+    sq_array_[idx] = idx;
+    queued_++;
+  }
+
+  // Submits everything queued and waits for all of it. on_complete(user_data,
+  // res) is called per completion, in completion order.
+  template <typename F>
+  void submit_and_wait(F &&on_complete) {
+    const unsigned n = queued_;
+    store_release(sq_tail_, *sq_tail_ + n);
+    queued_ = 0;
+    unsigned to_submit = n, done = 0;
+    while (done < n) {
+      long r = ::syscall(__NR_io_uring_enter, fd_, to_submit, n - done, IORING_ENTER_GETEVENTS, nullptr, 0);
+      if (r < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        throw std::runtime_error(std::string("io_uring_enter failed: ") + std::strerror(errno));
+      }
+      to_submit -= std::min<unsigned>(to_submit, static_cast<unsigned>(r));
+      unsigned head = *cq_head_;
+      const unsigned tail = load_acquire(cq_tail_);
+      for (; head != tail; head++, done++) {
+        const io_uring_cqe &cqe = cqes_[head & *cq_mask_];
+        on_complete(cqe.user_data, cqe.res);
+      }
+      store_release(cq_head_, head);
+    }
+  }
+
+ private:
+  void release() {
+    if (sqes_ != MAP_FAILED) {
+      ::munmap(sqes_, sqes_size_);
+    }
+    if (cq_ring_ != MAP_FAILED && cq_ring_ != sq_ring_) {
+      ::munmap(cq_ring_, cq_ring_size_);
+    }
+    if (sq_ring_ != MAP_FAILED) {
+      ::munmap(sq_ring_, sq_ring_size_);
+    }
+    if (fd_ >= 0) {
+      ::close(fd_);
+    }
+  }
+};
+
+} // namespace server
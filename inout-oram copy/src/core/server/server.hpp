@@ -1,68 +1,136 @@
 #pragma once
 #include <vector>
 #include <string>
-#include <fstream>
 #include <stdexcept>
 #include <memory>
 #include <unordered_map>
 #include <iostream>
 #include <cassert>
 #include <filesystem>
+#include <map>
+#include <algorithm>
+#include <atomic>
+#include <span>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <climits>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
 
 #include "oram/common/block.hpp"
 
+#ifdef ORAM_IO_URING
+#include <mutex>
+#include <thread>
+#include "server/io_uring.hpp"
+#endif
+
 namespace server {
+// When disk writes are forced to the device: never by the storage (the OS
+// writes the page cache back; a crash may lose recent evictions), after
+// every batched write, or after every sync_every-th one. Any policy other
+// than None also syncs when the storage is closed.
+enum class SyncPolicy { None, EveryWrite, Interval };
+
 // Server configuration
 struct ServerConfig {
-    enum class StorageType { Memory, Disk };
+    enum class StorageType { Memory, Disk, Arena, Uring, Mmap };
     StorageType type;
     std::string diskDirectory;
+    // Arena and Mmap: buckets to preallocate, PathORAMClient<B>::NumBuckets(n)
+    // for a tree of n blocks; Arena: whether to try huge pages for them
+    size_t num_buckets = 0;
+    bool hugepages = false;
+    // Disk and Uring: O_DIRECT layout and I/O for a new image. Disk, Uring
+    // and Mmap: durability
+    bool direct_io = false;
+    SyncPolicy sync = SyncPolicy::None;
+    size_t sync_every = 1;
 };
 
-// Storage strategy interface with template parameter
+// Storage strategy interface with template parameter. The batched calls take
+// spans so that clients can hand in buffers they own (e.g. an arena) instead
+// of building containers per access: ids[i] is read into / written from
+// buckets[i].
 template<typename EncryptedBucket, size_t EncryptedBucketSize = 0>
 class BucketStorage {
 public:
     virtual ~BucketStorage() = default;
-    virtual void write_bucket(uint32_t id, const EncryptedBucket bucket) = 0;
-    virtual void read_bucket(uint32_t id, EncryptedBucket res) = 0;
-    virtual void read_buckets(std::vector<uint32_t> &ids, std::vector<EncryptedBucket> &res) = 0;
-    virtual void write_buckets(std::map<uint32_t, EncryptedBucket> &buckets) = 0;
+    virtual void write_bucket(ORBucketID id, const EncryptedBucket bucket) = 0;
+    virtual void read_bucket(ORBucketID id, EncryptedBucket res) = 0;
+    virtual void read_buckets(std::span<const ORBucketID> ids, std::span<const EncryptedBucket> res) = 0;
+    virtual void write_buckets(std::span<const ORBucketID> ids, std::span<const EncryptedBucket> buckets) = 0;
+    // Hint: ids will be read soon. Storages that can fetch them in the
+    // background start doing so; the others ignore it.
+    virtual void prefetch(std::span<const ORBucketID> ids) {}
+
+    void read_buckets(std::vector<ORBucketID> &ids, std::vector<EncryptedBucket> &res) {
+        read_buckets(std::span<const ORBucketID>(ids), std::span<const EncryptedBucket>(res));
+    }
+
+    void write_buckets(std::map<ORBucketID, EncryptedBucket> &buckets) {
+        std::vector<ORBucketID> ids;
+        std::vector<EncryptedBucket> bufs;
+        for (const auto& [id, bucket] : buckets) {
+            ids.push_back(id);
+            bufs.push_back(bucket);
+        }
+        write_buckets(std::span<const ORBucketID>(ids), std::span<const EncryptedBucket>(bufs));
+    }
 };
 
-// Memory-based storage implementation
+// Memory-based storage implementation. Once every bucket has been written
+// (setup), reads and writes of different buckets may run concurrently.
 template<typename EncryptedBucket, size_t EncryptedBucketSize = 0>
 class MemoryStorage : public BucketStorage<EncryptedBucket, EncryptedBucketSize> {
 private:
-    std::unordered_map<uint32_t, EncryptedBucket> buckets;
+    std::unordered_map<ORBucketID, EncryptedBucket> buckets;
 
 public:
-    void write_bucket(uint32_t id, const EncryptedBucket bucket) override {
+    using BucketStorage<EncryptedBucket, EncryptedBucketSize>::read_buckets;
+    using BucketStorage<EncryptedBucket, EncryptedBucketSize>::write_buckets;
+
+    ~MemoryStorage() {
+        for (auto &[id, bucket] : buckets) {
+            free(bucket);
+        }
+    }
+
+    void write_bucket(ORBucketID id, const EncryptedBucket bucket) override {
       if (!bucket) {
           throw std::invalid_argument("[WRITE_BUCKET] Bucket must not be null");
       }
-      if (!buckets[id]) {
-        buckets[id] = static_cast<char*>(malloc(EncryptedBucketSize * sizeof(char)));
+      auto &stored = buckets[id];
+      if (!stored) {
+        stored = static_cast<char*>(malloc(EncryptedBucketSize * sizeof(char)));
       }
-      std::copy(bucket, bucket + EncryptedBucketSize, buckets[id]);
+      std::copy(bucket, bucket + EncryptedBucketSize, stored);
     }
 
-    void write_buckets(std::map<uint32_t, EncryptedBucket> &buckets) override{
-        for (const auto& [id, bucket] : buckets) {
-            write_bucket(id, bucket);
+    void write_buckets(std::span<const ORBucketID> ids, std::span<const EncryptedBucket> bufs) override {
+        for (size_t i = 0; i < ids.size(); i++) {
+            write_bucket(ids[i], bufs[i]);
         }
     }
 
-    void read_bucket(uint32_t id, EncryptedBucket res) override {
+    void read_bucket(ORBucketID id, EncryptedBucket res) override {
         if (!res) {
             throw std::invalid_argument("[READ_BUCKET] Result buffer must not be null");
         }
-        auto it = buckets[id];
+        auto it = buckets.find(id);
+        if (it == buckets.end()) {
+            throw std::out_of_range("[READ_BUCKET] Bucket was never written: " + std::to_string(id));
+        }
 
-        std::memcpy(res, it, EncryptedBucketSize);
+        std::memcpy(res, it->second, EncryptedBucketSize);
     }
 
-    void read_buckets(std::vector<ORBucketID> &ids, std::vector<EncryptedBucket> &res) override {
+    void read_buckets(std::span<const ORBucketID> ids, std::span<const EncryptedBucket> res) override {
         for (size_t i = 0; i < ids.size(); i++) {
             read_bucket(ids[i], res[i]);
         }
@@ -70,80 +138,758 @@ public:
 
 };
 
-// Disk-based storage implementation
+// Memory storage in one contiguous region of num_buckets slots, bucket id at
+// id * EncryptedBucketSize. The region is mapped and faulted in up front
+// (on 2 MiB pages if asked and available), so accesses neither allocate nor
+// page fault; reads and writes of different buckets may run concurrently. A
+// slot never written reads as zeros.
 template<typename EncryptedBucket, size_t EncryptedBucketSize>
-class DiskStorage : public BucketStorage<EncryptedBucket, EncryptedBucketSize> {
+class ArenaStorage : public BucketStorage<EncryptedBucket, EncryptedBucketSize> {
 private:
-    std::string filename;
-    std::fstream file;
+    static constexpr size_t kHugePageSize = 2ULL << 20;
+
+    char *base_ = nullptr;
+    size_t num_buckets_ = 0, mapped_ = 0;
+    bool huge_ = false;
+
+    char *slot(ORBucketID id) const {
+        if (id >= num_buckets_) {
+            throw std::out_of_range("[ARENA STORAGE] Bucket " + std::to_string(id) + " beyond the " +
+                                    std::to_string(num_buckets_) + " preallocated");
+        }
+        return base_ + static_cast<size_t>(id) * EncryptedBucketSize;
+    }
+
+    // The slots of a path are far apart: touching them all first overlaps
+    // their cache (and TLB) misses instead of taking them one copy at a time.
+    // Also checks the whole batch, ids and buffers, before anything is copied.
+    void prefetch_slots(std::span<const ORBucketID> ids, std::span<const EncryptedBucket> bufs, bool write) const {
+        for (size_t i = 0; i < ids.size(); i++) {
+            if (!bufs[i]) {
+                throw std::invalid_argument(write ? "[WRITE_BUCKET] Bucket must not be null"
+                                                  : "[READ_BUCKET] Result buffer must not be null");
+            }
+            const char *p = slot(ids[i]);
+            for (size_t off = 0; off < EncryptedBucketSize; off += 64) {
+                if (write) {
+                    __builtin_prefetch(p + off, 1);
+                } else {
+                    __builtin_prefetch(p + off, 0);
+                }
+            }
+        }
+    }
+
+public:
+    using BucketStorage<EncryptedBucket, EncryptedBucketSize>::read_buckets;
+    using BucketStorage<EncryptedBucket, EncryptedBucketSize>::write_buckets;
+
+    ArenaStorage(size_t num_buckets, bool hugepages) : num_buckets_(num_buckets) {
+        if (num_buckets == 0) {
+            throw std::invalid_argument("[ARENA STORAGE] The number of buckets must be specified");
+        }
+        const size_t bytes = num_buckets * EncryptedBucketSize;
+        void *p = MAP_FAILED;
+#ifdef MAP_HUGETLB
+        if (hugepages) {
+            mapped_ = (bytes + kHugePageSize - 1) / kHugePageSize * kHugePageSize;
+            p = ::mmap(nullptr, mapped_, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE, -1, 0);
+            huge_ = p != MAP_FAILED;
+        }
+#endif
+        if (p == MAP_FAILED) {
+            // No huge pages reserved: ask for transparent ones before faulting in
+            mapped_ = bytes;
+            p = ::mmap(nullptr, mapped_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (p == MAP_FAILED) {
+                throw std::runtime_error("[ARENA STORAGE] Failed to map " + std::to_string(bytes) + " bytes: " +
+                                         std::strerror(errno));
+            }
+#ifdef MADV_HUGEPAGE
+            if (hugepages) {
+                ::madvise(p, mapped_, MADV_HUGEPAGE);
+            }
+#endif
+#ifdef MADV_POPULATE_WRITE
+            if (::madvise(p, mapped_, MADV_POPULATE_WRITE) != 0)
+#endif
+            {
+                for (size_t off = 0; off < mapped_; off += 4096) {
+                    static_cast<volatile char *>(p)[off] = 0;
+                }
+            }
+        }
+        base_ = static_cast<char *>(p);
+    }
+
+    ArenaStorage(const ArenaStorage &) = delete;
+    ArenaStorage &operator=(const ArenaStorage &) = delete;
+
+    ~ArenaStorage() {
+        ::munmap(base_, mapped_);
+    }
+
+    size_t num_buckets() const { return num_buckets_; }
+    // Whether the region got explicit huge pages (MAP_HUGETLB)
+    bool huge_pages() const { return huge_; }
 
-    void openFile() {
-        if(!std::filesystem::exists(filename)) {
-            std::ofstream tempFile(filename);
-            tempFile.close();
+    void write_bucket(ORBucketID id, const EncryptedBucket bucket) override {
+        if (!bucket) {
+            throw std::invalid_argument("[WRITE_BUCKET] Bucket must not be null");
+        }
+        std::memcpy(slot(id), bucket, EncryptedBucketSize);
+    }
+
+    void read_bucket(ORBucketID id, EncryptedBucket res) override {
+        if (!res) {
+            throw std::invalid_argument("[READ_BUCKET] Result buffer must not be null");
+        }
+        std::memcpy(res, slot(id), EncryptedBucketSize);
+    }
+
+    void write_buckets(std::span<const ORBucketID> ids, std::span<const EncryptedBucket> bufs) override {
+        prefetch_slots(ids, bufs, true);
+        for (size_t i = 0; i < ids.size(); i++) {
+            std::memcpy(base_ + static_cast<size_t>(ids[i]) * EncryptedBucketSize, bufs[i], EncryptedBucketSize);
+        }
+    }
+
+    void read_buckets(std::span<const ORBucketID> ids, std::span<const EncryptedBucket> res) override {
+        prefetch_slots(ids, res, false);
+        for (size_t i = 0; i < ids.size(); i++) {
+            std::memcpy(res[i], base_ + static_cast<size_t>(ids[i]) * EncryptedBucketSize, EncryptedBucketSize);
         }
-        this->file.open(filename, std::ios::in | std::ios::out | std::ios::binary);
     }
+};
+
+// Head of a disk image: identifies the layout of the buckets that follow it,
+// so that an image is only reopened by a build that reads it the same way.
+// Version 1 images (no slot fields) have the packed layout.
+struct DiskImageHeader {
+    static constexpr char kMagic[8] = {'O', 'R', 'A', 'M', 'D', 'I', 'S', 'K'};
+    static constexpr uint32_t kVersion = 2;
+    static constexpr size_t kSize = 64;  // bucket 0 starts here, unless aligned
+
+    char magic[8];
+    uint32_t version;
+    uint32_t id_bytes;      // sizeof(ORBucketID)
+    uint64_t bucket_size;   // encrypted bucket size
+    uint64_t slot_size;     // bytes between buckets: bucket_size, or rounded up for O_DIRECT
+    uint64_t data_offset;   // of bucket 0: kSize, or one aligned block
+};
+static_assert(sizeof(DiskImageHeader) <= DiskImageHeader::kSize);
 
+// Disk-based storage implementation on positional I/O. Bucket id lives at
+// data_offset + id * slot_size; the packed layout (the default) puts it at
+// DiskImageHeader::kSize + id * EncryptedBucketSize, the direct layout pads
+// header and slots to kDirectAlignment so that the file can be opened with
+// O_DIRECT. Opening an existing file checks its header and keeps its layout.
+//
+// A batch is sorted by id, and every run of consecutive buckets is read or
+// written with one preadv/pwritev (straight into the caller's buffers when
+// packed, through a per-thread aligned staging buffer when direct). Reads
+// also bridge gaps of up to kReadGap bytes, so the top levels of a path,
+// which lie close together, cost one call. There is no lock: calls on
+// different buckets may run concurrently. Durability follows the sync
+// policy instead of flushing every bucket.
+template<typename EncryptedBucket, size_t EncryptedBucketSize>
+class DiskStorage : public BucketStorage<EncryptedBucket, EncryptedBucketSize> {
 public:
-    explicit DiskStorage(const std::string& path) : filename(path) {
-        openFile();
-        if (!file.is_open()) {
-            throw std::runtime_error("\n[DISK STORAGE] Failed to open storage file: " + path);
+    static constexpr size_t kDirectAlignment = 4096;
+    static constexpr size_t kReadGap = 32 << 10;
+
+protected:
+    std::string filename;
+    int fd_ = -1;
+    bool direct_ = false;
+    uint64_t slot_size_ = EncryptedBucketSize, data_offset_ = DiskImageHeader::kSize;
+    SyncPolicy sync_;
+    size_t sync_every_;
+    std::atomic<size_t> write_calls_{0};
+
+    // Per-thread scratch of the batched calls: the batch in id order cut
+    // into runs (first position in order, number of buckets), the iovecs of
+    // a run, where bridged gaps are read to, and the aligned staging buffer
+    // of direct I/O
+    struct Scratch {
+        std::vector<std::pair<ORBucketID, size_t>> order;
+        std::vector<std::pair<size_t, size_t>> runs;
+        std::vector<struct iovec> iov;
+        std::vector<char> discard = std::vector<char>(kReadGap);
+        char *staging = nullptr;
+        size_t staging_size = 0;
+
+        ~Scratch() { std::free(staging); }
+
+        char *stage(size_t bytes) {
+            if (bytes > staging_size) {
+                std::free(staging);
+                staging_size = (bytes + kDirectAlignment - 1) / kDirectAlignment * kDirectAlignment;
+                staging = static_cast<char *>(std::aligned_alloc(kDirectAlignment, staging_size));
+                if (!staging) {
+                    staging_size = 0;
+                    throw std::bad_alloc();
+                }
+            }
+            return staging;
+        }
+    };
+
+    static Scratch &scratch() {
+        static thread_local Scratch s;
+        return s;
+    }
+
+    off_t offset(ORBucketID id) const {
+        return static_cast<off_t>(data_offset_ + static_cast<uint64_t>(id) * slot_size_);
+    }
+
+    bool packed() const { return !direct_ && slot_size_ == EncryptedBucketSize; }
+
+    // Moves all of iov[0..count) at off, resuming after short transfers
+    void transfer_all(bool write, struct iovec *iov, int count, off_t off, ORBucketID first) {
+        while (count > 0) {
+            ssize_t r = write ? ::pwritev(fd_, iov, count, off) : ::preadv(fd_, iov, count, off);
+            if (r < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw std::runtime_error(std::string("Failed to ") + (write ? "write" : "read") + " buckets from " +
+                                         std::to_string(first) + ": " + std::strerror(errno));
+            }
+            if (r == 0) {
+                throw std::runtime_error(std::string("Failed to ") + (write ? "write" : "read") +
+                                         " complete bucket: " + std::to_string(first));
+            }
+            off += r;
+            size_t done = static_cast<size_t>(r);
+            while (count > 0 && done >= iov->iov_len) {
+                done -= iov->iov_len;
+                iov++;
+                count--;
+            }
+            if (count > 0) {
+                iov->iov_base = static_cast<char *>(iov->iov_base) + done;
+                iov->iov_len -= done;
+            }
+        }
+    }
+
+    // Sorts a batch by id into scratch().order and cuts it into runs: adjacent
+    // buckets and, for reads, buckets at most kReadGap apart. A run spans the
+    // slots from its first to its last bucket.
+    Scratch &plan_runs(bool write, std::span<const ORBucketID> ids, std::span<const EncryptedBucket> bufs) {
+        auto &s = scratch();
+        s.order.clear();
+        for (size_t i = 0; i < ids.size(); i++) {
+            if (!bufs[i]) {
+                throw std::invalid_argument("[DISK STORAGE] Bucket buffer must not be null");
+            }
+            s.order.emplace_back(ids[i], i);
+        }
+        // Ties keep call order, so the last write of a bucket wins
+        std::sort(s.order.begin(), s.order.end());
+
+        // A run is at most IOV_MAX / 2 buckets, leaving an iovec for each gap
+        const size_t max_run = IOV_MAX / 2;
+        const uint64_t max_gap = write ? 0 : kReadGap / slot_size_;
+        s.runs.clear();
+        for (size_t k = 0; k < s.order.size();) {
+            size_t run = 1;
+            while (k + run < s.order.size() && run < max_run &&
+                   s.order[k + run].first > s.order[k + run - 1].first &&
+                   s.order[k + run].first - s.order[k + run - 1].first - 1 <= max_gap) {
+                run++;
+            }
+            s.runs.emplace_back(k, run);
+            k += run;
+        }
+        return s;
+    }
+
+    size_t run_bytes(const Scratch &s, std::pair<size_t, size_t> run) const {
+        return static_cast<size_t>(s.order[run.first + run.second - 1].first - s.order[run.first].first + 1) *
+               slot_size_;
+    }
+
+    // Fills the slots of a run in staging from the callers' buffers (writes),
+    // or copies them out of it (reads)
+    void stage_run(bool write, const Scratch &s, std::pair<size_t, size_t> run, char *staging,
+                   std::span<const EncryptedBucket> bufs) const {
+        const ORBucketID first = s.order[run.first].first;
+        for (size_t j = run.first; j < run.first + run.second; j++) {
+            char *slot = staging + static_cast<size_t>(s.order[j].first - first) * slot_size_;
+            if (write) {
+                std::memcpy(slot, bufs[s.order[j].second], EncryptedBucketSize);
+                std::memset(slot + EncryptedBucketSize, 0, slot_size_ - EncryptedBucketSize);
+            } else {
+                std::memcpy(bufs[s.order[j].second], slot, EncryptedBucketSize);
+            }
+        }
+    }
+
+    // Applies the sync policy after a batched write
+    void after_write() {
+        const size_t calls = write_calls_.fetch_add(1, std::memory_order_relaxed) + 1;
+        if (sync_ == SyncPolicy::EveryWrite || (sync_ == SyncPolicy::Interval && calls % sync_every_ == 0)) {
+            sync();
+        }
+    }
+
+    void transfer(bool write, std::span<const ORBucketID> ids, std::span<const EncryptedBucket> bufs) {
+        auto &s = plan_runs(write, ids, bufs);
+        for (auto run : s.runs) {
+            const ORBucketID first = s.order[run.first].first;
+            s.iov.clear();
+            if (packed()) {
+                for (size_t j = run.first; j < run.first + run.second; j++) {
+                    if (j > run.first) {
+                        const size_t gap = static_cast<size_t>(s.order[j].first - s.order[j - 1].first - 1);
+                        if (gap > 0) {
+                            s.iov.push_back({s.discard.data(), gap * EncryptedBucketSize});
+                        }
+                    }
+                    s.iov.push_back({bufs[s.order[j].second], EncryptedBucketSize});
+                }
+                transfer_all(write, s.iov.data(), static_cast<int>(s.iov.size()), offset(first), first);
+            } else {
+                char *staging = s.stage(run_bytes(s, run));
+                if (write) {
+                    stage_run(true, s, run, staging, bufs);
+                }
+                s.iov.push_back({staging, run_bytes(s, run)});
+                transfer_all(write, s.iov.data(), 1, offset(first), first);
+                if (!write) {
+                    stage_run(false, s, run, staging, bufs);
+                }
+            }
+        }
+        if (write) {
+            after_write();
+        }
+    }
+
+private:
+    void openFile(bool direct_io) {
+        fd_ = ::open(filename.c_str(), O_RDWR | O_CREAT, 0644);
+        if (fd_ < 0) {
+            throw std::runtime_error("\n[DISK STORAGE] Failed to open storage file: " + filename + ": " +
+                                     std::strerror(errno));
+        }
+        struct stat st;
+        if (::fstat(fd_, &st) != 0) {
+            ::close(fd_);
+            throw std::runtime_error("[DISK STORAGE] Failed to stat " + filename);
+        }
+        if (st.st_size == 0) {
+            writeHeader(direct_io);
+        } else {
+            checkHeader();
+        }
+        if (direct_io && slot_size_ % kDirectAlignment == 0) {
+#if defined(O_DIRECT)
+            direct_ = ::fcntl(fd_, F_SETFL, ::fcntl(fd_, F_GETFL) | O_DIRECT) == 0;
+#elif defined(F_NOCACHE)
+            direct_ = ::fcntl(fd_, F_NOCACHE, 1) == 0;
+#endif
+        }
+        if (direct_io && !direct_) {
+            std::cerr << "[DISK STORAGE] Direct I/O unavailable for " << filename << ", using the page cache"
+                      << std::endl;
+        }
+    }
+
+    void writeHeader(bool aligned) {
+        if (aligned) {
+            slot_size_ = (EncryptedBucketSize + kDirectAlignment - 1) / kDirectAlignment * kDirectAlignment;
+            data_offset_ = kDirectAlignment;
+        }
+        DiskImageHeader header{};
+        std::memcpy(header.magic, DiskImageHeader::kMagic, sizeof(header.magic));
+        header.version = DiskImageHeader::kVersion;
+        header.id_bytes = sizeof(ORBucketID);
+        header.bucket_size = EncryptedBucketSize;
+        header.slot_size = slot_size_;
+        header.data_offset = data_offset_;
+        std::vector<char> buf(data_offset_, 0);
+        std::memcpy(buf.data(), &header, sizeof(header));
+        if (::pwrite(fd_, buf.data(), buf.size(), 0) != static_cast<ssize_t>(buf.size())) {
+            throw std::runtime_error("[DISK STORAGE] Failed to write the header of " + filename);
         }
     }
 
+    void checkHeader() {
+        DiskImageHeader header{};
+        if (::pread(fd_, &header, sizeof(header), 0) < static_cast<ssize_t>(offsetof(DiskImageHeader, slot_size)) ||
+            std::memcmp(header.magic, DiskImageHeader::kMagic, sizeof(header.magic)) != 0) {
+            throw std::runtime_error("[DISK STORAGE] Not an ORAM disk image: " + filename);
+        }
+        if (header.version < 1 || header.version > DiskImageHeader::kVersion ||
+            header.id_bytes != sizeof(ORBucketID) || header.bucket_size != EncryptedBucketSize) {
+            throw std::runtime_error("[DISK STORAGE] Image " + filename + " has version " +
+                                     std::to_string(header.version) + ", " + std::to_string(header.id_bytes) +
+                                     "-byte ids and " + std::to_string(header.bucket_size) +
+                                     "-byte buckets, which this build cannot read");
+        }
+        if (header.version >= 2) {
+            slot_size_ = header.slot_size;
+            data_offset_ = header.data_offset;
+        }
+    }
+
+public:
+    using BucketStorage<EncryptedBucket, EncryptedBucketSize>::read_buckets;
+    using BucketStorage<EncryptedBucket, EncryptedBucketSize>::write_buckets;
+
+    // direct_io: lay a new image out for O_DIRECT and bypass the page cache
+    // (where the file system allows it). sync_every: write calls between
+    // syncs under SyncPolicy::Interval.
+    explicit DiskStorage(const std::string& path, bool direct_io = false, SyncPolicy sync = SyncPolicy::None,
+                         size_t sync_every = 1)
+        : filename(path), sync_(sync), sync_every_(sync_every ? sync_every : 1) {
+        openFile(direct_io);
+    }
+
+    DiskStorage(const DiskStorage &) = delete;
+    DiskStorage &operator=(const DiskStorage &) = delete;
+
     ~DiskStorage() {
-        if (file.is_open()) {
-            file.close();
+        if (fd_ >= 0) {
+            if (sync_ != SyncPolicy::None) {
+                ::fsync(fd_);
+            }
+            ::close(fd_);
+        }
+    }
+
+    // Whether the file is read and written around the page cache
+    bool direct() const { return direct_; }
+    size_t slot_size() const { return slot_size_; }
+
+    // Makes every completed write durable
+    virtual void sync() {
+#if defined(__linux__)
+        int r = ::fdatasync(fd_);
+#else
+        int r = ::fsync(fd_);
+#endif
+        if (r != 0) {
+            throw std::runtime_error("[DISK STORAGE] Failed to sync " + filename + ": " + std::strerror(errno));
+        }
+    }
+
+    void write_bucket(ORBucketID id, const EncryptedBucket bucket) override {
+        transfer(true, std::span<const ORBucketID>(&id, 1), std::span<const EncryptedBucket>(&bucket, 1));
+    }
+
+    void read_bucket(ORBucketID id, EncryptedBucket res) override {
+        transfer(false, std::span<const ORBucketID>(&id, 1), std::span<const EncryptedBucket>(&res, 1));
+    }
+
+    void write_buckets(std::span<const ORBucketID> ids, std::span<const EncryptedBucket> bufs) override {
+        transfer(true, ids, bufs);
+    }
+
+    void read_buckets(std::span<const ORBucketID> ids, std::span<const EncryptedBucket> res) override {
+        transfer(false, ids, res);
+    }
+};
+
+// Disk image (same header, layout and sync policy as DiskStorage) mapped
+// into memory: reads and writes are copies from and to the mapping, served
+// by the page cache at close to MemoryStorage speed, and opening an existing
+// image maps it without reading it. The mapping is sized once, to
+// num_buckets or the image, whichever is larger; a new image needs
+// num_buckets. Access is random, so fault readahead is off (MADV_RANDOM);
+// prefetch asks the kernel to read the pages of the next buckets instead
+// (MADV_WILLNEED). Syncs are msync of the mapping.
+template<typename EncryptedBucket, size_t EncryptedBucketSize>
+class MmapStorage : public DiskStorage<EncryptedBucket, EncryptedBucketSize> {
+private:
+    using Base = DiskStorage<EncryptedBucket, EncryptedBucketSize>;
+    char *map_ = static_cast<char *>(MAP_FAILED);
+    size_t map_size_ = 0, num_buckets_ = 0;
+
+    char *slot(ORBucketID id) const {
+        if (id >= num_buckets_) {
+            throw std::out_of_range("[MMAP STORAGE] Bucket " + std::to_string(id) + " beyond the " +
+                                    std::to_string(num_buckets_) + " mapped");
         }
+        return map_ + this->offset(id);
     }
 
-    void write_bucket(uint32_t id, const EncryptedBucket bucket) override {
-        assert(bucket);
-        file.seekp(id * EncryptedBucketSize);
-        if (!file.good()) {
-            throw std::runtime_error("Failed to seek to position for bucket: " + 
-                                   std::to_string(id));
+    static void check_buffer(const char *buf) {
+        if (!buf) {
+            throw std::invalid_argument("[MMAP STORAGE] Bucket buffer must not be null");
         }
+    }
 
-        file.write(bucket, EncryptedBucketSize);
-        if (!file.good()) {
-            throw std::runtime_error("Failed to write bucket: " + 
-                                   std::to_string(id));
+    // A null buffer fails the whole batch before any bucket is copied
+    static void check_buffers(std::span<const EncryptedBucket> bufs) {
+        for (auto buf : bufs) {
+            check_buffer(buf);
+        }
+    }
+
+public:
+    using BucketStorage<EncryptedBucket, EncryptedBucketSize>::read_buckets;
+    using BucketStorage<EncryptedBucket, EncryptedBucketSize>::write_buckets;
+
+    explicit MmapStorage(const std::string& path, size_t num_buckets = 0, SyncPolicy sync = SyncPolicy::None,
+                         size_t sync_every = 1)
+        : Base(path, false, sync, sync_every) {
+        struct stat st;
+        if (::fstat(this->fd_, &st) != 0) {
+            throw std::runtime_error("[MMAP STORAGE] Failed to stat " + path);
+        }
+        const uint64_t size = static_cast<uint64_t>(st.st_size);
+        const uint64_t stored = size > this->data_offset_ ? (size - this->data_offset_) / this->slot_size_ : 0;
+        num_buckets_ = std::max<size_t>(num_buckets, stored);
+        if (num_buckets_ == 0) {
+            throw std::invalid_argument("[MMAP STORAGE] num_buckets must be set for a new image: " + path);
+        }
+        map_size_ = static_cast<size_t>(this->offset(num_buckets_));
+        if (size < map_size_ && ::ftruncate(this->fd_, static_cast<off_t>(map_size_)) != 0) {
+            throw std::runtime_error("[MMAP STORAGE] Failed to extend " + path + ": " + std::strerror(errno));
+        }
+        map_ = static_cast<char *>(::mmap(nullptr, map_size_, PROT_READ | PROT_WRITE, MAP_SHARED, this->fd_, 0));
+        if (map_ == MAP_FAILED) {
+            throw std::runtime_error("[MMAP STORAGE] Failed to map " + path + ": " + std::strerror(errno));
         }
+        ::madvise(map_, map_size_, MADV_RANDOM);
+    }
 
-        file.flush();
+    ~MmapStorage() {
+        if (map_ != MAP_FAILED) {
+            if (this->sync_ != SyncPolicy::None) {
+                ::msync(map_, map_size_, MS_SYNC);
+            }
+            ::munmap(map_, map_size_);
+        }
     }
 
-    void read_bucket(uint32_t id, EncryptedBucket res) override {
-        assert(res);
-        file.seekg(id * EncryptedBucketSize);
-        if (!file.good()) {
-            throw std::runtime_error("Failed to seek to position for bucket: " + 
-                                   std::to_string(id));
+    size_t num_buckets() const { return num_buckets_; }
+
+    void sync() override {
+        if (::msync(map_, map_size_, MS_SYNC) != 0) {
+            throw std::runtime_error("[MMAP STORAGE] Failed to sync " + this->filename + ": " + std::strerror(errno));
         }
+    }
 
-        file.read(res, EncryptedBucketSize);
-        if (file.gcount() != EncryptedBucketSize) {
-            throw std::runtime_error("Failed to read complete bucket: " + 
-                                   std::to_string(id));
+    // One MADV_WILLNEED per run of pages: the ids sorted, their page ranges
+    // merged. Ids beyond the mapping are ignored.
+    void prefetch(std::span<const ORBucketID> ids) override {
+        static const size_t page = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+        static thread_local std::vector<std::pair<size_t, size_t>> ranges;
+        ranges.clear();
+        for (auto id : ids) {
+            if (id < num_buckets_) {
+                const size_t off = static_cast<size_t>(this->offset(id));
+                ranges.emplace_back(off / page * page, off + EncryptedBucketSize);
+            }
+        }
+        std::sort(ranges.begin(), ranges.end());
+        for (size_t i = 0; i < ranges.size();) {
+            auto [begin, end] = ranges[i];
+            for (i++; i < ranges.size() && ranges[i].first <= end; i++) {
+                end = std::max(end, ranges[i].second);
+            }
+            ::madvise(map_ + begin, end - begin, MADV_WILLNEED);
         }
     }
-    
-    void write_buckets(std::map<ORBucketID, EncryptedBucket> &buckets) override {
-        for (const auto& [id, bucket] : buckets) {
-            write_bucket(id, bucket);
+
+    void write_bucket(ORBucketID id, const EncryptedBucket bucket) override {
+        check_buffer(bucket);
+        std::memcpy(slot(id), bucket, EncryptedBucketSize);
+        this->after_write();
+    }
+
+    void read_bucket(ORBucketID id, EncryptedBucket res) override {
+        check_buffer(res);
+        std::memcpy(res, slot(id), EncryptedBucketSize);
+    }
+
+    void write_buckets(std::span<const ORBucketID> ids, std::span<const EncryptedBucket> bufs) override {
+        check_buffers(bufs.first(ids.size()));
+        for (size_t i = 0; i < ids.size(); i++) {
+            std::memcpy(slot(ids[i]), bufs[i], EncryptedBucketSize);
         }
+        this->after_write();
     }
 
-    void read_buckets(std::vector<ORBucketID> &ids, std::vector<EncryptedBucket> &res) override {
+    void read_buckets(std::span<const ORBucketID> ids, std::span<const EncryptedBucket> res) override {
+        check_buffers(res.first(ids.size()));
         for (size_t i = 0; i < ids.size(); i++) {
-            read_bucket(ids[i], res[i]);
+            std::memcpy(res[i], slot(ids[i]), EncryptedBucketSize);
         }
     }
 };
 
+#ifdef ORAM_IO_URING
+// Disk storage (same image, layout and sync policy) whose batched reads and
+// writes go through io_uring: the runs of a batch, e.g. the buckets of a
+// path or of an eviction, are submitted together and complete in any
+// order, so a path costs about one I/O latency instead of one per level.
+// Every thread gets its own ring, with its staging buffer registered as a
+// fixed buffer where the kernel allows it. Single-bucket calls stay on
+// pread/pwrite.
+template<typename EncryptedBucket, size_t EncryptedBucketSize>
+class UringStorage : public DiskStorage<EncryptedBucket, EncryptedBucketSize> {
+private:
+    using Base = DiskStorage<EncryptedBucket, EncryptedBucketSize>;
+    using Scratch = typename Base::Scratch;
+    static constexpr unsigned kDepth = 256;
+    static constexpr size_t kMaxCachedRings = 8;
+
+    struct ThreadRing {
+        IoUring ring{kDepth};
+        char *staging = nullptr;
+        size_t staging_size = 0;
+        // Per run of the current wave: where it is staged, bytes moved so
+        // far; and the runs to queue again
+        std::vector<size_t> at, done;
+        std::vector<uint64_t> short_runs;
+
+        ~ThreadRing() { std::free(staging); }
+
+        char *stage(size_t bytes) {
+            if (bytes > staging_size) {
+                std::free(staging);
+                staging_size = (bytes + Base::kDirectAlignment - 1) / Base::kDirectAlignment * Base::kDirectAlignment;
+                staging = static_cast<char *>(std::aligned_alloc(Base::kDirectAlignment, staging_size));
+                if (!staging) {
+                    staging_size = 0;
+                    throw std::bad_alloc();
+                }
+                ring.register_buffer(staging, staging_size);
+            }
+            return staging;
+        }
+    };
+
+    inline static std::atomic<uint64_t> next_id_{1};
+    const uint64_t id_ = next_id_.fetch_add(1, std::memory_order_relaxed);
+    std::mutex rings_mutex_;
+    std::unordered_map<std::thread::id, std::unique_ptr<ThreadRing>> rings_;
+
+    // The calling thread's ring. Threads remember the rings of their last few
+    // storages; ids are never reused, so a destroyed storage is never hit.
+    ThreadRing &ring() {
+        static thread_local std::vector<std::pair<uint64_t, ThreadRing *>> cache;
+        for (auto &[id, r] : cache) {
+            if (id == id_) {
+                return *r;
+            }
+        }
+        std::lock_guard<std::mutex> lock(rings_mutex_);
+        auto &r = rings_[std::this_thread::get_id()];
+        if (!r) {
+            r = std::make_unique<ThreadRing>();
+        }
+        if (cache.size() == kMaxCachedRings) {
+            cache.erase(cache.begin());
+        }
+        cache.emplace_back(id_, r.get());
+        return *r;
+    }
+
+    void transfer(bool write, std::span<const ORBucketID> ids, std::span<const EncryptedBucket> bufs) {
+        Scratch &s = this->plan_runs(write, ids, bufs);
+        ThreadRing &tr = ring();
+        size_t total = 0;
+        for (auto run : s.runs) {
+            total += this->run_bytes(s, run);
+        }
+        char *staging = tr.stage(total);
+
+        // Waves of at most one ring of runs, each submitted as one batch. A
+        // run may complete short (as preadv/pwritev may): its remainder is
+        // queued again, until done or a completion moves no bytes (EIO).
+        auto &at = tr.at, &done = tr.done;
+        for (size_t wave = 0, wave_at = 0; wave < s.runs.size(); wave += tr.ring.entries()) {
+            const size_t end = std::min<size_t>(s.runs.size(), wave + tr.ring.entries());
+            at.resize(end - wave);
+            done.assign(end - wave, 0);
+            auto queue = [&](size_t r) {
+                const size_t k = r - wave;
+                const ORBucketID first = s.order[s.runs[r].first].first;
+                tr.ring.queue(write, this->fd_, staging + at[k] + done[k], this->run_bytes(s, s.runs[r]) - done[k],
+                              static_cast<uint64_t>(this->offset(first)) + done[k], tr.ring.registered(), r);
+            };
+            for (size_t r = wave; r < end; r++) {
+                at[r - wave] = wave_at;
+                if (write) {
+                    this->stage_run(true, s, s.runs[r], staging + wave_at, bufs);
+                }
+                queue(r);
+                wave_at += this->run_bytes(s, s.runs[r]);
+            }
+            while (tr.ring.queued() > 0) {
+                int error = 0;
+                size_t failed = 0;
+                tr.short_runs.clear();
+                tr.ring.submit_and_wait([&](uint64_t r, int res) {
+                    if (res == -EINTR || res == -EAGAIN) {
+                        tr.short_runs.push_back(r);
+                    } else if (res <= 0) {
+                        if (error == 0) {
+                            error = res < 0 ? -res : EIO;
+                            failed = r;
+                        }
+                    } else {
+                        done[r - wave] += static_cast<size_t>(res);
+                        if (done[r - wave] < this->run_bytes(s, s.runs[r])) {
+                            tr.short_runs.push_back(r);
+                        }
+                    }
+                });
+                if (error != 0) {
+                    const ORBucketID first = s.order[s.runs[failed].first].first;
+                    if (error == EIO && !write) {
+                        throw std::runtime_error("Failed to read complete bucket: " + std::to_string(first));
+                    }
+                    throw std::runtime_error(std::string("Failed to ") + (write ? "write" : "read") +
+                                             " buckets from " + std::to_string(first) + ": " + std::strerror(error));
+                }
+                for (auto r : tr.short_runs) {
+                    queue(r);
+                }
+            }
+            if (!write) {
+                for (size_t r = wave; r < end; r++) {
+                    this->stage_run(false, s, s.runs[r], staging + at[r - wave], bufs);
+                }
+            }
+        }
+        if (write) {
+            this->after_write();
+        }
+    }
+
+public:
+    using BucketStorage<EncryptedBucket, EncryptedBucketSize>::read_buckets;
+    using BucketStorage<EncryptedBucket, EncryptedBucketSize>::write_buckets;
+
+    explicit UringStorage(const std::string& path, bool direct_io = false, SyncPolicy sync = SyncPolicy::None,
+                          size_t sync_every = 1)
+        : Base(path, direct_io, sync, sync_every) {
+        ring();  // fails here, not on the first access, where io_uring is unavailable
+    }
+
+    // Whether the calling thread's ring reads into a registered buffer
+    bool fixed_buffers() { return ring().ring.registered(); }
+
+    void write_buckets(std::span<const ORBucketID> ids, std::span<const EncryptedBucket> bufs) override {
+        transfer(true, ids, bufs);
+    }
+
+    void read_buckets(std::span<const ORBucketID> ids, std::span<const EncryptedBucket> res) override {
+        transfer(false, ids, res);
+    }
+};
+#endif
+
 // Main server class
 template<typename EncryptedBucket, size_t EncryptedBucketSize = 0>
 class StorageServer {
@@ -166,27 +912,70 @@ public:
                     throw std::runtime_error("Bucket size must be specified for disk storage");
                 }
                 storage = std::make_unique<DiskStorage<EncryptedBucket, EncryptedBucketSize>>(
-                    config.diskDirectory
+                    config.diskDirectory, config.direct_io, config.sync, config.sync_every
+                );
+                break;
+            case ServerConfig::StorageType::Uring:
+                if (config.diskDirectory.empty()) {
+                    throw std::runtime_error("Disk directory must be specified for io_uring storage");
+                }
+#ifdef ORAM_IO_URING
+                storage = std::make_unique<UringStorage<EncryptedBucket, EncryptedBucketSize>>(
+                    config.diskDirectory, config.direct_io, config.sync, config.sync_every
                 );
                 break;
+#else
+                throw std::runtime_error("Built without io_uring storage (the io_uring meson option)");
+#endif
+            case ServerConfig::StorageType::Arena:
+                if constexpr (EncryptedBucketSize == 0) {
+                    throw std::runtime_error("Bucket size must be specified for arena storage");
+                } else {
+                    storage = std::make_unique<ArenaStorage<EncryptedBucket, EncryptedBucketSize>>(
+                        config.num_buckets, config.hugepages);
+                }
+                break;
+            case ServerConfig::StorageType::Mmap:
+                if (config.diskDirectory.empty()) {
+                    throw std::runtime_error("Disk directory must be specified for mmap storage");
+                }
+                if constexpr (EncryptedBucketSize == 0) {
+                    throw std::runtime_error("Bucket size must be specified for mmap storage");
+                } else {
+                    storage = std::make_unique<MmapStorage<EncryptedBucket, EncryptedBucketSize>>(
+                        config.diskDirectory, config.num_buckets, config.sync, config.sync_every);
+                }
+                break;
         }
     }
 
-    void write_bucket(uint32_t id, const EncryptedBucket& bucket) {
+    void write_bucket(ORBucketID id, const EncryptedBucket& bucket) {
         storage->write_bucket(id, bucket);
     }
 
-    void write_buckets(std::map<uint32_t, EncryptedBucket> &buckets) {
+    void write_buckets(std::map<ORBucketID, EncryptedBucket> &buckets) {
         storage->write_buckets(buckets);
     }
 
-    void read_bucket(uint32_t id, EncryptedBucket res) {
+    void read_bucket(ORBucketID id, EncryptedBucket res) {
         return storage->read_bucket(id, res);
     }
 
     void read_buckets(std::vector<ORBucketID> &ids, std::vector<EncryptedBucket> &res) {
         return storage->read_buckets(ids, res);
     }
+
+    void write_buckets(std::span<const ORBucketID> ids, std::span<const EncryptedBucket> buckets) {
+        storage->write_buckets(ids, buckets);
+    }
+
+    void read_buckets(std::span<const ORBucketID> ids, std::span<const EncryptedBucket> res) {
+        storage->read_buckets(ids, res);
+    }
+
+    void prefetch(std::span<const ORBucketID> ids) {
+        storage->prefetch(ids);
+    }
 };
 
 } // namespace server
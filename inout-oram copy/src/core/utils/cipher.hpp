@@ -0,0 +1,266 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <stdexcept>
+#include <vector>
+
+#include <openssl/err.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+
+#include "utils/crypto.hpp"
+
+// Bucket cipher of the ORAM clients. Contexts are created once per thread and
+// engine and keep the expanded key: sealing a bucket only sets a fresh nonce.
+// The mode is a build option (see the `cipher` meson option), since it fixes
+// the size of a sealed bucket and with it the channel types.
+namespace utils {
+
+enum class CipherMode : uint32_t {
+  CBC = 0,  // legacy layout: padded ciphertext || 16-byte IV, as Encrypt
+  CTR = 1,  // ciphertext || 12-byte nonce
+  GCM = 2,  // ciphertext || 16-byte tag || 12-byte nonce, authenticated
+};
+
+#if defined(ORAM_CIPHER_CBC)
+inline constexpr CipherMode kBucketCipher = CipherMode::CBC;
+#elif defined(ORAM_CIPHER_GCM)
+inline constexpr CipherMode kBucketCipher = CipherMode::GCM;
+#else
+inline constexpr CipherMode kBucketCipher = CipherMode::CTR;
+#endif
+
+inline constexpr size_t kNonceSize = 12;
+inline constexpr size_t kTagSize = 16;
+
+// Size of a sealed plaintext of len bytes
+constexpr size_t SealedLen(size_t len, CipherMode mode = kBucketCipher) {
+  switch (mode) {
+    case CipherMode::CBC: return CiphertextLen(len);
+    case CipherMode::CTR: return len + kNonceSize;
+    case CipherMode::GCM: return len + kTagSize + kNonceSize;
+  }
+  return 0;
+}
+
+namespace detail {
+
+// Per-thread nonces: a random 64-bit prefix and a 32-bit counter, the prefix
+// redrawn whenever the counter wraps. With a random prefix per thread (and
+// per wrap), two threads repeat a nonce under the same key only on a 64-bit
+// collision.
+struct NonceSource {
+  uint64_t prefix = 0;
+  uint32_t counter = 0;
+
+  void next(unsigned char *out) {
+    if (counter == 0 && RAND_bytes(reinterpret_cast<unsigned char *>(&prefix), sizeof(prefix)) != 1) {
+      throw std::runtime_error("Failed to draw a nonce prefix");
+    }
+    std::memcpy(out, &prefix, sizeof(prefix));
+    std::memcpy(out + sizeof(prefix), &counter, sizeof(counter));
+    counter++;
+  }
+};
+
+// The last few engines used on this thread, each with an encryption and a
+// decryption context already keyed. Engines are told apart by a process-wide
+// id, never reused, so a destroyed engine's contexts are simply never hit
+// again and age out.
+struct CipherContexts {
+  static constexpr size_t kMaxEngines = 8;
+  struct Entry {
+    uint64_t engine;
+    EVP_CIPHER_CTX *enc, *dec;
+  };
+  std::vector<Entry> entries;  // least recently used first
+
+  CipherContexts() { entries.reserve(kMaxEngines); }
+  CipherContexts(const CipherContexts &) = delete;
+  CipherContexts &operator=(const CipherContexts &) = delete;
+  ~CipherContexts() {
+    for (auto &e : entries) {
+      EVP_CIPHER_CTX_free(e.enc);
+      EVP_CIPHER_CTX_free(e.dec);
+    }
+  }
+
+  Entry &get(uint64_t engine, const EVP_CIPHER *cipher, const Key &key) {
+    for (size_t i = entries.size(); i-- > 0;) {
+      if (entries[i].engine == engine) {
+        if (i + 1 != entries.size()) {
+          std::swap(entries[i], entries.back());
+        }
+        return entries.back();
+      }
+    }
+    Entry e{engine, nullptr, nullptr};
+    if (entries.size() == kMaxEngines) {
+      // Reuse the oldest contexts; EVP_*Init_ex with a cipher resets them
+      e = entries.front();
+      e.engine = engine;
+      entries.erase(entries.begin());
+    } else {
+      e.enc = EVP_CIPHER_CTX_new();
+      e.dec = EVP_CIPHER_CTX_new();
+    }
+    if (e.enc == nullptr || e.dec == nullptr
+        || EVP_EncryptInit_ex(e.enc, cipher, nullptr, key.data(), nullptr) != 1
+        || EVP_DecryptInit_ex(e.dec, cipher, nullptr, key.data(), nullptr) != 1) {
+      ERR_print_errors_fp(stderr);
+      EVP_CIPHER_CTX_free(e.enc);
+      EVP_CIPHER_CTX_free(e.dec);
+      throw std::runtime_error("Failed to set up a cipher context");
+    }
+    entries.push_back(e);
+    return entries.back();
+  }
+};
+
+inline thread_local CipherContexts tls_contexts;
+inline thread_local NonceSource tls_nonces;
+
+inline std::atomic<uint64_t> next_engine_id{1};
+
+} // namespace detail
+
+// Seals (encrypts, and with GCM authenticates) fixed-size buffers under one
+// key. Thread-safe: every thread uses its own contexts and nonces.
+class CipherEngine {
+ private:
+  Key key_;
+  CipherMode mode_;
+  uint64_t id_ = detail::next_engine_id.fetch_add(1, std::memory_order_relaxed);
+
+  const EVP_CIPHER *cipher() const {
+    switch (mode_) {
+      case CipherMode::CBC: return kCipher();
+      case CipherMode::CTR: return EVP_aes_256_ctr();
+      case CipherMode::GCM: return EVP_aes_256_gcm();
+    }
+    return nullptr;
+  }
+
+  detail::CipherContexts::Entry &contexts() const {
+    return detail::tls_contexts.get(id_, cipher(), key_);
+  }
+
+  // The 16-byte IV of CBC and CTR (nonce || zero block counter), or GCM's
+  // 12-byte nonce, taken from the end of a sealed buffer
+  static void load_iv(const unsigned char *nonce, size_t nonce_len, unsigned char *iv) {
+    std::memset(iv, 0, kIvSize);
+    std::memcpy(iv, nonce, nonce_len);
+  }
+
+  bool seal_one(EVP_CIPHER_CTX *ctx, const char *in, size_t len, char *out) const {
+    auto *o = reinterpret_cast<unsigned char *>(out);
+    const size_t body = mode_ == CipherMode::CBC ? CiphertextLen(len) - kIvSize : len;
+    const size_t nonce_len = mode_ == CipherMode::CBC ? kIvSize : kNonceSize;
+    unsigned char *nonce = o + SealedLen(len, mode_) - nonce_len;
+    unsigned char iv[kIvSize];
+    if (mode_ == CipherMode::CBC) {
+      if (RAND_bytes(nonce, kIvSize) != 1) {
+        return false;
+      }
+    } else {
+      detail::tls_nonces.next(nonce);
+    }
+    load_iv(nonce, nonce_len, iv);
+    int l1 = 0, l2 = 0;
+    if (EVP_EncryptInit_ex(ctx, nullptr, nullptr, nullptr, iv) != 1
+        || EVP_EncryptUpdate(ctx, o, &l1, reinterpret_cast<const unsigned char *>(in), static_cast<int>(len)) != 1
+        || EVP_EncryptFinal_ex(ctx, o + l1, &l2) != 1
+        || static_cast<size_t>(l1 + l2) != body) {
+      ERR_print_errors_fp(stderr);
+      return false;
+    }
+    if (mode_ == CipherMode::GCM
+        && EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, kTagSize, o + len) != 1) {
+      ERR_print_errors_fp(stderr);
+      return false;
+    }
+    return true;
+  }
+
+  size_t open_one(EVP_CIPHER_CTX *ctx, const char *in, size_t sealed_len, char *out) const {
+    const auto *i = reinterpret_cast<const unsigned char *>(in);
+    auto *o = reinterpret_cast<unsigned char *>(out);
+    const size_t nonce_len = mode_ == CipherMode::CBC ? kIvSize : kNonceSize;
+    const size_t overhead = mode_ == CipherMode::GCM ? kTagSize + kNonceSize : nonce_len;
+    if (sealed_len < overhead) {
+      return 0;
+    }
+    const size_t body = sealed_len - overhead;
+    unsigned char iv[kIvSize];
+    load_iv(i + sealed_len - nonce_len, nonce_len, iv);
+    int l1 = 0, l2 = 0;
+    if (EVP_DecryptInit_ex(ctx, nullptr, nullptr, nullptr, iv) != 1
+        || EVP_DecryptUpdate(ctx, o, &l1, i, static_cast<int>(body)) != 1) {
+      ERR_print_errors_fp(stderr);
+      return 0;
+    }
+    if (mode_ == CipherMode::GCM
+        && EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_TAG, kTagSize,
+                               const_cast<unsigned char *>(i + body)) != 1) {
+      return 0;
+    }
+    // A GCM tag mismatch fails here; it is an expected outcome (tampering),
+    // not an OpenSSL error worth printing
+    if (EVP_DecryptFinal_ex(ctx, o + l1, &l2) != 1) {
+      ERR_clear_error();
+      return 0;
+    }
+    return static_cast<size_t>(l1 + l2);
+  }
+
+ public:
+  explicit CipherEngine(const Key &key, CipherMode mode = kBucketCipher) : key_(key), mode_(mode) {}
+  // A copy gets its own id, hence its own contexts
+  CipherEngine(const CipherEngine &other) : key_(other.key_), mode_(other.mode_) {}
+  CipherEngine &operator=(const CipherEngine &other) {
+    key_ = other.key_;
+    mode_ = other.mode_;
+    id_ = detail::next_engine_id.fetch_add(1, std::memory_order_relaxed);
+    return *this;
+  }
+
+  CipherMode Mode() const { return mode_; }
+  size_t SealedSize(size_t len) const { return SealedLen(len, mode_); }
+
+  // Writes SealedSize(len) bytes to out. Returns false on failure.
+  bool Seal(const char *in, size_t len, char *out) const {
+    return seal_one(contexts().enc, in, len, out);
+  }
+
+  // Returns the plaintext length, or 0 if in does not decrypt (or, with GCM,
+  // does not authenticate) under this key.
+  size_t Open(const char *in, size_t sealed_len, char *out) const {
+    return open_one(contexts().dec, in, sealed_len, out);
+  }
+
+  // Seals in[i] (len bytes each) into out[i], e.g. the buckets of a path,
+  // with one context lookup for the whole batch.
+  bool SealBatch(std::span<char *const> in, size_t len, std::span<char *const> out) const {
+    EVP_CIPHER_CTX *ctx = contexts().enc;
+    bool ok = true;
+    for (size_t k = 0; k < in.size(); k++) {
+      ok = seal_one(ctx, in[k], len, out[k]) && ok;
+    }
+    return ok;
+  }
+
+  // Opens in[i] (sealed_len bytes each) into out[i]. True iff every buffer
+  // opened to len bytes.
+  bool OpenBatch(std::span<char *const> in, size_t sealed_len, size_t len, std::span<char *const> out) const {
+    EVP_CIPHER_CTX *ctx = contexts().dec;
+    bool ok = true;
+    for (size_t k = 0; k < in.size(); k++) {
+      ok = open_one(ctx, in[k], sealed_len, out[k]) == len && ok;
+    }
+    return ok;
+  }
+};
+
+} // namespace utils
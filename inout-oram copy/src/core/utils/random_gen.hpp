@@ -1,31 +1,225 @@
 #pragma once
-#include <random>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
 
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+
+// Client randomness: leaves, block contents, keys and shuffles all come from
+// a per-thread AES-256-CTR generator, seeded once per thread from the OS.
+// For reproducible runs, SetSeed (or ORAM_RNG_SEED=<n> in the environment)
+// derives every thread's stream from one seed instead: thread k to draw
+// after the seed is set gets stream k, so runs repeat as long as threads
+// start drawing in the same order.
 namespace random_gen {
- 
-int generateRandomNumber(int n) {
-    if (n <= 0) {
+
+namespace detail {
+
+struct SeedState {
+    std::atomic<uint64_t> epoch{0};  // bumped by SetSeed/ClearSeed, threads reseed on change
+    std::atomic<bool> deterministic{false};
+    std::atomic<uint64_t> seed{0};
+    std::atomic<uint64_t> next_stream{0};
+
+    SeedState() {
+        if (const char *env = std::getenv("ORAM_RNG_SEED")) {
+            seed = std::strtoull(env, nullptr, 0);
+            deterministic = true;
+        }
+    }
+};
+
+inline SeedState &seed_state() {
+    static SeedState state;
+    return state;
+}
+
+} // namespace detail
+
+// AES-256-CTR keystream with fast key erasure: every refill encrypts a
+// buffer of zeros and the first 32 bytes of it become the next key, so the
+// key never reveals earlier output.
+class Drbg {
+  public:
+    static constexpr size_t kBufferSize = 4096;
+    static constexpr size_t kKeySize = 32;
+
+    Drbg() = default;
+    Drbg(const Drbg &) = delete;
+    Drbg &operator=(const Drbg &) = delete;
+    ~Drbg() {
+        OPENSSL_cleanse(buf_, sizeof(buf_));
+        EVP_CIPHER_CTX_free(ctx_);
+    }
+
+    inline uint64_t next() {
+        if (pos_ + sizeof(uint64_t) > kBufferSize || epoch_ != detail::seed_state().epoch.load(std::memory_order_relaxed)) {
+            refill();
+        }
+        uint64_t r;
+        std::memcpy(&r, buf_ + pos_, sizeof(r));
+        pos_ += sizeof(r);
+        return r;
+    }
+
+    void bytes(void *out, size_t len) {
+        auto *o = static_cast<unsigned char *>(out);
+        while (len > 0) {
+            if (pos_ == kBufferSize || epoch_ != detail::seed_state().epoch.load(std::memory_order_relaxed)) {
+                refill();
+            }
+            size_t take = std::min(len, kBufferSize - pos_);
+            std::memcpy(o, buf_ + pos_, take);
+            pos_ += take;
+            o += take;
+            len -= take;
+        }
+    }
+
+  private:
+    EVP_CIPHER_CTX *ctx_ = nullptr;
+    alignas(64) unsigned char buf_[kBufferSize];
+    size_t pos_ = kBufferSize;
+    uint64_t epoch_ = std::numeric_limits<uint64_t>::max();
+
+    inline static constexpr unsigned char kZeros[kBufferSize] = {};
+
+    void rekey(const unsigned char *key) {
+        static constexpr unsigned char kIv[16] = {};
+        bool ok;
+        if (ctx_ == nullptr) {
+            ctx_ = EVP_CIPHER_CTX_new();
+            ok = ctx_ != nullptr && EVP_EncryptInit_ex(ctx_, EVP_aes_256_ctr(), nullptr, key, kIv) == 1;
+        } else {
+            ok = EVP_EncryptInit_ex(ctx_, nullptr, nullptr, key, kIv) == 1;
+        }
+        if (!ok) {
+            throw std::runtime_error("Failed to key the random generator");
+        }
+    }
+
+    void reseed() {
+        auto &s = detail::seed_state();
+        epoch_ = s.epoch.load(std::memory_order_acquire);
+        unsigned char key[kKeySize];
+        if (s.deterministic.load(std::memory_order_relaxed)) {
+            const uint64_t in[2] = {s.seed.load(std::memory_order_relaxed), s.next_stream.fetch_add(1)};
+            unsigned int len = 0;
+            if (EVP_Digest(in, sizeof(in), key, &len, EVP_sha256(), nullptr) != 1) {
+                throw std::runtime_error("Failed to derive a random generator key");
+            }
+        } else if (RAND_bytes(key, kKeySize) != 1) {
+            throw std::runtime_error("Failed to seed the random generator");
+        }
+        rekey(key);
+        OPENSSL_cleanse(key, sizeof(key));
+    }
+
+    void refill() {
+        if (epoch_ != detail::seed_state().epoch.load(std::memory_order_relaxed)) {
+            reseed();
+        }
+        int len = 0;
+        if (EVP_EncryptUpdate(ctx_, buf_, &len, kZeros, kBufferSize) != 1) {
+            throw std::runtime_error("Failed to run the random generator");
+        }
+        rekey(buf_);
+        OPENSSL_cleanse(buf_, kKeySize);
+        pos_ = kKeySize;
+    }
+};
+
+inline Drbg &ThreadDrbg() {
+    static thread_local Drbg drbg;
+    return drbg;
+}
+
+// Deterministic mode: every thread restarts from streams derived from seed.
+// The calling thread gets stream 0.
+inline void SetSeed(uint64_t seed) {
+    auto &s = detail::seed_state();
+    s.seed = seed;
+    s.next_stream = 0;
+    s.deterministic = true;
+    s.epoch.fetch_add(1, std::memory_order_release);
+    ThreadDrbg().next();
+}
+
+// Back to OS-seeded streams
+inline void ClearSeed() {
+    auto &s = detail::seed_state();
+    s.deterministic = false;
+    s.epoch.fetch_add(1, std::memory_order_release);
+}
+
+inline uint64_t Random64() { return ThreadDrbg().next(); }
+
+inline void RandBytes(void *out, size_t len) { ThreadDrbg().bytes(out, len); }
+
+// Uniform in [0, n), without modulo bias (Lemire's multiply-and-reject).
+inline uint64_t generateRandomNumber(uint64_t n) {
+    if (n == 0) {
         throw std::invalid_argument("n must be greater than 0");
     }
+    auto &g = ThreadDrbg();
+    __uint128_t m = static_cast<__uint128_t>(g.next()) * n;
+    if (static_cast<uint64_t>(m) < n) {
+        const uint64_t threshold = -n % n;
+        while (static_cast<uint64_t>(m) < threshold) {
+            m = static_cast<__uint128_t>(g.next()) * n;
+        }
+    }
+    return static_cast<uint64_t>(m >> 64);
+}
 
-    // Create a random device and seed the generator
-    std::random_device rd; 
-    std::mt19937 gen(rd());
+// out[i] = base + a uniform draw from [0, n), for i < count: e.g. count
+// fresh leaves with base = the first leaf and n = the number of leaves.
+template <typename T>
+inline void FillRandomNumbers(T *out, size_t count, uint64_t n, uint64_t base = 0) {
+    if (n == 0) {
+        throw std::invalid_argument("n must be greater than 0");
+    }
+    auto &g = ThreadDrbg();
+    const uint64_t threshold = -n % n;
+    for (size_t i = 0; i < count; i++) {
+        __uint128_t m;
+        do {
+            m = static_cast<__uint128_t>(g.next()) * n;
+        } while (static_cast<uint64_t>(m) < threshold);
+        out[i] = static_cast<T>(base + static_cast<uint64_t>(m >> 64));
+    }
+}
 
-    // Define the range [0, n-1]
-    std::uniform_int_distribution<> dist(0, n - 1);
+// UniformRandomBitGenerator over the thread's generator, for std::shuffle
+// and the <random> distributions
+struct Urbg {
+    using result_type = uint64_t;
+    static constexpr result_type min() { return 0; }
+    static constexpr result_type max() { return std::numeric_limits<uint64_t>::max(); }
+    result_type operator()() const { return Random64(); }
+};
 
-    // Generate and return the random number
-    return dist(gen);
+// Stateless splitmix64 mix. Mix64(seed + i) is the i-th value of a
+// deterministic stream that any thread can evaluate at any position.
+inline uint64_t Mix64(uint64_t x) {
+    x += 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
 }
 
 template <size_t B>
 std::array<uint8_t,B> GenRandBytes() {
-    std::array<uint8_t,B> res{};
-    for (size_t i = 0; i < B; i++) {
-        res[i] = generateRandomNumber(255);
-    }
+    std::array<uint8_t,B> res;
+    RandBytes(res.data(), B);
     return res;
 }
 
-} // namespace random_gen
\ No newline at end of file
+} // namespace random_gen
@@ -8,6 +8,9 @@
 #include <random>
 #include <cstring>
 #include <utility>
+#include <stdexcept>
+
+#include <openssl/rand.h>
 
 namespace odict {
 
@@ -48,12 +51,8 @@ public:
         // Generate key using the renamed function from ADJORAM if you're using the same class
         // Or implement key generation directly:
         state->key.resize(32);
-        std::random_device rd;
-        std::mt19937 gen(rd());
-        std::uniform_int_distribution<uint8_t> dist(0, 255);
-        
-        for (size_t i = 0; i < state->key.size(); i++) {
-            state->key[i] = dist(gen);
+        if (RAND_bytes(state->key.data(), static_cast<int>(state->key.size())) != 1) {
+            throw std::runtime_error("Failed to generate odict key");
         }
         
         return {state, tree};
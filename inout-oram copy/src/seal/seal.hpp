@@ -12,25 +12,24 @@
 #include <random>
 #include <thread>
 #include <chrono>
+#include <stdexcept>
 #include <spdlog/spdlog.h>
 #include "oram/path_oram/path_oram.hpp"
+#include "oram/ring_oram/ring_oram.hpp"
+#include "oram/circuit_oram/circuit_oram.hpp"
 #include "server/server.hpp"
 #include "core/utils/crypto.hpp"
 #include "oram/common/block.hpp"
 
 namespace seal {
 
-// Helper function for key generation with a different name to avoid conflicts
+// Helper function for key generation with a different name to avoid conflicts.
+// Key material comes from OpenSSL, never from the seedable leaf DRBG.
 inline std::vector<uint8_t> CreateRandomKey(size_t key_size = 32) {
     std::vector<uint8_t> key(key_size);
-    std::random_device rd;
-    std::mt19937 gen(rd());
-    std::uniform_int_distribution<uint8_t> dist(0, 255);
-    
-    for (size_t i = 0; i < key_size; i++) {
-        key[i] = dist(gen);
+    if (RAND_bytes(key.data(), static_cast<int>(key_size)) != 1) {
+        throw std::runtime_error("Failed to generate SEAL key");
     }
-    
     return key;
 }
 inline utils::Key VectorToKey(const std::vector<uint8_t>& vec) {
@@ -76,12 +75,14 @@ public:
         KeywordDocPair(const std::string& k, uint32_t id) : keyword(k), doc_id(id) {}
     };
 
-    // Setup function initializes the encrypted index
+    // Setup function initializes the encrypted index; engine picks the ORAM
+    // behind every ADJ-ORAM region
     static std::pair<ClientState, ServerIndex> Setup(
         size_t security_param,
         const std::vector<std::pair<std::string, std::vector<uint32_t>>>& dataset,
         size_t alpha,
-        size_t x);
+        size_t x,
+        common::ORAMEngine engine = common::ORAMEngine::Path);
 
     // Search function to query the encrypted index
     static std::pair<std::vector<uint32_t>, ClientState> Search(
@@ -261,8 +262,9 @@ public:
         std::vector<uint8_t> key;
         size_t alpha;
         size_t N;
-        // Add PathORAM clients, but don't use them yet
-        std::vector<PathORAMClient<B>*> oram_clients;
+        // One ORAM client per region, of the engine picked at setup
+        common::ORAMEngine engine = common::ORAMEngine::Path;
+        std::vector<common::ORAMClient<B>*> oram_clients;
         // Keep the original implementation working
         std::vector<std::vector<uint8_t>> encrypted_regions;
     };
@@ -270,21 +272,34 @@ public:
     struct EncryptedMemory {
         // Add PathORAM channels, but don't use them yet
         std::vector<std::shared_ptr<channel::PathORAMChannel<char*, PathORAMClient<B>::EncryptedBucketSize()>>> channels;
+        // Ring ORAM regions keep slots and bucket metadata in separate channels
+        std::vector<typename RingORAMClient<B>::TSlotChannel> ring_slot_channels;
+        std::vector<typename RingORAMClient<B>::TMetaChannel> ring_meta_channels;
         // Keep the original implementation working
         std::vector<std::vector<uint8_t>> encrypted_regions;
     };
     using PathORAMChannelType = channel::PathORAMChannel<char*, PathORAMClient<B>::EncryptedBucketSize()>;
 
+    // Reads look blocks up by doc id: the index itself when it is a doc id
+    // no larger than kMaxProbeDocId, otherwise (or on a miss) the first of
+    // the doc ids 1..kMaxProbeDocId present in the region
+    static constexpr uint32_t kMaxProbeDocId = 20;
+
+    static bool IsDirectDocId(size_t index) {
+        return index <= kMaxProbeDocId;
+    }
+
     
     // Initialize the ADJ-ORAM
 static std::pair<std::shared_ptr<State>, std::shared_ptr<EncryptedMemory>> Initialize(
     size_t security_param,
     const std::vector<typename SEAL<B>::KeywordDocPair>& memory,
-    size_t alpha) {
+    size_t alpha,
+    common::ORAMEngine engine = common::ORAMEngine::Path) {
     
     spdlog::info("===== ADJORAM::Initialize ENTRY POINT =====");
     std::this_thread::sleep_for(std::chrono::seconds(1));
-    spdlog::info("SETTING UP REAL PATHORAM CHANNELS AND CLIENTS");
+    spdlog::info("SETTING UP REAL ORAM CHANNELS AND CLIENTS");
     
     auto state = std::make_shared<State>();
     auto encrypted_memory = std::make_shared<EncryptedMemory>();
@@ -293,6 +308,8 @@ static std::pair<std::shared_ptr<State>, std::shared_ptr<EncryptedMemory>> Initi
     state->key = CreateRandomKey();
     state->alpha = alpha;
     state->N = memory.size();
+    state->engine = engine;
+    const char* engine_name = common::EngineName(engine);
     
     // Number of regions = 2^alpha
     size_t num_regions = 1 << alpha;
@@ -300,6 +317,8 @@ static std::pair<std::shared_ptr<State>, std::shared_ptr<EncryptedMemory>> Initi
     // Initialize both the original and PathORAM structures
     encrypted_memory->encrypted_regions.resize(num_regions);
     encrypted_memory->channels.resize(num_regions);
+    encrypted_memory->ring_slot_channels.resize(num_regions);
+    encrypted_memory->ring_meta_channels.resize(num_regions);
     state->oram_clients.resize(num_regions);
     state->encrypted_regions.resize(num_regions);
     
@@ -338,24 +357,56 @@ static std::pair<std::shared_ptr<State>, std::shared_ptr<EncryptedMemory>> Initi
         
         // Try to set up a real PathORAM channel and client
         try {
-            spdlog::info("Creating PathORAM channel for region {}", i);
+            spdlog::info("Creating {} channel for region {}", engine_name, i);
             server::ServerConfig config;
             config.type = server::ServerConfig::StorageType::Memory;
             
-            // Create real PathORAM channel
-            encrypted_memory->channels[i] = std::make_shared<PathORAMChannelType>(config);
             
             // Calculate region capacity
             size_t region_capacity = std::max(size_t(1), regions[i].size());
-            spdlog::info("Initializing PathORAM for region {} with capacity {}", i, region_capacity);
+            spdlog::info("Initializing {} for region {} with capacity {}", engine_name, i, region_capacity);
+            
+            // Doc ids are sparse (dummies live near 0xFFFFFFFF), so the dense
+            // position map is only usable when every key fits the region. An
+            // empty region is padded with a default block, whose key does not.
+            bool dense_keys = !regions[i].empty() && std::all_of(regions[i].begin(), regions[i].end(),
+                [region_capacity](const auto& pair) { return pair.doc_id < region_capacity; });
+            auto pm_type = dense_keys ? common::PositionMapType::Dense : common::PositionMapType::Map;
             
             // Initialize ORAM for this region
-            std::optional<PathORAMClient<B>*> opt_oram = PathORAMClient<B>::Construct(
-                region_capacity, encrypted_memory->channels[i], VectorToKey(state->key));
+            std::optional<common::ORAMClient<B>*> opt_oram;
+            if (engine == common::ORAMEngine::Ring) {
+                encrypted_memory->ring_slot_channels[i] = std::make_shared<
+                    typename RingORAMClient<B>::TSlotChannel::element_type>(config);
+                encrypted_memory->ring_meta_channels[i] = std::make_shared<
+                    typename RingORAMClient<B>::TMetaChannel::element_type>(config);
+                auto ring = RingORAMClient<B>::Construct(
+                    region_capacity, encrypted_memory->ring_slot_channels[i], encrypted_memory->ring_meta_channels[i],
+                    VectorToKey(state->key), RingORAMParams(), pm_type);
+                if (ring.has_value()) {
+                    opt_oram = ring.value();
+                }
+            } else if (engine == common::ORAMEngine::Circuit) {
+                encrypted_memory->channels[i] = std::make_shared<PathORAMChannelType>(config);
+                auto circuit = CircuitORAMClient<B>::Construct(
+                    region_capacity, encrypted_memory->channels[i], VectorToKey(state->key), pm_type);
+                if (circuit.has_value()) {
+                    opt_oram = circuit.value();
+                }
+            } else {
+                encrypted_memory->channels[i] = std::make_shared<PathORAMChannelType>(config);
+                auto path = PathORAMClient<B>::Construct(
+                    region_capacity, encrypted_memory->channels[i], VectorToKey(state->key), pm_type);
+                if (path.has_value()) {
+                    opt_oram = path.value();
+                }
+            }
             
             if (opt_oram.has_value()) {
-                state->oram_clients[i] = opt_oram.value();
-                spdlog::info("PathORAM client created successfully for region {}", i);
+                // Published only once Init succeeded: a region whose Init
+                // failed keeps no client
+                std::unique_ptr<common::ORAMClient<B>> oram(opt_oram.value());
+                spdlog::info("{} client created successfully for region {}", engine_name, i);
                     std::vector<common::Block<B>> blocks;
                     for (const auto& pair : regions[i]) {
                         spdlog::info("Storing block with key={} (doc_id) for keyword '{}'", 
@@ -371,17 +422,18 @@ static std::pair<std::shared_ptr<State>, std::shared_ptr<EncryptedMemory>> Initi
                             blocks.push_back(common::Block<B>());
                         }
                         
-                        spdlog::info("Initializing PathORAM {} with {} blocks", i, blocks.size());
+                        spdlog::info("Initializing {} {} with {} blocks", engine_name, i, blocks.size());
                         
                         // Initialize PathORAM with blocks
-                        state->oram_clients[i]->Init(blocks);
-                        spdlog::info("PathORAM {} initialized successfully with actual data", i);
+                        oram->Init(blocks);
+                        state->oram_clients[i] = oram.release();
+                        spdlog::info("{} {} initialized successfully with actual data", engine_name, i);
     
             } else {
-                spdlog::error("Failed to create PathORAM client for region {}", i);
+                spdlog::error("Failed to create {} client for region {}", engine_name, i);
             }
         } catch (const std::exception& e) {
-            spdlog::error("Error setting up PathORAM for region {}: {}", i, e.what());
+            spdlog::error("Error setting up {} for region {}: {}", engine_name, i, e.what());
         }
     }
     
@@ -428,23 +480,21 @@ static std::pair<typename SEAL<B>::KeywordDocPair, std::shared_ptr<State>> Acces
     result.doc_id = 0; // Initialize with safe default values
     result.keyword = "";
     bool used_pathoram = false;
+    const char* engine_name = common::EngineName(state->engine);
 
     if (region_idx < state->oram_clients.size() && state->oram_clients[region_idx]) {
         try {
             if (op == "read") {
-                spdlog::info("Using actual PathORAM Read operation on region {}", region_idx);
+                spdlog::info("Using actual {} Read operation on region {}", engine_name, region_idx);
                 
                 // APPROACH 3: Instead of searching for specific keys, we'll use a more careful approach
                 // that finds any valid block in the region and returns that
                 spdlog::info("APPROACH 3: Looking for real blocks in the region");
                 
-                // List of common document IDs to try (real ones, not dummy ones)
-                std::vector<uint32_t> common_doc_ids = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19, 20};
-                
                 bool found_any_block = false;
                 
                 // First try the actual document ID if the index is small enough (might be a direct mapping)
-                if (index >= 0 && index <= 20) {
+                if (IsDirectDocId(index)) {
                     try {
                         common::Block<B> block;
                         uint32_t key_to_try = index;
@@ -471,7 +521,7 @@ static std::pair<typename SEAL<B>::KeywordDocPair, std::shared_ptr<State>> Acces
                 
                 // If we didn't find a block with the index, try common document IDs
                 if (!found_any_block) {
-                    for (uint32_t doc_id : common_doc_ids) {
+                    for (uint32_t doc_id = 1; doc_id <= kMaxProbeDocId; doc_id++) {
                         try {
                             common::Block<B> block;
                             
@@ -500,14 +550,14 @@ static std::pair<typename SEAL<B>::KeywordDocPair, std::shared_ptr<State>> Acces
                 
                 // Perform eviction
                 state->oram_clients[region_idx]->Evict();
-                spdlog::info("PathORAM Evict completed for region {}", region_idx);
+                spdlog::info("{} Evict completed for region {}", engine_name, region_idx);
                 
                 if (!found_any_block) {
                     spdlog::warn("No blocks could be found in region {}", region_idx);
                 }
                 
             } else if (op == "write") {
-                spdlog::info("Using actual PathORAM Write operation on region {}", region_idx);
+                spdlog::info("Using actual {} Write operation on region {}", engine_name, region_idx);
                 
                 // For now, just try reading a block first, then evict
                 try {
@@ -526,16 +576,16 @@ static std::pair<typename SEAL<B>::KeywordDocPair, std::shared_ptr<State>> Acces
                 
                 // Perform eviction
                 state->oram_clients[region_idx]->Evict();
-                spdlog::info("PathORAM Evict completed for region {}", region_idx);
+                spdlog::info("{} Evict completed for region {}", engine_name, region_idx);
             }
         } catch (const std::exception& e) {
-            spdlog::error("PathORAM operation failed: {}", e.what());
+            spdlog::error("{} operation failed: {}", engine_name, e.what());
         }
     }
     
     // Fall back to original implementation if PathORAM failed or not available
     if (!used_pathoram) {
-        spdlog::info("Falling back to original implementation (no PathORAM available)");
+        spdlog::info("Falling back to original implementation (no ORAM available)");
         
         // Original implementation
         if (op == "read") {
@@ -545,18 +595,127 @@ static std::pair<typename SEAL<B>::KeywordDocPair, std::shared_ptr<State>> Acces
             // Try to use PathORAM if available
             try {
                 if (region_idx < state->oram_clients.size() && state->oram_clients[region_idx]) {
-                    spdlog::info("Attempting to use PathORAM for reading");
+                    spdlog::info("Attempting to use {} for reading", engine_name);
                     // Log the attempt, but don't actually use it yet
-                    spdlog::info("PathORAM read operation would happen here");
+                    spdlog::info("{} read operation would happen here", engine_name);
                 }
             } catch (const std::exception& e) {
-                spdlog::error("PathORAM access failed: {}", e.what());
+                spdlog::error("{} access failed: {}", engine_name, e.what());
             }
         }
     }
     
     return {result, state};
 }
+
+// Batched read of several indices: the lookups that land in the same region
+// share one PathORAMClient::AccessBatch, i.e. one read of the union of their
+// paths and one eviction, instead of a read_path + Evict round trip each.
+// Keys are tried the way Access tries them: the direct doc ids first, then,
+// for the indices of a region left without a hit, one more batch over the
+// probe doc ids 1..kMaxProbeDocId whose first hit serves all of them.
+static std::pair<std::vector<typename SEAL<B>::KeywordDocPair>, std::shared_ptr<State>> AccessBatch(
+    const std::shared_ptr<State>& state,
+    std::shared_ptr<EncryptedMemory>& encrypted_memory,
+    const std::vector<size_t>& indices,
+    size_t alpha) {
+
+    std::vector<typename SEAL<B>::KeywordDocPair> results(indices.size());
+    for (auto& result : results) {
+        result.doc_id = 0;
+    }
+    if (alpha == 0) {
+        spdlog::warn("Using alpha=0 (single region) - handling carefully");
+        return {results, state};
+    }
+
+    auto prp = [&state](uint32_t i) -> uint32_t {
+        std::hash<std::string> hasher;
+        std::string to_hash(reinterpret_cast<char*>(&i), sizeof(i));
+        to_hash.append(reinterpret_cast<const char*>(state->key.data()), state->key.size());
+        return hasher(to_hash);
+    };
+
+    auto has_client = [&state](size_t region_idx) {
+        return region_idx < state->oram_clients.size() && state->oram_clients[region_idx];
+    };
+    const char* engine_name = common::EngineName(state->engine);
+    auto batch_read = [&state, engine_name](size_t region_idx, const std::vector<ORKey>& keys,
+                               std::vector<common::Block<B>>& blocks) {
+        std::vector<AccessOp> ops(keys.size(), AccessOp::Read);
+        try {
+            state->oram_clients[region_idx]->AccessBatch(keys, ops, blocks);
+        } catch (const std::exception& e) {
+            spdlog::error("{} batch on region {} failed: {}", engine_name, region_idx, e.what());
+            return false;
+        }
+        spdlog::info("{} batch of {} accesses completed for region {}", engine_name, keys.size(), region_idx);
+        return true;
+    };
+    auto serve = [&results](size_t i, const common::Block<B>& block) {
+        auto& result = results[i];
+        result.doc_id = block.key;
+        result.keyword = std::string(reinterpret_cast<const char*>(block.val),
+                                     strnlen(reinterpret_cast<const char*>(block.val), B));
+    };
+
+    // Group the lookups by region. Regions without a client leave their
+    // results at the defaults, as Access does.
+    std::map<size_t, std::vector<size_t>> direct, probe;
+    for (size_t i = 0; i < indices.size(); i++) {
+        size_t region_idx = prp(indices[i]) >> (32 - alpha);
+        if (!has_client(region_idx)) {
+            continue;
+        }
+        if (IsDirectDocId(indices[i])) {
+            direct[region_idx].push_back(i);
+        } else {
+            probe[region_idx].push_back(i);
+        }
+    }
+
+    for (auto& [region_idx, positions] : direct) {
+        std::vector<ORKey> keys;
+        for (auto i : positions) {
+            keys.push_back(indices[i]);
+        }
+        std::vector<common::Block<B>> blocks;
+        if (!batch_read(region_idx, keys, blocks)) {
+            continue;
+        }
+        for (size_t j = 0; j < positions.size(); j++) {
+            if (blocks[j].key == keys[j]) {
+                serve(positions[j], blocks[j]);
+            } else {
+                probe[region_idx].push_back(positions[j]);
+            }
+        }
+    }
+
+    std::vector<ORKey> probe_keys;
+    for (uint32_t doc_id = 1; doc_id <= kMaxProbeDocId; doc_id++) {
+        probe_keys.push_back(doc_id);
+    }
+    for (auto& [region_idx, positions] : probe) {
+        std::vector<common::Block<B>> blocks;
+        if (!batch_read(region_idx, probe_keys, blocks)) {
+            continue;
+        }
+        size_t hit = 0;
+        while (hit < probe_keys.size() && blocks[hit].key != probe_keys[hit]) {
+            hit++;
+        }
+        if (hit == probe_keys.size()) {
+            spdlog::warn("No blocks could be found in region {}", region_idx);
+            continue;
+        }
+        for (auto i : positions) {
+            serve(i, blocks[hit]);
+        }
+    }
+
+    return {results, state};
+}
 };
 
 
@@ -567,7 +726,8 @@ std::pair<typename SEAL<B>::ClientState, typename SEAL<B>::ServerIndex> SEAL<B>:
     size_t security_param,
     const std::vector<std::pair<std::string, std::vector<uint32_t>>>& dataset,
     size_t alpha,
-    size_t x) {
+    size_t x,
+    common::ORAMEngine engine) {
     
     // Step 1: Pad the dataset using ADJ-PADDING
     auto padded_dataset = ADJPadding<B>::PadDataset(dataset, x);
@@ -602,7 +762,7 @@ std::pair<typename SEAL<B>::ClientState, typename SEAL<B>::ServerIndex> SEAL<B>:
     }
     
     // Step 5: Initialize ADJ-ORAM with array M
-    auto [oram_state, encrypted_memory] = ADJORAM<B>::Initialize(security_param, M, alpha);
+    auto [oram_state, encrypted_memory] = ADJORAM<B>::Initialize(security_param, M, alpha, engine);
     
     // Step 6: Create client state and server index
     ClientState client_state = {oram_state, odict_state};
@@ -630,16 +790,16 @@ std::pair<std::vector<uint32_t>, typename SEAL<B>::ClientState> SEAL<B>::Search(
     size_t first_index = metadata.first;
     size_t count = metadata.second;
     
-    // Step 3: Retrieve documents via ADJ-ORAM
+    // Step 3: Retrieve documents via ADJ-ORAM, all postings in one batch
     std::vector<uint32_t> results;
-    auto updated_oram_state = oram_state;
-    
-    for (size_t i = first_index; i < first_index + count; i++) {
-        auto [doc_pair, new_oram_state] = ADJORAM<B>::Access(
-            updated_oram_state, encrypted_memory, "read", i, KeywordDocPair(), alpha);
-        
-        updated_oram_state = new_oram_state;
-        
+    std::vector<size_t> indices(count);
+    for (size_t i = 0; i < count; i++) {
+        indices[i] = first_index + i;
+    }
+    auto [doc_pairs, updated_oram_state] = ADJORAM<B>::AccessBatch(
+        oram_state, encrypted_memory, indices, alpha);
+
+    for (const auto& doc_pair : doc_pairs) {
         // Add valid document IDs to results (filter out dummy documents)
         if (doc_pair.doc_id < 0xFFFFFFF0) {
             results.push_back(doc_pair.doc_id);
@@ -77,6 +77,21 @@ int main() {
         }
     }
     
+    // The same index with Ring ORAM regions
+    {
+        sw.start();
+        auto [ring_client_state, ring_server_index] =
+            seal::SEAL<B>::Setup(128, dataset, alpha, x, common::ORAMEngine::Ring);
+        spdlog::info("[RING] SEAL setup: {:.6f} seconds", sw.elapsed_sec());
+
+        auto [path_results, path_state] = seal::SEAL<B>::Search(client_state, server_index, "apple", alpha);
+        client_state = path_state;
+        sw.start();
+        auto [ring_results, ring_state] = seal::SEAL<B>::Search(ring_client_state, ring_server_index, "apple", alpha);
+        spdlog::info("[RING] Found {} results in {:.6f} seconds", ring_results.size(), sw.elapsed_sec());
+        assert(ring_results.size() == path_results.size());
+    }
+
     // Test different parameter configurations
     spdlog::info("\nTesting SEAL with different configurations:");
     
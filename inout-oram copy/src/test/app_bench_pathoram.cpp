@@ -0,0 +1,695 @@
+#include <filesystem>
+#include <random>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/resource.h>
+#include <spdlog/spdlog.h>
+
+#include "oram/path_oram/path_oram.hpp"
+#include "oram/ring_oram/ring_oram.hpp"
+#include "oram/circuit_oram/circuit_oram.hpp"
+#include "server/channel.hpp"
+#include "server/server.hpp"
+#include "ext/tinyformat.hpp"
+#include "pthread_threadpool.hpp"
+#include "datalog.hpp"
+#include "stopwatch.hpp"
+
+const size_t B = 64;
+const size_t n = 1ULL << 14;
+const size_t n_accesses = 200;
+
+using ExampleEncryptedBucket = char *;
+const size_t ExampleEncryptedBucketSize = PathORAMClient<B>::EncryptedBucketSize();
+
+struct BenchCase {
+  std::string name;
+  PositionMapConfig pm;
+};
+
+// Client memory vs. round trips for the position map variants. Every
+// recursive level costs one extra read and one extra write round trip per
+// access, but keeps only the last level's array and the stashes on the client.
+void bench_position_maps(DataLog &log) {
+  auto key = utils::GenerateKey();
+  server::ServerConfig config;
+  config.type = server::ServerConfig::StorageType::Arena;
+  config.num_buckets = PathORAMClient<B>::NumBuckets(n);
+
+  std::vector<BenchCase> cases = {
+      {"map", PositionMapConfig(common::PositionMapType::Map)},
+      {"dense", PositionMapConfig(common::PositionMapType::Dense)},
+      {"recursive-4096", PositionMapConfig(common::PositionMapType::Recursive, 4096, config)},
+      {"recursive-256", PositionMapConfig(common::PositionMapType::Recursive, 256, config)},
+      {"recursive-1", PositionMapConfig(common::PositionMapType::Recursive, 1, config)},
+  };
+
+  std::vector<common::Block<B>> blocks;
+  for (size_t i = 0; i < n; i++) {
+    blocks.push_back(common::Block<B>(i, random_gen::GenRandBytes<B>()));
+  }
+
+  for (auto &c : cases) {
+    auto channel = std::make_shared<channel::PathORAMChannel<ExampleEncryptedBucket, ExampleEncryptedBucketSize>>(config);
+    auto opt_oram = PathORAMClient<B>::Construct(n, std::move(channel), key, c.pm);
+    if (!opt_oram.has_value()) {
+      throw std::runtime_error("Failed to initialize ORAM");
+    }
+    PathORAMClient<B> *oram = opt_oram.value();
+
+    auto init_blocks = blocks;
+    oram->Init(init_blocks);
+
+    Stopwatch sw;
+    sw.start();
+    for (size_t i = 0; i < n_accesses; i++) {
+      ORKey k = random_gen::generateRandomNumber(n);
+      common::Block<B> data;
+      oram->Read(k, data);
+      oram->Evict();
+      if (std::memcmp(data.val, blocks[k].val, B) != 0) {
+        throw std::runtime_error("Read returned wrong value for key " + std::to_string(k));
+      }
+    }
+    double access_us = sw.elapsed_sec() * 1e6 / n_accesses;
+
+    size_t levels = oram->PositionMapLevels();
+    DataRow row;
+    row.add_column("pos_map", c.name);
+    row.add_column("levels", levels);
+    row.add_column("round_trips", 2 * (levels + 1));
+    row.add_column("client_bytes", oram->ClientMemoryBytes());
+    row.add_column("access_us", access_us);
+    log.add_row(row);
+
+    spdlog::info("[POS-MAP] {}: levels={} round_trips/access={} client_bytes={} access={:.1f}us",
+                 c.name, levels, 2 * (levels + 1), oram->ClientMemoryBytes(), access_us);
+  }
+}
+
+// Share of the access latency spent in eviction (placement, serialization,
+// encryption and the write round trip) vs. the read side of the access.
+void bench_eviction(DataLog &log) {
+  auto key = utils::GenerateKey();
+  server::ServerConfig config;
+  config.type = server::ServerConfig::StorageType::Arena;
+
+  for (size_t log_n : {10, 14, 16}) {
+    size_t n_blocks = 1ULL << log_n;
+    config.num_buckets = PathORAMClient<B>::NumBuckets(n_blocks);
+    auto channel = std::make_shared<channel::PathORAMChannel<ExampleEncryptedBucket, ExampleEncryptedBucketSize>>(config);
+    PathORAMClient<B> *oram = PathORAMClient<B>::Construct(n_blocks, std::move(channel), key).value();
+
+    std::vector<common::Block<B>> blocks;
+    for (size_t i = 0; i < n_blocks; i++) {
+      blocks.push_back(common::Block<B>(i, random_gen::GenRandBytes<B>()));
+    }
+
+    Stopwatch setup;
+    setup.start();
+    oram->Init(blocks);
+    double setup_s = setup.elapsed_sec();
+
+    Stopwatch sw;
+    double read_ns = 0, evict_ns = 0;
+    for (size_t i = 0; i < n_accesses; i++) {
+      common::Block<B> data;
+      ORKey k = random_gen::generateRandomNumber(n_blocks);
+
+      sw.start();
+      oram->Read(k, data);
+      read_ns += sw.elapsed_ns();
+
+      sw.start();
+      oram->Evict();
+      evict_ns += sw.elapsed_ns();
+    }
+
+    double evict_share = evict_ns / (read_ns + evict_ns);
+    DataRow row;
+    row.add_column("n", n_blocks);
+    row.add_column("setup_s", setup_s);
+    row.add_column("read_us", read_ns / 1e3 / n_accesses);
+    row.add_column("evict_us", evict_ns / 1e3 / n_accesses);
+    row.add_column("evict_share", evict_share);
+    log.add_row(row);
+
+    spdlog::info("[EVICT] n={}: setup={:.3f}s read={:.1f}us evict={:.1f}us ({:.1f}% of access)",
+                 n_blocks, setup_s, read_ns / 1e3 / n_accesses, evict_ns / 1e3 / n_accesses, evict_share * 100);
+  }
+}
+
+// k reads issued one by one (k read + k write round trips) vs. one
+// AccessBatch over the same keys (one of each, shared top buckets fetched
+// once).
+void bench_batch(DataLog &log) {
+  auto key = utils::GenerateKey();
+  server::ServerConfig config;
+  config.type = server::ServerConfig::StorageType::Arena;
+  config.num_buckets = PathORAMClient<B>::NumBuckets(n);
+
+  auto channel = std::make_shared<channel::PathORAMChannel<ExampleEncryptedBucket, ExampleEncryptedBucketSize>>(config);
+  PathORAMClient<B> *oram = PathORAMClient<B>::Construct(n, std::move(channel), key).value();
+
+  std::vector<common::Block<B>> blocks;
+  for (size_t i = 0; i < n; i++) {
+    blocks.push_back(common::Block<B>(i, random_gen::GenRandBytes<B>()));
+  }
+  auto init_blocks = blocks;
+  oram->Init(init_blocks);
+
+  const size_t rounds = 20;
+  for (size_t k : {1, 4, 16, 64}) {
+    Stopwatch sw;
+    double single_ns = 0, batch_ns = 0;
+    for (size_t r = 0; r < rounds; r++) {
+      std::vector<ORKey> keys(k);
+      for (auto &w : keys) {
+        w = random_gen::generateRandomNumber(n);
+      }
+
+      sw.start();
+      for (auto w : keys) {
+        common::Block<B> data;
+        oram->Read(w, data);
+        oram->Evict();
+      }
+      single_ns += sw.elapsed_ns();
+
+      std::vector<AccessOp> ops(k, AccessOp::Read);
+      std::vector<common::Block<B>> data;
+      sw.start();
+      oram->AccessBatch(keys, ops, data);
+      batch_ns += sw.elapsed_ns();
+
+      for (size_t i = 0; i < k; i++) {
+        if (std::memcmp(data[i].val, blocks[keys[i]].val, B) != 0) {
+          throw std::runtime_error("AccessBatch returned wrong value for key " + std::to_string(keys[i]));
+        }
+      }
+    }
+
+    DataRow row;
+    row.add_column("k", k);
+    row.add_column("single_round_trips", 2 * k);
+    row.add_column("batch_round_trips", 2);
+    row.add_column("single_us_per_key", single_ns / 1e3 / rounds / k);
+    row.add_column("batch_us_per_key", batch_ns / 1e3 / rounds / k);
+    log.add_row(row);
+
+    spdlog::info("[BATCH] k={}: single={:.1f}us/key batch={:.1f}us/key",
+                 k, single_ns / 1e3 / rounds / k, batch_ns / 1e3 / rounds / k);
+  }
+}
+
+// Cost of a leaf draw: a random_device-seeded mt19937 per call (how leaves
+// used to be drawn) against the per-thread generator, one at a time and in
+// bulk.
+void bench_random(DataLog &log) {
+  const size_t draws = 1ULL << 16;
+  std::vector<Leaf> leaves(draws);
+  Stopwatch sw;
+  auto add_row = [&](const std::string &name, double ns) {
+    DataRow row;
+    row.add_column("source", name);
+    row.add_column("ns_per_leaf", ns / draws);
+    log.add_row(row);
+    spdlog::info("[RANDOM] {}: {:.1f} ns/leaf", name, ns / draws);
+  };
+
+  sw.start();
+  for (size_t i = 0; i < draws / 64; i++) {
+    std::random_device rd;
+    std::mt19937 gen(rd());
+    leaves[i] = std::uniform_int_distribution<uint64_t>(0, n - 1)(gen);
+  }
+  add_row("random_device_per_call", sw.elapsed_ns() * 64);
+
+  random_gen::FillRandomNumbers(leaves.data(), draws, n);  // warm-up
+  sw.start();
+  for (size_t i = 0; i < draws; i++) {
+    leaves[i] = random_gen::generateRandomNumber(n);
+  }
+  add_row("drbg", sw.elapsed_ns());
+
+  sw.start();
+  random_gen::FillRandomNumbers(leaves.data(), draws, n);
+  add_row("drbg_bulk", sw.elapsed_ns());
+}
+
+// Bucket crypto throughput for small blocks: the per-call utils::Encrypt /
+// Decrypt (a fresh CBC context per bucket) against the cipher engine sealing
+// a path at a time, in each mode. Also reports the bytes per sealed bucket.
+template <size_t BS>
+void bench_cipher(DataLog &log) {
+  const size_t len = PathORAMClient<BS>::BucketSize();
+  const size_t path = 15, rounds = 2000;
+  auto key = utils::GenerateKey();
+  common::BucketArena ser(len), enc(utils::CiphertextLen(len) + utils::kTagSize), dec(enc.slot_size());
+  auto ser_bufs = ser.acquire(path), enc_bufs = enc.acquire(path), dec_bufs = dec.acquire(path);
+  for (size_t k = 0; k < path; k++) {
+    std::memset(ser_bufs[k], static_cast<int>(k), len);
+  }
+
+  auto add_row = [&](const std::string &name, size_t sealed, double ns) {
+    DataRow row;
+    row.add_column("block_size", BS);
+    row.add_column("cipher", name);
+    row.add_column("sealed_bytes", sealed);
+    row.add_column("ns_per_bucket", ns / (rounds * path));
+    row.add_column("mb_per_s", 2.0 * len * rounds * path / ns * 1e3);
+    log.add_row(row);
+    spdlog::info("[CIPHER] B={} {}: {} bytes sealed, {:.0f} ns/bucket (seal + open)", BS, name, sealed,
+                 ns / (rounds * path));
+  };
+
+  Stopwatch sw;
+  sw.start();
+  for (size_t r = 0; r < rounds; r++) {
+    for (size_t k = 0; k < path; k++) {
+      if (!utils::Encrypt(ser_bufs[k], len, key, enc_bufs[k])
+          || utils::Decrypt(enc_bufs[k], utils::CiphertextLen(len), key, dec_bufs[k]) != len) {
+        throw std::runtime_error("Legacy cipher round trip failed");
+      }
+    }
+  }
+  add_row("legacy_cbc", utils::CiphertextLen(len), sw.elapsed_ns());
+
+  for (auto [mode, name] : {std::pair{utils::CipherMode::CBC, "cbc"}, std::pair{utils::CipherMode::CTR, "ctr"},
+                            std::pair{utils::CipherMode::GCM, "gcm"}}) {
+    utils::CipherEngine cipher(key, mode);
+    sw.start();
+    for (size_t r = 0; r < rounds; r++) {
+      if (!cipher.SealBatch(ser_bufs, len, enc_bufs)
+          || !cipher.OpenBatch(enc_bufs, cipher.SealedSize(len), len, dec_bufs)) {
+        throw std::runtime_error("Cipher engine round trip failed");
+      }
+    }
+    add_row(name, cipher.SealedSize(len), sw.elapsed_ns());
+  }
+}
+
+// Bytes moved between client and server per access (read + eviction,
+// amortized) and latency of the engines on the same data. Ring ORAM pays for
+// its metadata on every access, so it wins with larger blocks; Circuit ORAM
+// trades bandwidth (three path round trips) for a constant-size stash.
+template <size_t BS>
+void bench_engines(DataLog &log) {
+  using Ring = RingORAMClient<BS>;
+  auto key = utils::GenerateKey();
+  server::ServerConfig config;
+  config.type = server::ServerConfig::StorageType::Arena;
+  config.num_buckets = PathORAMClient<BS>::NumBuckets(n);
+  // Ring ORAM stores every bucket as Z + S slots, and its metadata apart
+  server::ServerConfig slot_config = config;
+  slot_config.num_buckets = config.num_buckets * (common::kDefaultZ + RingORAMParams().S);
+
+  std::vector<common::Block<BS>> blocks;
+  for (size_t i = 0; i < n; i++) {
+    blocks.push_back(common::Block<BS>(i, utils::GenRandBytes<BS>()));
+  }
+  std::vector<ORKey> keys(n_accesses);
+  for (auto &k : keys) {
+    k = random_gen::generateRandomNumber(n);
+  }
+
+  auto run = [&](const std::string &name, common::ORAMClient<BS> &oram, auto bytes_moved) {
+    auto init_blocks = blocks;
+    oram.Init(init_blocks);
+
+    size_t before = bytes_moved();
+    Stopwatch sw;
+    sw.start();
+    for (auto k : keys) {
+      common::Block<BS> data;
+      oram.Read(k, data);
+      oram.Evict();
+      if (std::memcmp(data.val, blocks[k].val, BS) != 0) {
+        throw std::runtime_error(name + " returned wrong value for key " + std::to_string(k));
+      }
+    }
+    double access_us = sw.elapsed_sec() * 1e6 / n_accesses;
+    size_t bytes = (bytes_moved() - before) / n_accesses;
+
+    DataRow row;
+    row.add_column("engine", name);
+    row.add_column("B", BS);
+    row.add_column("bytes_per_access", bytes);
+    row.add_column("access_us", access_us);
+    row.add_column("client_bytes", oram.ClientMemoryBytes());
+    log.add_row(row);
+
+    spdlog::info("[ENGINE] {} B={}: {} bytes/access, {:.1f}us/access, client_bytes={}",
+                 name, BS, bytes, access_us, oram.ClientMemoryBytes());
+  };
+
+  {
+    auto channel = std::make_shared<channel::PathORAMChannel<char *, PathORAMClient<BS>::EncryptedBucketSize()>>(config);
+    std::unique_ptr<PathORAMClient<BS>> oram(PathORAMClient<BS>::Construct(n, channel, key).value());
+    run("path", *oram, [&] { return channel->bytes_read() + channel->bytes_written(); });
+  }
+  if constexpr (!common::kIntegrity) {
+    auto channel = std::make_shared<channel::PathORAMChannel<char *, PathORAMClient<BS>::EncryptedBucketSize()>>(config);
+    std::unique_ptr<CircuitORAMClient<BS>> oram(CircuitORAMClient<BS>::Construct(n, channel, key).value());
+    run("circuit", *oram, [&] { return channel->bytes_read() + channel->bytes_written(); });
+  }
+  {
+    auto slots = std::make_shared<channel::PathORAMChannel<char *, Ring::EncryptedSlotSize()>>(slot_config);
+    auto meta = std::make_shared<channel::PathORAMChannel<char *, Ring::EncryptedMetaSize()>>(config);
+    std::unique_ptr<Ring> oram(Ring::Construct(n, slots, meta, key).value());
+    run("ring", *oram, [&] {
+      return slots->bytes_read() + slots->bytes_written() + meta->bytes_read() + meta->bytes_written();
+    });
+  }
+}
+
+// The in-memory server backends under the same accesses: per-bucket
+// allocations in a hash map against the preallocated arena (with and
+// without huge pages). Minor page faults are counted over the accesses,
+// after setup, when the client itself no longer allocates.
+void bench_storage(DataLog &log) {
+  auto key = utils::GenerateKey();
+  std::vector<common::Block<B>> blocks;
+  for (size_t i = 0; i < n; i++) {
+    blocks.push_back(common::Block<B>(i, random_gen::GenRandBytes<B>()));
+  }
+
+  struct StorageCase {
+    std::string name;
+    server::ServerConfig config;
+  };
+  const size_t num_buckets = PathORAMClient<B>::NumBuckets(n);
+  std::vector<StorageCase> cases = {
+      {"memory", {server::ServerConfig::StorageType::Memory, ""}},
+      {"arena", {server::ServerConfig::StorageType::Arena, "", num_buckets}},
+      {"arena-hugepages", {server::ServerConfig::StorageType::Arena, "", num_buckets, true}},
+  };
+  for (auto &c : cases) {
+    auto channel = std::make_shared<channel::PathORAMChannel<ExampleEncryptedBucket, ExampleEncryptedBucketSize>>(c.config);
+    std::unique_ptr<PathORAMClient<B>> oram(PathORAMClient<B>::Construct(n, channel, key).value());
+    auto init_blocks = blocks;
+    oram->Init(init_blocks);
+
+    common::Block<B> data;
+    struct rusage before, after;
+    getrusage(RUSAGE_SELF, &before);
+    Stopwatch sw;
+    sw.start();
+    for (size_t i = 0; i < 10 * n_accesses; i++) {
+      oram->Read(random_gen::generateRandomNumber(n), data);
+      oram->Evict();
+    }
+    double access_us = sw.elapsed_sec() * 1e6 / (10 * n_accesses);
+    getrusage(RUSAGE_SELF, &after);
+    double faults = static_cast<double>(after.ru_minflt - before.ru_minflt) / (10 * n_accesses);
+
+    DataRow row;
+    row.add_column("storage", c.name);
+    row.add_column("access_us", access_us);
+    row.add_column("faults_per_access", faults);
+    log.add_row(row);
+    spdlog::info("[STORAGE] {}: {:.1f}us/access, {:.2f} page faults/access", c.name, access_us, faults);
+  }
+}
+
+// The disk backend's layouts and sync policies: buffered I/O through the
+// page cache, the same with a data sync after every eviction, and the
+// O_DIRECT layout (which falls back to buffered I/O where the file system
+// has no direct I/O). Reports the time spent in the channel per access.
+void bench_disk(DataLog &log) {
+  auto key = utils::GenerateKey();
+  std::vector<common::Block<B>> blocks;
+  for (size_t i = 0; i < n; i++) {
+    blocks.push_back(common::Block<B>(i, random_gen::GenRandBytes<B>()));
+  }
+
+  struct DiskCase {
+    std::string name;
+    bool direct;
+    server::SyncPolicy sync;
+    server::ServerConfig::StorageType type = server::ServerConfig::StorageType::Disk;
+  };
+  std::vector<DiskCase> cases = {{"buffered", false, server::SyncPolicy::None},
+                                 {"buffered-sync", false, server::SyncPolicy::EveryWrite},
+                                 {"direct", true, server::SyncPolicy::None}};
+  cases.push_back({"mmap", false, server::SyncPolicy::None, server::ServerConfig::StorageType::Mmap});
+#ifdef ORAM_IO_URING
+  cases.push_back({"uring", false, server::SyncPolicy::None, server::ServerConfig::StorageType::Uring});
+  cases.push_back({"uring-direct", true, server::SyncPolicy::None, server::ServerConfig::StorageType::Uring});
+#endif
+  const std::string path = "/tmp/bench-disk-oram";
+  for (auto &c : cases) {
+    std::filesystem::remove(path);
+    server::ServerConfig config{c.type, path};
+    config.direct_io = c.direct;
+    config.sync = c.sync;
+    config.num_buckets = PathORAMClient<B>::NumBuckets(n);
+    auto channel = std::make_shared<channel::PathORAMChannel<ExampleEncryptedBucket, ExampleEncryptedBucketSize>>(config);
+    std::unique_ptr<PathORAMClient<B>> oram(PathORAMClient<B>::Construct(n, channel, key).value());
+    auto init_blocks = blocks;
+    oram->Init(init_blocks);
+
+    common::Block<B> data;
+    Stopwatch sw;
+    sw.start();
+    for (size_t i = 0; i < n_accesses; i++) {
+      oram->Read(random_gen::generateRandomNumber(n), data);
+      oram->Evict();
+    }
+    double access_us = sw.elapsed_sec() * 1e6 / n_accesses;
+    const auto &stats = oram->Stats();
+    double read_us = stats.channel_read.time_ns * 1e-3 / n_accesses;
+    double write_us = stats.channel_write.time_ns * 1e-3 / n_accesses;
+
+    DataRow row;
+    row.add_column("disk", c.name);
+    row.add_column("access_us", access_us);
+    row.add_column("channel_read_us", read_us);
+    row.add_column("channel_write_us", write_us);
+    log.add_row(row);
+    spdlog::info("[DISK] {}: {:.1f}us/access (channel read {:.1f}us, write {:.1f}us)", c.name, access_us, read_us,
+                 write_us);
+  }
+  std::filesystem::remove(path);
+}
+
+// Treetop caching: the top k levels stay decrypted on the client, so each
+// access moves l+1-k buckets instead of l+1 at the cost of 2^k-1 buckets of
+// client memory.
+void bench_treetop(DataLog &log) {
+  auto key = utils::GenerateKey();
+  server::ServerConfig config;
+  config.type = server::ServerConfig::StorageType::Arena;
+  config.num_buckets = PathORAMClient<B>::NumBuckets(n);
+
+  std::vector<common::Block<B>> blocks;
+  for (size_t i = 0; i < n; i++) {
+    blocks.push_back(common::Block<B>(i, random_gen::GenRandBytes<B>()));
+  }
+
+  for (size_t k : {0, 4, 8, 10, 12}) {
+    auto channel = std::make_shared<channel::PathORAMChannel<ExampleEncryptedBucket, ExampleEncryptedBucketSize>>(config);
+    std::unique_ptr<PathORAMClient<B>> oram(PathORAMClient<B>::Construct(n, channel, key, {}, k).value());
+    auto init_blocks = blocks;
+    oram->Init(init_blocks);
+
+    size_t before = channel->bytes_read() + channel->bytes_written();
+    Stopwatch sw;
+    sw.start();
+    for (size_t i = 0; i < n_accesses; i++) {
+      ORKey w = random_gen::generateRandomNumber(n);
+      common::Block<B> data;
+      oram->Read(w, data);
+      oram->Evict();
+      if (std::memcmp(data.val, blocks[w].val, B) != 0) {
+        throw std::runtime_error("Treetop k=" + std::to_string(k) + " returned wrong value for key " + std::to_string(w));
+      }
+    }
+    double access_us = sw.elapsed_sec() * 1e6 / n_accesses;
+    size_t bytes = (channel->bytes_read() + channel->bytes_written() - before) / n_accesses;
+
+    DataRow row;
+    row.add_column("k", k);
+    row.add_column("bytes_per_access", bytes);
+    row.add_column("access_us", access_us);
+    row.add_column("client_bytes", oram->ClientMemoryBytes());
+    log.add_row(row);
+
+    spdlog::info("[TREETOP] k={}: {} bytes/access, {:.1f}us/access, client_bytes={}",
+                 k, bytes, access_us, oram->ClientMemoryBytes());
+  }
+}
+
+// Per-bucket crypto of a path spread across a threadpool. With large blocks
+// AES dominates an access, so latency should drop with the number of threads
+// (on a machine with that many cores).
+void bench_parallel(DataLog &log) {
+  const size_t BL = 4096;
+  const size_t n_par = 1ULL << 12;
+  auto key = utils::GenerateKey();
+  server::ServerConfig config;
+  config.type = server::ServerConfig::StorageType::Arena;
+  config.num_buckets = PathORAMClient<BL>::NumBuckets(n_par);
+
+  std::vector<common::Block<BL>> blocks;
+  for (size_t i = 0; i < n_par; i++) {
+    blocks.push_back(common::Block<BL>(i, utils::GenRandBytes<BL>()));
+  }
+
+  for (size_t n_threads : {1, 2, 4}) {
+    // The pool's workers spin: more threads than cores only measures contention
+    if (n_threads > 1 && n_threads > std::thread::hardware_concurrency()) {
+      continue;
+    }
+    PThreadThreadpool threadpool(n_threads);
+    auto channel = std::make_shared<channel::PathORAMChannel<char *, PathORAMClient<BL>::EncryptedBucketSize()>>(config);
+    std::unique_ptr<PathORAMClient<BL>> oram(
+        PathORAMClient<BL>::Construct(n_par, channel, key, {}, 0, threadpool.get_context()).value());
+    auto init_blocks = blocks;
+    Stopwatch sw;
+    sw.start();
+    oram->Init(init_blocks);
+    double init_sec = sw.elapsed_sec();
+
+    sw.start();
+    for (size_t i = 0; i < n_accesses; i++) {
+      ORKey w = random_gen::generateRandomNumber(n_par);
+      common::Block<BL> data;
+      oram->Read(w, data);
+      oram->Evict();
+      if (std::memcmp(data.val, blocks[w].val, BL) != 0) {
+        throw std::runtime_error("Parallel client returned wrong value for key " + std::to_string(w));
+      }
+    }
+    double access_us = sw.elapsed_sec() * 1e6 / n_accesses;
+
+    DataRow row;
+    row.add_column("threads", n_threads);
+    row.add_column("B", BL);
+    row.add_column("init_sec", init_sec);
+    row.add_column("access_us", access_us);
+    oram->Stats().add_columns(row);
+    log.add_row(row);
+
+    spdlog::info("[PARALLEL] threads={} B={}: init={:.2f}s, {:.1f}us/access", n_threads, BL, init_sec, access_us);
+  }
+}
+
+// Sustained accesses on disk with eviction written in the background, which
+// overlaps the writes of access i with the reads of access i+1.
+void bench_background(DataLog &log) {
+  const size_t BL = 1024;
+  const size_t n_bg = 1ULL << 12;
+  if (std::thread::hardware_concurrency() < 2) {
+    spdlog::info("[BACKGROUND] skipped: needs a spare core for the eviction thread");
+    return;
+  }
+  auto key = utils::GenerateKey();
+  using Channel = channel::PathORAMChannel<char *, PathORAMClient<BL>::EncryptedBucketSize()>;
+  const std::string golden = "/tmp/bench-background-golden", golden_state = golden + ".state";
+  server::ServerConfig config;
+  config.type = server::ServerConfig::StorageType::Disk;
+  config.diskDirectory = "/tmp/bench-background-oram";
+
+  // Set up once; every run starts from a clone of the same initialized tree
+  {
+    std::filesystem::remove(golden);
+    std::vector<common::Block<BL>> blocks;
+    for (size_t i = 0; i < n_bg; i++) {
+      blocks.push_back(common::Block<BL>(i, utils::GenRandBytes<BL>()));
+    }
+    server::ServerConfig golden_config{server::ServerConfig::StorageType::Disk, golden};
+    std::unique_ptr<PathORAMClient<BL>> oram(
+        PathORAMClient<BL>::Construct(n_bg, std::make_shared<Channel>(golden_config), key).value());
+    oram->Init(blocks);
+    oram->Checkpoint(golden_state);
+  }
+
+  PThreadThreadpool threadpool(2);
+  for (bool background : {false, true}) {
+    Stopwatch restore_sw;
+    restore_sw.start();
+    common::CloneFile(golden, config.diskDirectory);
+    std::unique_ptr<PathORAMClient<BL>> oram(
+        PathORAMClient<BL>::Restore(golden_state, std::make_shared<Channel>(config), key).value());
+    double restore_ms = restore_sw.elapsed_sec() * 1e3;
+    if (background) {
+      oram->EnableBackgroundEviction(threadpool.get_context());
+    }
+
+    Stopwatch sw;
+    sw.start();
+    for (size_t i = 0; i < n_accesses; i++) {
+      common::Block<BL> data;
+      oram->Read(random_gen::generateRandomNumber(n_bg), data);
+      oram->Evict();
+    }
+    double access_us = sw.elapsed_sec() * 1e6 / n_accesses;
+
+    DataRow row;
+    row.add_column("background", background);
+    row.add_column("B", BL);
+    row.add_column("restore_ms", restore_ms);
+    row.add_column("access_us", access_us);
+    row.add_column("ops_per_sec", 1e6 / access_us);
+    log.add_row(row);
+
+    spdlog::info("[BACKGROUND] background={} B={}: restore={:.1f}ms, {:.1f}us/access", background, BL, restore_ms,
+                 access_us);
+  }
+  for (const auto &f : {golden, golden_state, config.diskDirectory}) {
+    std::filesystem::remove(f);
+  }
+}
+
+int main(int argc, char **argv) {
+  DataLog pos_map_log("pos_map");
+  bench_position_maps(pos_map_log);
+
+  DataLog eviction_log("eviction");
+  bench_eviction(eviction_log);
+
+  DataLog batch_log("batch");
+  bench_batch(batch_log);
+
+  DataLog random_log("random");
+  bench_random(random_log);
+
+  DataLog cipher_log("cipher");
+  bench_cipher<8>(cipher_log);
+  bench_cipher<64>(cipher_log);
+
+  DataLog engine_log("engine");
+  bench_engines<B>(engine_log);
+  bench_engines<1024>(engine_log);
+
+  DataLog storage_log("storage");
+  bench_storage(storage_log);
+
+  DataLog disk_log("disk");
+  bench_disk(disk_log);
+
+  DataLog treetop_log("treetop");
+  bench_treetop(treetop_log);
+
+  DataLog parallel_log("parallel");
+  bench_parallel(parallel_log);
+
+  DataLog background_log("background");
+  bench_background(background_log);
+
+  for (auto *log : {&pos_map_log, &eviction_log, &batch_log, &random_log, &cipher_log, &engine_log, &storage_log,
+                    &disk_log, &treetop_log, &parallel_log, &background_log}) {
+    // A benchmark skipped on this machine leaves its log empty
+    if (log->empty()) {
+      continue;
+    }
+    std::cout << log->to_string();
+    if (argc > 1) {
+      log->save_to(std::string(argv[1]) + "/" + log->name + ".csv");
+    }
+  }
+  return 0;
+}
@@ -6,6 +6,7 @@
 #include <spdlog/spdlog.h>
 
 #include "oram/path_oram/path_oram.hpp"
+#include "oram/circuit_oram/circuit_oram.hpp"
 #include "server/channel.hpp"
 #include "server/server.hpp"
 #include "pthread_threadpool.hpp"
@@ -24,7 +25,13 @@ const size_t n_threads = 4;
 using ExampleEncryptedBucket = char *;
 using ExampleBucket = common::Bucket<B>;
 using ExampleBlock = common::Block<B>;
-const size_t ExampleEncryptedBucketSize = PathORAMClient<B>::EncryptedBucketSize();
+// The same harness runs against every engine sharing PathORAMClient's channel
+#ifdef TEST_CIRCUIT_ORAM
+using TestORAM = CircuitORAMClient<B>;
+#else
+using TestORAM = PathORAMClient<B>;
+#endif
+const size_t ExampleEncryptedBucketSize = TestORAM::EncryptedBucketSize();
 
 int main(int argc, char **argv) {
   // Configuration of the test
@@ -53,13 +60,28 @@ int main(int argc, char **argv) {
   std::shared_ptr<channel::PathORAMChannel<ExampleEncryptedBucket, ExampleEncryptedBucketSize>>
       channel = std::make_shared<channel::PathORAMChannel<ExampleEncryptedBucket, ExampleEncryptedBucketSize>>(config);
 
-  std::optional<PathORAMClient<B> *> opt_oram = PathORAMClient<B>::Construct(n, std::move(channel), key);
+#ifdef TEST_CIRCUIT_ORAM
+  // Circuit ORAM does not authenticate its buckets
+  if constexpr (common::kIntegrity) {
+    bool refused = false;
+    try {
+      TestORAM::Construct(n, channel, key);
+    } catch (const std::logic_error &) {
+      refused = true;
+    }
+    assert(refused);
+    spdlog::info("Circuit ORAM is not available with ORAM_INTEGRITY");
+    return 0;
+  }
+#endif
+
+  std::optional<TestORAM *> opt_oram = TestORAM::Construct(n, channel, key);
   if (!opt_oram.has_value()) {
     std::cerr << "Failed to initialize ORAM" << std::endl;
     return 1;
   }
 
-  PathORAMClient<B> *oram = opt_oram.value();
+  TestORAM *oram = opt_oram.value();
   std::vector<common::Block<B>> blocks;
   for (size_t i = 0; i < n; i++) {
     blocks.push_back(common::Block(i, random_gen::GenRandBytes<B>()));
@@ -79,6 +101,46 @@ int main(int argc, char **argv) {
     spdlog::info("Evicting after Read");
     assert(data.key == blocks[0].key);
     assert(std::memcmp(data.val, blocks[0].val, B) == 0);
+
+    // Batched accesses see each other's writes in order
+    std::vector<ORKey> keys = {3, 7, 3, 9, 7};
+    std::vector<AccessOp> ops = {AccessOp::Read, AccessOp::Write, AccessOp::Write, AccessOp::Read, AccessOp::Read};
+    std::vector<common::Block<B>> batch(keys.size());
+    std::memset(batch[1].val, 0x77, B);
+    std::memset(batch[2].val, 0x33, B);
+    oram->AccessBatch(keys, ops, batch);
+    assert(batch[0].key == 3 && std::memcmp(batch[0].val, blocks[3].val, B) == 0);
+    assert(batch[3].key == 9 && std::memcmp(batch[3].val, blocks[9].val, B) == 0);
+    assert(batch[4].key == 7 && batch[4].val[0] == 0x77);
+
+    oram->Read(3, data);
+    oram->Evict();
+    assert(data.key == 3 && data.val[0] == 0x33 && data.val[B - 1] == 0x33);
+
+#ifndef TEST_CIRCUIT_ORAM
+    // Three accesses since Init: every bucket read was decrypted, every
+    // bucket written encrypted
+    const auto &stats = oram->Stats();
+    spdlog::info("Access stats:\n{}", stats.summary());
+    assert(stats.path_compute.count == 3 && stats.stash_size.count == 3);
+    assert(stats.buckets_read.count == 3 && stats.buckets_written.count == 3);
+    assert(stats.decrypt.count == stats.buckets_read.total_value);
+    assert(stats.encrypt.count == stats.buckets_written.total_value);
+    assert(stats.bytes_read.total_value == stats.buckets_read.total_value * ExampleEncryptedBucketSize);
+    assert(stats.stash_size.max_value <= 2 * common::kDefaultZ * std::bit_width(n - 1));
+    DataRow stats_row;
+    stats.add_columns(stats_row);
+    assert(stats_row.column_names.size() == 2 * (std::size(stats.kTimings) + std::size(stats.kNumbers)));
+    oram->ResetStats();
+    assert(stats.path_compute.count == 0 && stats.bytes_written.total_value == 0);
+#endif
+
+    // A key outside the position map reads nothing but still costs a path
+    std::vector<common::Block<B>> missing(1);
+    size_t read_before = channel->bytes_read(), written_before = channel->bytes_written();
+    oram->AccessBatch({ORKey(n)}, {AccessOp::Read}, missing);
+    assert(missing[0].key == static_cast<ORKey>(-1));
+    assert(channel->bytes_read() > read_before && channel->bytes_written() > written_before);
     
     // Clean up using quotes to handle spaces in path
     int result_code = system(("rm -rf \"" + storage_path + "\"").c_str());
@@ -105,6 +167,157 @@ int main(int argc, char **argv) {
     // Clean up using quotes to handle spaces in path
     int result_code = system(("rm -rf \"" + storage_path + "\"").c_str());
     spdlog::info("Removing test-path-oram files with result code {}", result_code);
+
+#ifndef TEST_CIRCUIT_ORAM
+    // With a seed, the tree does not depend on the number of threads: the
+    // same blocks give the same buckets (under fresh nonces, so compared
+    // after decryption)
+    server::ServerConfig mem_config;
+    mem_config.type = server::ServerConfig::StorageType::Arena;
+    mem_config.num_buckets = PathORAMClient<B>::NumBuckets(n);
+    using Channel = channel::PathORAMChannel<ExampleEncryptedBucket, ExampleEncryptedBucketSize>;
+    std::vector<std::shared_ptr<Channel>> channels;
+    std::vector<TestORAM *> seeded;
+    for (size_t threads : {size_t(1), n_threads}) {
+      channels.push_back(std::make_shared<Channel>(mem_config));
+      seeded.push_back(TestORAM::Construct(n, channels.back(), key).value());
+      seeded.back()->ParInit(threads > 1 ? threadpool.get_context() : nullptr, blocks, threads, 42);
+    }
+    std::vector<ORBucketID> ids;
+    for (ORBucketID id = 0; id < 2 * n - 1; id++) {
+      ids.push_back(id);
+    }
+    common::BucketArena bufs[2] = {common::BucketArena(ExampleEncryptedBucketSize),
+                                   common::BucketArena(ExampleEncryptedBucketSize)};
+    for (size_t c = 0; c < 2; c++) {
+      channels[c]->read_buckets(std::span<const ORBucketID>(ids), bufs[c].acquire(ids.size()));
+    }
+    utils::CipherEngine cipher(key);
+    common::BucketArena plain[2] = {common::BucketArena(TestORAM::BucketSize()),
+                                    common::BucketArena(TestORAM::BucketSize())};
+    for (size_t c = 0; c < 2; c++) {
+      assert(cipher.OpenBatch(bufs[c].acquire(ids.size()), ExampleEncryptedBucketSize, TestORAM::BucketSize(),
+                              plain[c].acquire(ids.size())));
+    }
+    for (size_t i = 0; i < ids.size(); i++) {
+      assert(std::memcmp(plain[0][i], plain[1][i], TestORAM::BucketSize()) == 0);
+    }
+    for (auto *o : seeded) {
+      o->Read(5, data);
+      o->Evict();
+      assert(data.key == 5 && std::memcmp(data.val, blocks[5].val, B) == 0);
+      delete o;
+    }
+
+    // Background eviction: same results and the same buckets per access,
+    // also when the stash budget forces synchronous evictions
+    const size_t path_bytes = (std::bit_width(n - 1) + 1) * ExampleEncryptedBucketSize;
+    PThreadThreadpool evict_pool(2);
+    for (size_t budget : {size_t(0), size_t(1)}) {
+      auto bg_channel = std::make_shared<Channel>(mem_config);
+      auto *bg = TestORAM::Construct(n, bg_channel, key).value();
+      bg->Init(blocks);
+      bg->EnableBackgroundEviction(evict_pool.get_context(), budget);
+      std::map<ORKey, uint8_t> expected;
+      for (size_t k = 0; k < n; k++) {
+        expected[k] = blocks[k].val[0];
+      }
+
+      size_t read_before = bg_channel->bytes_read(), written_before = bg_channel->bytes_written();
+      const size_t accesses = 40;
+      for (size_t i = 0; i < accesses; i++) {
+        ORKey k = random_gen::generateRandomNumber(n);
+        if (i % 2 == 0) {
+          std::vector<common::Block<B>> batch(1);
+          std::memset(batch[0].val, static_cast<int>(i), B);
+          bg->AccessBatch({k}, {AccessOp::Write}, batch);
+          expected[k] = static_cast<uint8_t>(i);
+        } else {
+          bg->Read(k, data);
+          bg->Evict();
+          assert(data.key == k && data.val[0] == expected[k]);
+        }
+      }
+      delete bg;
+      assert(bg_channel->bytes_read() - read_before == accesses * path_bytes);
+      assert(bg_channel->bytes_written() - written_before == accesses * path_bytes);
+    }
+
+    // Checkpoint and restart: a client restored over a clone of the disk
+    // image sees the same contents, without running setup
+    const auto tmp = std::filesystem::temp_directory_path();
+    const std::string image = tmp / "test-ckpt-image", state = tmp / "test-ckpt-state";
+    const std::string clone_image = tmp / "test-ckpt-image-clone", clone_state = tmp / "test-ckpt-state-clone";
+    for (const auto &f : {image, state, clone_image, clone_state}) {
+      std::filesystem::remove(f);
+    }
+    server::ServerConfig image_config{server::ServerConfig::StorageType::Disk, image};
+    server::ServerConfig clone_config{server::ServerConfig::StorageType::Disk, clone_image};
+    auto *golden = TestORAM::Construct(n, std::make_shared<Channel>(image_config), key, {}, 2).value();
+    golden->Init(blocks);
+    std::vector<common::Block<B>> update(1);
+    std::memset(update[0].val, 0x5C, B);
+    golden->AccessBatch({17}, {AccessOp::Write}, update);
+    golden->Checkpoint(state);
+    delete golden;
+
+    common::CloneFile(image, clone_image);
+    common::CloneFile(state, clone_state);
+    auto *restored = TestORAM::Restore(clone_state, std::make_shared<Channel>(clone_config), key).value();
+    assert(restored->TreetopLevels() == 2);
+    for (ORKey k : {ORKey(0), ORKey(17), ORKey(n - 1)}) {
+      restored->Read(k, data);
+      restored->Evict();
+      assert(data.key == k && data.val[0] == (k == 17 ? 0x5C : blocks[k].val[0]));
+    }
+    delete restored;
+
+    // Another key, or an image of other buckets, is refused
+    assert(!TestORAM::Restore(state, std::make_shared<Channel>(image_config), utils::GenerateKey()).has_value());
+    bool refused = false;
+    try {
+      channel::PathORAMChannel<ExampleEncryptedBucket, ExampleEncryptedBucketSize + 16> other(image_config);
+    } catch (const std::runtime_error &) {
+      refused = true;
+    }
+    assert(refused);
+    for (const auto &f : {image, state, clone_image, clone_state}) {
+      std::filesystem::remove(f);
+    }
+
+#ifdef ORAM_INTEGRITY
+    // The server replays a stale root, or moves the leaf buckets around: the
+    // next access notices (every bucket still decrypts)
+    for (bool replay : {true, false}) {
+      auto tampered = std::make_shared<Channel>(mem_config);
+      auto *victim = TestORAM::Construct(n, tampered, key).value();
+      victim->Init(blocks);
+      common::BucketArena saved(ExampleEncryptedBucketSize);
+      std::vector<ORBucketID> targets;
+      for (ORBucketID id = replay ? 0 : n - 1; id < (replay ? 1 : 2 * n - 1); id++) {
+        targets.push_back(id);
+      }
+      auto bufs = saved.acquire(targets.size());
+      tampered->read_buckets(std::span<const ORBucketID>(targets), bufs);
+      if (replay) {
+        victim->Read(1, data);
+        victim->Evict();
+      } else {
+        std::rotate(targets.begin(), targets.begin() + 1, targets.end());
+      }
+      tampered->write_buckets(std::span<const ORBucketID>(targets), bufs);
+      bool detected = false;
+      try {
+        victim->Read(2, data);
+      } catch (const std::runtime_error &e) {
+        spdlog::info("Tampering detected: {}", e.what());
+        detected = true;
+      }
+      assert(detected);
+      delete victim;
+    }
+#endif
+#endif
   }
 
   return 0;
@@ -0,0 +1,85 @@
+#include <cassert>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <vector>
+#include <spdlog/spdlog.h>
+
+#include "oram/ring_oram/ring_oram.hpp"
+#include "server/channel.hpp"
+#include "server/server.hpp"
+#include "stopwatch.hpp"
+
+const size_t B = 8;
+const size_t n = 1000;  // Not a power of two on purpose
+const size_t n_accesses = 2000;
+
+using Ring = RingORAMClient<B>;
+
+int main(int argc, char **argv) {
+  auto key = utils::GenerateKey();
+  server::ServerConfig config;
+  config.type = server::ServerConfig::StorageType::Memory;
+
+  auto slots = std::make_shared<channel::PathORAMChannel<char *, Ring::EncryptedSlotSize()>>(config);
+  auto meta = std::make_shared<channel::PathORAMChannel<char *, Ring::EncryptedMetaSize()>>(config);
+  std::optional<Ring *> opt_oram = Ring::Construct(n, slots, meta, key);
+  if (!opt_oram.has_value()) {
+    std::cerr << "Failed to initialize Ring ORAM" << std::endl;
+    return 1;
+  }
+  Ring *oram = opt_oram.value();
+
+  std::vector<common::Block<B>> blocks;
+  std::map<ORKey, uint8_t> expected;
+  for (size_t i = 0; i < n; i++) {
+    blocks.push_back(common::Block<B>(i, random_gen::GenRandBytes<B>()));
+    expected[i] = blocks.back().val[0];
+  }
+
+  Stopwatch sw;
+  sw.start();
+  oram->Init(blocks);
+  spdlog::info("Init took {} seconds", sw.elapsed_sec());
+
+  // Random reads and writes against a reference map
+  size_t max_stash = 0;
+  sw.start();
+  for (size_t i = 0; i < n_accesses; i++) {
+    ORKey k = random_gen::generateRandomNumber(n);
+    std::vector<common::Block<B>> data(1);
+    AccessOp op = (i % 3 == 0) ? AccessOp::Write : AccessOp::Read;
+    if (op == AccessOp::Write) {
+      std::memset(data[0].val, static_cast<int>(i & 0xFF), B);
+      expected[k] = i & 0xFF;
+    }
+    oram->AccessBatch({k}, {op}, data);
+    if (op == AccessOp::Read) {
+      assert(data[0].key == k);
+      assert(data[0].val[0] == expected[k]);
+    }
+    max_stash = std::max(max_stash, oram->StashSize());
+  }
+  spdlog::info("{} accesses took {} seconds, max stash size {}", n_accesses, sw.elapsed_sec(), max_stash);
+
+  // A key outside the position map reads nothing but still fetches a path
+  const size_t path_meta_bytes = (std::ceil(std::log2(n)) + 1) * Ring::EncryptedMetaSize();
+  for (size_t i = 0; i < 2 * RingORAMParams().A; i++) {
+    size_t read_before = meta->bytes_read();
+    std::vector<common::Block<B>> data(1);
+    oram->AccessBatch({ORKey(n)}, {AccessOp::Read}, data);
+    assert(data[0].key == static_cast<ORKey>(-1));
+    assert(meta->bytes_read() - read_before >= path_meta_bytes);
+  }
+
+  // Every block is still reachable through the Read/Evict surface
+  for (size_t k = 0; k < n; k++) {
+    common::Block<B> data;
+    oram->Read(k, data);
+    oram->Evict();
+    assert(data.key == k && data.val[0] == expected[k]);
+  }
+
+  std::cout << "[PASSED] Ring ORAM" << std::endl;
+  return 0;
+}
@@ -4,8 +4,11 @@
 #include <cassert>
 #include <iostream>
 #include <map>
+#include <functional>
+#include <thread>
 #include <array>  // Added for std::array
 #include <iomanip> // Added for std::setw, std::setfill
+#include <sys/resource.h>
 
 #include "oram/path_oram/path_oram.hpp"
 #include "server/server.hpp"
@@ -41,8 +44,9 @@ void microbenchmark_block_move() {
   // Move block
   ExampleBlock moved = std::move(block);
 
-  // Verify data
-  assert(block.key == 0);  // 2^32 - 1, thats the value of -1 in uint32_t
+  // Verify data: blocks are trivially copyable, moving copies
+  static_assert(std::is_trivially_copyable_v<ExampleBlock>);
+  assert(block.key == 33);
   assert(std::memcmp(moved.val, temp, B) == 0);
   assert(moved.key == 33);
 
@@ -83,8 +87,8 @@ void microbenchmarks_bucket() {
   bucket.flags_ = 2;
   bucket.blocks_[0].key = b1.key;
   bucket.blocks_[1].key = b2.key;
-  std::memcpy(bucket.blocks_[0].val, b1.val, PathORAMClient<B>::BlockSize());
-  std::memcpy(bucket.blocks_[1].val, b2.val, PathORAMClient<B>::BlockSize());
+  std::memcpy(bucket.blocks_[0].val, b1.val, B);
+  std::memcpy(bucket.blocks_[1].val, b2.val, B);
   // Serialize bucket
   char *buf =
       (char *)malloc(PathORAMClient<B>::EncryptedBucketSize() * sizeof(char));
@@ -106,6 +110,145 @@ void microbenchmarks_bucket() {
   std::cout << "[PASSED] Bucket Serialization" << std::endl;
 }
 
+void test_stash() {
+  common::Stash<B> stash;
+  for (uint32_t k = 0; k < 100; k++) {
+    ExampleBlock b;
+    b.key = k;
+    std::memset(b.val, k, B);
+    stash.insert(b);
+  }
+  assert(stash.size() == 100);
+
+  // Swap-remove keeps the index of the moved block valid
+  assert(stash.erase(10));
+  assert(!stash.erase(10));
+  assert(stash.find(10) == nullptr);
+  assert(stash.find(99) != nullptr && stash.find(99)->val[0] == 99);
+
+  // Re-inserting a key replaces its block
+  ExampleBlock b;
+  b.key = 5;
+  std::memset(b.val, 0xCC, B);
+  stash.insert(b);
+  assert(stash.size() == 99);
+  assert(stash.find(5)->val[0] == 0xCC);
+
+  // Take every even key, compact the rest
+  std::vector<size_t> keep;
+  for (size_t slot = 0; slot < stash.size(); slot++) {
+    if (stash[slot].key % 2 == 0) {
+      ExampleBlock taken = stash.take(slot);
+      assert(taken.key % 2 == 0);
+    } else {
+      keep.push_back(slot);
+    }
+  }
+  stash.compact(keep);
+  assert(stash.size() == 50);
+  for (uint32_t k = 0; k < 100; k++) {
+    auto *found = stash.find(k);
+    assert((found != nullptr) == (k % 2 == 1));
+    assert(stash.scan(k) == found);
+    if (found) {
+      assert(found->key == k && found->val[0] == (k == 5 ? 0xCC : k));
+    }
+  }
+
+  // Random churn against a reference map (exercises the index's deletions)
+  std::map<uint32_t, uint8_t> ref;
+  stash.clear();
+  for (size_t i = 0; i < 20000; i++) {
+    uint32_t k = random_gen::generateRandomNumber(512);
+    if (i % 3 == 0) {
+      assert(stash.erase(k) == (ref.erase(k) == 1));
+    } else {
+      ExampleBlock nb;
+      nb.key = k;
+      nb.val[0] = i & 0xFF;
+      stash.insert(nb);
+      ref[k] = i & 0xFF;
+    }
+  }
+  assert(stash.size() == ref.size());
+  for (uint32_t k = 0; k < 512; k++) {
+    auto *found = stash.find(k);
+    assert((found != nullptr) == ref.count(k));
+    assert(stash.scan(k) == found);
+    assert(!found || found->val[0] == ref[k]);
+  }
+
+  std::cout << "[PASSED] Stash" << std::endl;
+}
+
+void test_bucket_arena() {
+  common::BucketArena arena(PathORAMClient<B>::EncryptedBucketSize());
+  auto bufs = arena.acquire(8);
+  assert(bufs.size() == 8 && arena.capacity() == 8);
+  for (size_t i = 0; i < bufs.size(); i++) {
+    std::memset(bufs[i], static_cast<int>(i), arena.slot_size());
+  }
+
+  // Smaller requests reuse the same buffers
+  auto again = arena.acquire(3);
+  assert(again.data() == bufs.data() && again[2][arena.slot_size() - 1] == 2);
+
+  // Growing keeps the contents
+  auto grown = arena.acquire(32);
+  assert(grown.size() == 32 && grown[7][0] == 7);
+
+  std::cout << "[PASSED] BucketArena" << std::endl;
+}
+
+// Every kernel against the obvious loop, across the vector/tail boundaries.
+// 64-bit keys that agree in their low half must still differ.
+template <typename T>
+void check_simd_kernels() {
+  auto widen = [](uint64_t v) { return static_cast<T>(sizeof(T) == 8 ? (v % 16) | ((v / 16) << 32) : v); };
+  for (size_t n = 0; n <= 70; n++) {
+    std::vector<T> keys(n), acc(n), ref(n);
+    for (size_t i = 0; i < n; i++) {
+      keys[i] = widen(random_gen::generateRandomNumber(32));
+      acc[i] = ref[i] = widen(random_gen::generateRandomNumber(1 << 20));
+    }
+    for (uint64_t v = 0; v < 33; v++) {
+      T key = widen(v);
+      size_t first = std::find(keys.begin(), keys.end(), key) - keys.begin();
+      assert(common::simd::find(keys.data(), n, key) == first);
+      assert(common::simd::find_all(keys.data(), n, key) == first);
+      if (n <= 64) {
+        uint64_t mask = 0;
+        for (size_t i = 0; i < n; i++) {
+          mask |= static_cast<uint64_t>(keys[i] == key) << i;
+        }
+        assert(common::simd::eq_mask(keys.data(), n, key) == mask);
+      }
+    }
+    const T y = widen(21);
+    common::simd::min_xor(keys.data(), n, y, acc.data());
+    for (size_t i = 0; i < n; i++) {
+      assert(acc[i] == std::min<T>(ref[i], keys[i] ^ y));
+    }
+  }
+}
+
+void test_simd_scan() {
+  check_simd_kernels<uint32_t>();
+  check_simd_kernels<uint64_t>();
+
+  // Bucket::find only sees the real blocks
+  ExampleBucket bucket;
+  for (size_t k = 0; k < common::kDefaultZ; k++) {
+    bucket.blocks_[k].key = 10 + k;
+  }
+  bucket.flags_ = 2;
+  assert(bucket.find(11) == 1);
+  assert(bucket.find(12) == -1);
+  assert(bucket.find(7) == -1);
+
+  std::cout << "[PASSED] SIMD scans" << std::endl;
+}
+
 void test_memory_storage() {
   auto key = utils::GenerateKey();
   // Configure server for memory storage
@@ -138,8 +281,8 @@ void test_memory_storage() {
   bu.serialize(bu_ser);
   char *en_bu =
       (char *)malloc(PathORAMClient<B>::EncryptedBucketSize() * sizeof(char));
-  auto success =
-      utils::Encrypt(bu_ser, PathORAMClient<B>::BucketSize(), key, en_bu);
+  utils::CipherEngine cipher(key);
+  auto success = cipher.Seal(bu_ser, PathORAMClient<B>::BucketSize(), en_bu);
   if (!success) {
     std::cerr << "[MEMORY] Encryption failed!" << std::endl;
     return;
@@ -163,8 +306,7 @@ void test_memory_storage() {
 
   // Verify Bucket data
   char *dec_bu = (char *)malloc(PathORAMClient<B>::BucketSize() * sizeof(char));
-  auto plen = utils::Decrypt(
-      retrieved, PathORAMClient<B>::EncryptedBucketSize(), key, dec_bu);
+  auto plen = cipher.Open(retrieved, PathORAMClient<B>::EncryptedBucketSize(), dec_bu);
   ExampleBucket verificator;
   verificator.deserialize(dec_bu);
   assert(plen == PathORAMClient<B>::BucketSize());
@@ -176,6 +318,446 @@ void test_memory_storage() {
   std::cout << "[PASSED] Memory Storage Test" << std::endl;
 }
 
+// The arena holds exactly the buckets of the tree, reads them back in bulk
+// and takes no page faults once constructed (with or without huge pages).
+void test_arena_storage() {
+  constexpr size_t EBS = PathORAMClient<B>::EncryptedBucketSize();
+  const size_t n = 1 << 10;
+  const size_t num_buckets = PathORAMClient<B>::NumBuckets(n);
+  assert(num_buckets == 2 * n - 1 && PathORAMClient<B>::NumBuckets(n + 1) == 4 * n - 1);
+
+  for (bool huge : {false, true}) {
+    ArenaStorage<ExampleEncryptedBucket, EBS> arena(num_buckets, huge);
+    std::vector<ORBucketID> ids = {ORBucketID(num_buckets - 1), 6, 2, 0};
+    std::vector<std::vector<char>> in(ids.size(), std::vector<char>(EBS)), out(ids.size(), std::vector<char>(EBS));
+    std::vector<char *> in_ptrs, out_ptrs;
+    for (size_t i = 0; i < ids.size(); i++) {
+      std::memset(in[i].data(), static_cast<int>(i + 1), EBS);
+      in_ptrs.push_back(in[i].data());
+      out_ptrs.push_back(out[i].data());
+    }
+
+    struct rusage before, after;
+    getrusage(RUSAGE_THREAD, &before);
+    for (size_t round = 0; round < 100; round++) {
+      arena.write_buckets(std::span<const ORBucketID>(ids), std::span<char *const>(in_ptrs));
+      arena.read_buckets(std::span<const ORBucketID>(ids), std::span<char *const>(out_ptrs));
+    }
+    getrusage(RUSAGE_THREAD, &after);
+    assert(after.ru_minflt == before.ru_minflt);
+    for (size_t i = 0; i < ids.size(); i++) {
+      assert(std::memcmp(in[i].data(), out[i].data(), EBS) == 0);
+    }
+
+    // Unwritten slots read as zeros; ids past the tree are refused
+    arena.read_bucket(1, out_ptrs[0]);
+    assert(std::all_of(out[0].begin(), out[0].end(), [](char c) { return c == 0; }));
+    bool refused = false;
+    try {
+      arena.read_bucket(ORBucketID(num_buckets), out_ptrs[0]);
+    } catch (const std::out_of_range &) {
+      refused = true;
+    }
+    assert(refused);
+
+    // A null buffer in a batch is refused before any slot is touched
+    std::vector<char *> with_null = in_ptrs;
+    with_null[2] = nullptr;
+    std::memset(in[0].data(), 0x7f, EBS);
+    refused = false;
+    try {
+      arena.write_buckets(std::span<const ORBucketID>(ids), std::span<char *const>(with_null));
+    } catch (const std::invalid_argument &) {
+      refused = true;
+    }
+    assert(refused);
+    arena.read_bucket(ids[0], out_ptrs[0]);
+    assert(out[0][0] == 1);
+    refused = false;
+    try {
+      arena.read_buckets(std::span<const ORBucketID>(ids), std::span<char *const>(with_null));
+    } catch (const std::invalid_argument &) {
+      refused = true;
+    }
+    assert(refused);
+  }
+
+  // Through the server config, as the clients' channels build it
+  ServerConfig config{ServerConfig::StorageType::Arena, "", num_buckets};
+  StorageServer<ExampleEncryptedBucket, EBS> server(config);
+  std::vector<char> buf(EBS, 0x42), back(EBS);
+  server.write_bucket(ORBucketID(num_buckets - 1), buf.data());
+  server.read_bucket(ORBucketID(num_buckets - 1), back.data());
+  assert(buf == back);
+  std::cout << "[PASSED] Arena Storage Test" << std::endl;
+}
+
+// Bounded draws stay in range and are unbiased enough to fill every bucket
+// of a small histogram evenly; a seed makes the streams repeat, per thread.
+void test_random_gen() {
+  const uint64_t bound = 3;
+  const size_t draws = 30000;
+  size_t hist[bound] = {};
+  for (size_t i = 0; i < draws; i++) {
+    hist[random_gen::generateRandomNumber(bound)]++;
+  }
+  for (size_t h : hist) {
+    assert(h > draws / bound * 9 / 10 && h < draws / bound * 11 / 10);
+  }
+  std::vector<Leaf> leaves(1000);
+  random_gen::FillRandomNumbers(leaves.data(), leaves.size(), 5, 7);
+  assert(std::all_of(leaves.begin(), leaves.end(), [](Leaf l) { return l >= 7 && l < 12; }));
+  assert(random_gen::generateRandomNumber(1) == 0);
+
+  auto draw = [] {
+    std::vector<uint64_t> v(600);  // crosses a refill of the generator
+    for (auto &x : v) {
+      x = random_gen::Random64();
+    }
+    return v;
+  };
+  random_gen::SetSeed(42);
+  auto first = draw();
+  std::vector<uint64_t> other;
+  std::thread([&] { other = draw(); }).join();
+  random_gen::SetSeed(42);
+  assert(draw() == first);
+  std::vector<uint64_t> again;
+  std::thread([&] { again = draw(); }).join();
+  assert(again == other && other != first);
+  random_gen::ClearSeed();
+  assert(draw() != first);
+  std::cout << "[PASSED] Random Generator Test" << std::endl;
+}
+
+// Every mode opens what it sealed, in single and batch calls and from other
+// threads; nonces make two seals of the same bucket differ; GCM refuses a
+// flipped bit and another key; CBC stays readable by utils::Decrypt.
+void test_cipher_engine() {
+  const size_t len = PathORAMClient<B>::BucketSize();
+  auto key = utils::GenerateKey();
+  std::vector<char> plain(len);
+  for (size_t i = 0; i < len; i++) {
+    plain[i] = static_cast<char>(i * 7);
+  }
+
+  for (auto mode : {utils::CipherMode::CBC, utils::CipherMode::CTR, utils::CipherMode::GCM}) {
+    utils::CipherEngine cipher(key, mode);
+    const size_t sealed = cipher.SealedSize(len);
+    std::vector<char> a(sealed), b(sealed), out(sealed);
+    assert(cipher.Seal(plain.data(), len, a.data()) && cipher.Seal(plain.data(), len, b.data()));
+    assert(std::memcmp(a.data(), b.data(), sealed) != 0);
+    assert(cipher.Open(a.data(), sealed, out.data()) == len && std::memcmp(out.data(), plain.data(), len) == 0);
+    if (mode == utils::CipherMode::CBC) {
+      assert(utils::Decrypt(a.data(), sealed, key, out.data()) == len);
+    }
+
+    const size_t count = 9;
+    common::BucketArena ser(len), enc(sealed), dec(sealed);
+    auto ser_bufs = ser.acquire(count), enc_bufs = enc.acquire(count), dec_bufs = dec.acquire(count);
+    for (size_t k = 0; k < count; k++) {
+      std::memcpy(ser_bufs[k], plain.data(), len);
+      ser_bufs[k][0] = static_cast<char>(k);
+    }
+    assert(cipher.SealBatch(ser_bufs, len, enc_bufs));
+    bool opened = false;
+    std::thread([&] { opened = cipher.OpenBatch(enc_bufs, sealed, len, dec_bufs); }).join();
+    assert(opened);
+    for (size_t k = 0; k < count; k++) {
+      assert(std::memcmp(dec_bufs[k], ser_bufs[k], len) == 0);
+    }
+
+    if (mode == utils::CipherMode::GCM) {
+      a[3] ^= 1;
+      assert(cipher.Open(a.data(), sealed, out.data()) == 0);
+      enc_bufs[4][sealed - 1] ^= 1;  // nonce
+      assert(!cipher.OpenBatch(enc_bufs, sealed, len, dec_bufs));
+      assert(utils::CipherEngine(utils::GenerateKey(), mode).Open(b.data(), sealed, out.data()) == 0);
+    }
+  }
+  static_assert(utils::SealedLen(100, utils::CipherMode::CTR) == 112);
+  static_assert(utils::SealedLen(100, utils::CipherMode::GCM) == 128);
+  static_assert(PathORAMClient<B>::EncryptedBucketSize() == utils::SealedLen(PathORAMClient<B>::BucketSize()));
+  std::cout << "[PASSED] Cipher Engine Test" << std::endl;
+}
+
+#ifdef ORAM_64BIT_IDS
+// Keys, leaves and bucket ids past 2^32 survive every layer that stores them
+void test_wide_ids() {
+  const ORKey big = (1ULL << 40) + 3;
+  ExampleBlock b(big, random_gen::GenRandBytes<B>());
+  b.leaf = (1ULL << 36) + 1;
+  char buf[ExampleBlock::SerializedSize()];
+  b.serialize(buf);
+  ExampleBlock copy;
+  copy.deserialize(buf);
+  assert(copy.key == big && copy.leaf == b.leaf);
+
+  // Keys that only differ above bit 32 stay apart
+  common::Stash<B> stash;
+  stash.insert(ExampleBlock(big, b.val));
+  stash.insert(ExampleBlock(3, b.val));
+  assert(stash.size() == 2 && stash.find(big)->key == big && stash.scan(3)->key == 3);
+
+  // Leaves wider than 32 bits in the dense position map
+  const size_t l = 36;
+  const Leaf min_leaf = (1ULL << l) - 1;
+  common::DensePositionMap pm(16, l, min_leaf);
+  pm.set(5, min_leaf + (1ULL << 35) + 9);
+  assert(pm.get(5) == min_leaf + (1ULL << 35) + 9 && pm.get(4) >= min_leaf && pm.get(4) < min_leaf + 16);
+
+  assert(random_gen::generateRandomNumber(1ULL << 40) < (1ULL << 40));
+
+  // A bucket id past 2^32 lands past 2^32 buckets into the (sparse) file
+  const std::string path = "/tmp/test-wide-ids-storage";
+  std::filesystem::remove(path);
+  {
+    DiskStorage<char *, 16> disk(path);
+    char out[16], in[16];
+    std::memset(out, 0x5A, sizeof(out));
+    const ORBucketID id = (1ULL << 32) + 7;
+    disk.write_bucket(id, out);
+    disk.read_bucket(id, in);
+    assert(std::memcmp(in, out, sizeof(in)) == 0);
+    assert(std::filesystem::file_size(path) == DiskImageHeader::kSize + (id + 1) * 16);
+  }
+  std::filesystem::remove(path);
+
+  std::cout << "[PASSED] 64-bit ids" << std::endl;
+}
+#endif
+
+// Checks shared by the disk-backed storages. Batches come back in call order
+// whatever the layout: runs of adjacent buckets, bridged gaps and repeated
+// ids. The layout of an image survives reopening it without the flags it was
+// created with, and reads past or across the end of the image fail.
+template <typename Disk>
+void check_disk_storage(const std::string &path) {
+  constexpr size_t EBS = PathORAMClient<B>::EncryptedBucketSize();
+  std::vector<ORBucketID> ids = {40, 3, 4, 5, 200, 7, 0, 4000};
+  std::vector<std::vector<char>> in(ids.size(), std::vector<char>(EBS)), out(ids.size(), std::vector<char>(EBS));
+  std::vector<char *> in_ptrs, out_ptrs;
+  for (size_t i = 0; i < ids.size(); i++) {
+    std::memset(in[i].data(), static_cast<int>(0x10 + i), EBS);
+    in_ptrs.push_back(in[i].data());
+    out_ptrs.push_back(out[i].data());
+  }
+
+  for (bool direct : {false, true}) {
+    std::filesystem::remove(path);
+    {
+      Disk disk(path, direct, SyncPolicy::Interval, 2);
+      assert(disk.slot_size() == (direct ? Disk::kDirectAlignment : EBS));
+      disk.write_buckets(std::span<const ORBucketID>(ids), std::span<char *const>(in_ptrs));
+      // A repeated id in one batch: the last write wins
+      std::vector<ORBucketID> twice = {5, 5};
+      std::vector<char *> twice_ptrs = {in_ptrs[0], in_ptrs[1]};
+      disk.write_buckets(std::span<const ORBucketID>(twice), std::span<char *const>(twice_ptrs));
+    }
+    auto expected = in;
+    expected[3] = in[1];
+    const size_t data_offset = direct ? Disk::kDirectAlignment : DiskImageHeader::kSize;
+    assert(std::filesystem::file_size(path) == data_offset + 4001 * (direct ? Disk::kDirectAlignment : EBS));
+
+    Disk reopened(path);
+    assert(reopened.slot_size() == (direct ? Disk::kDirectAlignment : EBS));
+    std::vector<ORBucketID> reversed(ids.rbegin(), ids.rend());
+    std::reverse(out_ptrs.begin(), out_ptrs.end());
+    reopened.read_buckets(std::span<const ORBucketID>(reversed), std::span<char *const>(out_ptrs));
+    std::reverse(out_ptrs.begin(), out_ptrs.end());
+    assert(out == expected);
+
+    // Unwritten buckets between written ones read as zeros; past the end fails
+    reopened.read_bucket(41, out_ptrs[0]);
+    assert(std::all_of(out[0].begin(), out[0].end(), [](char c) { return c == 0; }));
+    bool failed = false;
+    try {
+      reopened.read_bucket(5000, out_ptrs[0]);
+    } catch (const std::runtime_error &) {
+      failed = true;
+    }
+    assert(failed);
+    failed = false;
+    try {
+      std::vector<ORBucketID> past_end = {4000, 5000};
+      reopened.read_buckets(std::span<const ORBucketID>(past_end), std::span<char *const>(out_ptrs.data(), 2));
+    } catch (const std::runtime_error &) {
+      failed = true;
+    }
+    assert(failed);
+    // A run that crosses the end of the file: the read comes back short,
+    // then empty
+    failed = false;
+    try {
+      std::vector<ORBucketID> across_end = {3999, 4001};
+      reopened.read_buckets(std::span<const ORBucketID>(across_end), std::span<char *const>(out_ptrs.data(), 2));
+    } catch (const std::runtime_error &) {
+      failed = true;
+    }
+    assert(failed);
+  }
+  std::filesystem::remove(path);
+}
+
+void test_posix_disk_storage() {
+  check_disk_storage<DiskStorage<ExampleEncryptedBucket, PathORAMClient<B>::EncryptedBucketSize()>>(
+      "/tmp/test-posix-disk-storage");
+  std::cout << "[PASSED] POSIX Disk Storage Test" << std::endl;
+}
+
+// Mmap storage: persists in the disk image format, reopens without a size,
+// and serves a Path ORAM (whose batches prefetch their paths)
+void test_mmap_storage() {
+  constexpr size_t EBS = PathORAMClient<B>::EncryptedBucketSize();
+  using Mmap = MmapStorage<ExampleEncryptedBucket, EBS>;
+  using Disk = DiskStorage<ExampleEncryptedBucket, EBS>;
+  const std::string path = "/tmp/test-mmap-storage";
+  std::vector<ORBucketID> ids = {40, 3, 4, 5, 200, 7, 0, 4000};
+  std::vector<std::vector<char>> in(ids.size(), std::vector<char>(EBS)), out(ids.size(), std::vector<char>(EBS));
+  std::vector<char *> in_ptrs, out_ptrs;
+  for (size_t i = 0; i < ids.size(); i++) {
+    std::memset(in[i].data(), static_cast<int>(0x20 + i), EBS);
+    in_ptrs.push_back(in[i].data());
+    out_ptrs.push_back(out[i].data());
+  }
+
+  std::filesystem::remove(path);
+  bool refused = false;
+  try {
+    Mmap unsized(path);
+  } catch (const std::invalid_argument &) {
+    refused = true;
+  }
+  assert(refused);
+  std::filesystem::remove(path);
+  {
+    Mmap mmap(path, 4001, SyncPolicy::Interval, 2);
+    assert(mmap.num_buckets() == 4001);
+    mmap.write_buckets(std::span<const ORBucketID>(ids), std::span<char *const>(in_ptrs));
+    std::vector<ORBucketID> twice = {5, 5};
+    std::vector<char *> twice_ptrs = {in_ptrs[0], in_ptrs[1]};
+    mmap.write_buckets(std::span<const ORBucketID>(twice), std::span<char *const>(twice_ptrs));
+  }
+  auto expected = in;
+  expected[3] = in[1];
+  assert(std::filesystem::file_size(path) == DiskImageHeader::kSize + 4001 * EBS);
+
+  // Same image as the disk storage, both ways
+  {
+    Disk disk(path);
+    disk.read_buckets(std::span<const ORBucketID>(ids), std::span<char *const>(out_ptrs));
+    assert(out == expected);
+    disk.write_bucket(41, in_ptrs[7]);
+  }
+  Mmap reopened(path);
+  assert(reopened.num_buckets() == 4001);
+  reopened.prefetch(std::span<const ORBucketID>(ids));
+  reopened.read_buckets(std::span<const ORBucketID>(ids), std::span<char *const>(out_ptrs));
+  assert(out == expected);
+  reopened.read_bucket(41, out_ptrs[0]);
+  assert(out[0] == in[7]);
+  reopened.read_bucket(42, out_ptrs[0]);
+  assert(std::all_of(out[0].begin(), out[0].end(), [](char c) { return c == 0; }));
+  refused = false;
+  try {
+    reopened.read_bucket(4001, out_ptrs[0]);
+  } catch (const std::out_of_range &) {
+    refused = true;
+  }
+  assert(refused);
+
+  // Null buffers are refused, a batch before any bucket is copied
+  std::vector<char *> with_null = {in_ptrs[7], nullptr};
+  std::vector<ORBucketID> pair = {ids[0], ids[1]};
+  std::vector<std::function<void()>> null_calls = {
+      [&] { reopened.write_bucket(ids[0], nullptr); },
+      [&] { reopened.read_bucket(ids[0], nullptr); },
+      [&] { reopened.write_buckets(std::span<const ORBucketID>(pair), std::span<char *const>(with_null)); },
+      [&] { reopened.read_buckets(std::span<const ORBucketID>(pair), std::span<char *const>(with_null)); },
+  };
+  for (auto &call : null_calls) {
+    refused = false;
+    try {
+      call();
+    } catch (const std::invalid_argument &) {
+      refused = true;
+    }
+    assert(refused);
+  }
+  reopened.read_bucket(ids[0], out_ptrs[0]);
+  assert(out[0] == expected[0]);
+  std::filesystem::remove(path);
+
+  // A Path ORAM on it, through the server config
+  const size_t n = 1 << 10;
+  const std::string oram_path = "/tmp/test-mmap-oram";
+  std::filesystem::remove(oram_path);
+  {
+    ServerConfig config{ServerConfig::StorageType::Mmap, oram_path, PathORAMClient<B>::NumBuckets(n)};
+    auto channel = std::make_shared<channel::PathORAMChannel<ExampleEncryptedBucket, EBS>>(config);
+    std::unique_ptr<PathORAMClient<B>> oram(PathORAMClient<B>::Construct(n, channel, utils::GenerateKey()).value());
+    std::vector<common::Block<B>> blocks;
+    for (size_t i = 0; i < n; i++) {
+      blocks.push_back(common::Block<B>(i, random_gen::GenRandBytes<B>()));
+    }
+    auto init_blocks = blocks;
+    oram->Init(init_blocks);
+    std::vector<ORKey> keys = {5, 900, 17};
+    std::vector<common::Block<B>> batch;
+    oram->AccessBatch(keys, {AccessOp::Read, AccessOp::Read, AccessOp::Read}, batch);
+    for (size_t i = 0; i < keys.size(); i++) {
+      assert(batch[i].key == keys[i] && std::memcmp(batch[i].val, blocks[keys[i]].val, B) == 0);
+    }
+  }
+  std::filesystem::remove(oram_path);
+  std::cout << "[PASSED] Mmap Storage Test" << std::endl;
+}
+
+#ifdef ORAM_IO_URING
+void test_uring_storage() {
+  constexpr size_t EBS = PathORAMClient<B>::EncryptedBucketSize();
+  using Uring = UringStorage<ExampleEncryptedBucket, EBS>;
+  check_disk_storage<Uring>("/tmp/test-uring-storage");
+
+  // Threads drive rings of their own; a thread alternates between storages
+  const std::string path_a = "/tmp/test-uring-storage-a", path_b = "/tmp/test-uring-storage-b";
+  std::filesystem::remove(path_a);
+  std::filesystem::remove(path_b);
+  {
+    Uring a(path_a), b(path_b, true);
+    auto fill = [&](Uring &storage, int seed, ORBucketID first) {
+      std::vector<ORBucketID> ids;
+      std::vector<std::vector<char>> bufs(300, std::vector<char>(EBS));
+      std::vector<char *> ptrs;
+      for (size_t i = 0; i < bufs.size(); i++) {
+        ids.push_back(first + 3 * i);
+        std::memset(bufs[i].data(), seed + static_cast<int>(i), EBS);
+        ptrs.push_back(bufs[i].data());
+      }
+      storage.write_buckets(std::span<const ORBucketID>(ids), std::span<char *const>(ptrs));
+      std::vector<std::vector<char>> got(bufs.size(), std::vector<char>(EBS));
+      std::vector<char *> got_ptrs;
+      for (auto &g : got) {
+        got_ptrs.push_back(g.data());
+      }
+      storage.read_buckets(std::span<const ORBucketID>(ids), std::span<char *const>(got_ptrs));
+      assert(got == bufs);
+    };
+    std::thread t1([&] { fill(a, 1, 0); });
+    std::thread t2([&] { fill(a, 2, 1); });
+    t1.join();
+    t2.join();
+    for (int round = 0; round < 3; round++) {
+      fill(a, 3 + round, 2);
+      fill(b, 7 + round, 2);
+    }
+  }
+  std::filesystem::remove(path_a);
+  std::filesystem::remove(path_b);
+  std::cout << "[PASSED] io_uring Storage Test" << std::endl;
+}
+#endif
+
 void printBufferHex(const char *buffer, size_t size, const std::string &label) {
   std::cout << label << " (" << size << " bytes): ";
   for (size_t i = 0; i < size; i++) {
@@ -208,9 +790,9 @@ void test_disk_storage() {
   
   for (int i = 0; i < 100; i++) {
     ExampleBucket bucket;
-    auto f_ = random_gen::generateRandomNumber(Z);
+    auto f_ = random_gen::generateRandomNumber(common::kDefaultZ);
     bucket.flags_ = f_;
-    for (int k = 0; k < Z; k++) {
+    for (size_t k = 0; k < common::kDefaultZ; k++) {
       std::memset(bucket.blocks_[k].val, 0xAA + i, B);
       bucket.blocks_[k].key = random_gen::generateRandomNumber(100);
     }
@@ -225,8 +807,8 @@ void test_disk_storage() {
     buckets[i].serialize(bu_ser);
     char *en_bu =
         (char *)malloc(PathORAMClient<B>::EncryptedBucketSize() * sizeof(char));
-    auto success =
-        utils::Encrypt(bu_ser, PathORAMClient<B>::BucketSize(), key, en_bu);
+    utils::CipherEngine cipher(key);
+    auto success = cipher.Seal(bu_ser, PathORAMClient<B>::BucketSize(), en_bu);
     if (!success) {
       std::cerr << "[DISK] Encryption failed!" << std::endl;
       return;
@@ -248,8 +830,7 @@ void test_disk_storage() {
 
     char *dec_bu =
         (char *)malloc(PathORAMClient<B>::BucketSize() * sizeof(char));
-    auto plen = utils::Decrypt(
-        retrieved, PathORAMClient<B>::EncryptedBucketSize(), key, dec_bu);
+    auto plen = cipher.Open(retrieved, PathORAMClient<B>::EncryptedBucketSize(), dec_bu);
     ExampleBucket verificator;
     verificator.deserialize(dec_bu);
 
@@ -258,7 +839,7 @@ void test_disk_storage() {
 
     assert(buckets[i].flags_ == verificator.flags_);
 
-    for (int k = 0; k < Z; k++) {
+    for (size_t k = 0; k < common::kDefaultZ; k++) {
       assert(buckets[i].blocks_[k].key == verificator.blocks_[k].key);
       assert(std::memcmp(buckets[i].blocks_[k].val, verificator.blocks_[k].val,
                          B) == 0);
@@ -278,7 +859,21 @@ int main() {
   microbenchmark_block_move();
   microbenchmarks_block();
   microbenchmarks_bucket();
+  test_stash();
+  test_bucket_arena();
+  test_simd_scan();
+  test_random_gen();
+  test_cipher_engine();
   test_memory_storage();
+  test_arena_storage();
+  test_posix_disk_storage();
+  test_mmap_storage();
+#ifdef ORAM_IO_URING
+  test_uring_storage();
+#endif
+#ifdef ORAM_64BIT_IDS
+  test_wide_ids();
+#endif
   // test_disk_storage();
   return 0;
 }
\ No newline at end of file
@@ -239,15 +239,21 @@ void thread_wait_for_others(threadpool_context_t* ctx) {
   synch_spinlock_unlock(&ctx->ctx_lock);
 }
 
+// Waits under ctx_lock_online, the lock thread_come_online broadcasts under:
+// with any other lock the last thread can come online between the check and
+// the wait, and the waiter sleeps forever. A pool released before a slow
+// waiter rechecks has threads going offline again, so the count alone would
+// never be reached: release ends the wait too.
 void thread_wait_all_online(threadpool_context_t* ctx) {
-  synch_spinlock_lock(&ctx->lock_thread_work);
-  while (__atomic_load_n(&ctx->num_threads_online, __ATOMIC_ACQUIRE) < ctx->num_threads) {
-    synch_cond_wait(&ctx->cond_all_threads_online, &ctx->lock_thread_work);
+  synch_spinlock_lock(&ctx->ctx_lock_online);
+  while (__atomic_load_n(&ctx->num_threads_online, __ATOMIC_ACQUIRE) < ctx->num_threads &&
+         !__atomic_load_n(&ctx->work_done, __ATOMIC_ACQUIRE)) {
+    synch_cond_wait(&ctx->cond_all_threads_online, &ctx->ctx_lock_online);
   }
-  synch_spinlock_unlock(&ctx->lock_thread_work);
+  synch_spinlock_unlock(&ctx->ctx_lock_online);
 }
 
-void thread_release_all(threadpool_context_t* ctx) { ctx->work_done = true; }
+void thread_release_all(threadpool_context_t* ctx) { __atomic_store_n(&ctx->work_done, true, __ATOMIC_RELEASE); }
 
 void thread_unrelease_all(threadpool_context_t* ctx) { ctx->work_done = false; }
 
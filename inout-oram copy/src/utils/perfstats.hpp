@@ -1,6 +1,7 @@
 #pragma once
 
 #include <atomic>
+#include <string>
 
 #include "ext/tinyformat.hpp"
 
@@ -29,7 +30,7 @@ struct TimingsField {
       mean_time = 0; // avoid nan
     }
     // return tfm::format("%.6f s (%05.2f %%) (n=%d)", time_s(), pct, count);
-    return tfm::format("total=%.6fs u=%.6fms (%05.2f %%) (n=%d)", time_s(), mean_time * 1e3, pct, count);
+    return tfm::format("total=%.6fs u=%.6fms (%05.2f %%) (n=%d)", time_s(), mean_time * 1e3, pct, count.load());
   }
 };
 
@@ -37,6 +38,11 @@ struct TimingsField {
   PERF.FIELD.time_ns += SW.elapsed_ns() - START_TIME;                                                                  \
   PERF.FIELD.count++;
 
+// One timing for N items processed as a batch
+#define TIMINGS_SAMPLE_N(PERF, SW, FIELD, N)                                                                           \
+  PERF.FIELD.time_ns += SW.elapsed_ns();                                                                               \
+  PERF.FIELD.count += N;
+
 #define TIMINGS_SAMPLE_AT(PERF, FIELD, START_TIME, END_TIME)                                                           \
   PERF.FIELD.time_ns += END_TIME - START_TIME;                                                                         \
   PERF.FIELD.count++;
@@ -44,12 +50,33 @@ struct TimingsField {
 struct NumberField {
   std::atomic<uint64_t> total_value = 0;
   std::atomic<uint64_t> count = 0;
+  std::atomic<uint64_t> max_value = 0;
+
+  void reset() {
+    total_value = 0;
+    count = 0;
+    max_value = 0;
+  }
+
+  inline void observe_max(uint64_t value) {
+    uint64_t cur = max_value.load(std::memory_order_relaxed);
+    while (value > cur && !max_value.compare_exchange_weak(cur, value, std::memory_order_relaxed)) {
+    }
+  }
 
-  inline double mean() const { return total_value / static_cast<double>(count); }
+  inline double mean() const {
+    if (count == 0) {
+      return 0; // avoid nan
+    }
+    return total_value / static_cast<double>(count);
+  }
 
-  inline std::string summary() const { return tfm::format("mean=%.6f (n=%d)", mean(), count); }
+  inline std::string summary() const {
+    return tfm::format("mean=%.6f max=%d (n=%d)", mean(), max_value.load(), count.load());
+  }
 };
 
 #define NUMBER_SAMPLE(PERF, FIELD, VALUE)                                                                              \
   PERF.FIELD.total_value += VALUE;                                                                                     \
+  PERF.FIELD.observe_max(VALUE);                                                                                       \
   PERF.FIELD.count++;